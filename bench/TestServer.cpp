@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "TestServer.hpp"
+
+namespace
+{
+    constexpr size_t PATTERN_PERIOD = 65521; // Prime, so misplaced data only lines up by coincidence
+    constexpr size_t SEND_CHUNK = 256 * 1024;
+
+    const unsigned char *pattern()
+    {
+        static const std::vector<unsigned char> table = []
+        {
+            std::vector<unsigned char> bytes(PATTERN_PERIOD);
+            uint32_t state = 2463534242u;
+            for (auto &byte : bytes)
+            {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                byte = static_cast<unsigned char>(state);
+            }
+            return bytes;
+        }();
+        return table.data();
+    }
+
+    // What one request asked for, after applying the query string to the server defaults
+    struct ResponsePlan
+    {
+        bool head = false;
+        int64_t size = 0;
+        std::chrono::milliseconds latency{0};
+        int64_t rate = 0;
+        bool ranges = true;
+        bool ifRange = true;     // Serve the whole file when If-Range names an older version
+        int64_t rangeStart = -1; // -1 without a Range header
+        int64_t rangeEnd = -1;   // Inclusive; -1 for the end of the file
+        int version = 0;
+
+        // Faults, only set for the first requests of a name; offsets are -1 when unset
+        int64_t drop = -1;
+        int64_t truncate = -1;
+        int64_t stall = -1;
+        std::chrono::milliseconds stallDuration{0};
+        int status = 0;
+        int64_t retryAfter = -1;
+    };
+
+    int64_t queryValue(const std::string &query, const char *key, int64_t fallback)
+    {
+        std::string needle = std::string(key) + "=";
+        size_t pos = 0;
+        while ((pos = query.find(needle, pos)) != std::string::npos)
+        {
+            if (pos == 0 || query[pos - 1] == '&')
+                return std::strtoll(query.c_str() + pos + needle.size(), nullptr, 10);
+            pos += needle.size();
+        }
+        return fallback;
+    }
+
+    std::string headerValue(const std::string &request, const char *name)
+    {
+        std::string needle = std::string("\r\n") + name + ":";
+        auto it = std::search(request.begin(), request.end(), needle.begin(), needle.end(),
+                              [](char a, char b)
+                              { return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b)); });
+        if (it == request.end())
+            return "";
+
+        size_t start = static_cast<size_t>(it - request.begin()) + needle.size();
+        size_t end = request.find("\r\n", start);
+        std::string value = request.substr(start, end - start);
+        value.erase(0, value.find_first_not_of(' '));
+        return value;
+    }
+
+    std::string statusLine(int status)
+    {
+        switch (status)
+        {
+        case 200:
+            return "HTTP/1.1 200 OK\r\n";
+        case 206:
+            return "HTTP/1.1 206 Partial Content\r\n";
+        case 304:
+            return "HTTP/1.1 304 Not Modified\r\n";
+        case 416:
+            return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        case 429:
+            return "HTTP/1.1 429 Too Many Requests\r\n";
+        case 503:
+            return "HTTP/1.1 503 Service Unavailable\r\n";
+        default:
+            return "HTTP/1.1 " + std::to_string(status) + " Injected Fault\r\n";
+        }
+    }
+
+    // Closes the socket with a reset instead of a clean shutdown, discarding unread data at the client
+    void resetConnection(int fd)
+    {
+        linger option{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &option, sizeof(option));
+        close(fd);
+    }
+
+    bool sendAll(int fd, const char *data, size_t length)
+    {
+        while (length > 0)
+        {
+            ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+TestServer::TestServer(const TestServerOptions &options) : _options(options) {}
+
+TestServer::~TestServer()
+{
+    stop();
+}
+
+// Listens on an ephemeral loopback port and forks the serving process
+bool TestServer::start(std::string &error)
+{
+    void *shared = mmap(nullptr, sizeof(Counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        error = std::string("mmap: ") + std::strerror(errno);
+        return false;
+    }
+    _counters = new (shared) Counters();
+
+    _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (_listenFd < 0 ||
+        bind(_listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(_listenFd, 512) != 0 ||
+        getsockname(_listenFd, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    {
+        error = std::string("cannot listen: ") + std::strerror(errno);
+        return false;
+    }
+    _port = ntohs(address.sin_port);
+
+    pattern(); // Built once, before the fork
+    _pid = fork();
+    if (_pid < 0)
+    {
+        error = std::string("fork: ") + std::strerror(errno);
+        return false;
+    }
+    if (_pid == 0)
+    {
+        serve();
+        _exit(0);
+    }
+
+    close(_listenFd);
+    _listenFd = -1;
+    return true;
+}
+
+void TestServer::stop()
+{
+    if (_pid > 0)
+    {
+        kill(_pid, SIGKILL);
+        waitpid(_pid, nullptr, 0);
+        _pid = -1;
+    }
+    if (_listenFd >= 0)
+    {
+        close(_listenFd);
+        _listenFd = -1;
+    }
+    if (_counters)
+    {
+        munmap(_counters, sizeof(Counters));
+        _counters = nullptr;
+    }
+}
+
+std::string TestServer::url(const std::string &name, int64_t size, const std::string &query) const
+{
+    return "http://127.0.0.1:" + std::to_string(_port) + "/" + name + "?size=" + std::to_string(size) +
+           (query.empty() ? "" : "&" + query);
+}
+
+int64_t TestServer::getBytesSent() const
+{
+    return _counters ? _counters->bytesSent.load() : 0;
+}
+
+int64_t TestServer::getRequests() const
+{
+    return _counters ? _counters->requests.load() : 0;
+}
+
+// Writes the bytes of any synthetic file from the given offset: a table of PATTERN_PERIOD bytes,
+// XORed with the number of whole periods before each byte and with the content version
+void TestServer::fillContent(int64_t offset, char *buffer, size_t length, int version)
+{
+    const unsigned char *table = pattern();
+    while (length > 0)
+    {
+        size_t index = static_cast<size_t>(offset % PATTERN_PERIOD);
+        auto mask = static_cast<unsigned char>(offset / PATTERN_PERIOD + version * 97);
+        size_t count = std::min(length, PATTERN_PERIOD - index);
+
+        for (size_t i = 0; i < count; ++i)
+            buffer[i] = static_cast<char>(table[index + i] ^ mask);
+
+        buffer += count;
+        offset += static_cast<int64_t>(count);
+        length -= count;
+    }
+}
+
+// Checks that a downloaded file has the expected size and content
+bool TestServer::verifyFile(const std::string &path, int64_t size, int version)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    std::vector<char> actual(SEND_CHUNK), expected(SEND_CHUNK);
+    int64_t offset = 0;
+    bool matches = true;
+    size_t n;
+    while (matches && (n = std::fread(actual.data(), 1, actual.size(), file)) > 0)
+    {
+        fillContent(offset, expected.data(), n, version);
+        matches = std::memcmp(actual.data(), expected.data(), n) == 0;
+        offset += static_cast<int64_t>(n);
+    }
+    std::fclose(file);
+    return matches && offset == size;
+}
+
+// ------------------------------------------------------------------------------
+// Private methods, run in the server process
+// ------------------------------------------------------------------------------
+
+void TestServer::serve()
+{
+    std::signal(SIGPIPE, SIG_IGN);
+    while (true)
+    {
+        int client = accept4(_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+            continue;
+        std::thread(&TestServer::handleConnection, this, client).detach();
+    }
+}
+
+// Returns how many earlier requests named the same file
+int TestServer::countRequest(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(_namesMutex);
+    return _requestsByName[name]++;
+}
+
+// Serves requests on one connection until the client closes it or a fault ends it
+void TestServer::handleConnection(int fd)
+{
+    std::string buffer;
+    std::vector<char> body(SEND_CHUNK);
+    char chunk[8192];
+
+    while (true)
+    {
+        size_t headerEnd;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+        {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+            {
+                close(fd);
+                return;
+            }
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+        std::string request = buffer.substr(0, headerEnd + 2);
+        buffer.erase(0, headerEnd + 4);
+        _counters->requests.fetch_add(1);
+
+        // Request line: METHOD /name?query HTTP/1.1
+        size_t methodEnd = request.find(' ');
+        size_t targetEnd = request.find(' ', methodEnd + 1);
+        std::string target = request.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+        size_t queryStart = target.find('?');
+        std::string query = queryStart == std::string::npos ? "" : target.substr(queryStart + 1);
+        int earlierRequests = countRequest(target.substr(0, queryStart));
+
+        ResponsePlan plan;
+        plan.head = request.compare(0, methodEnd, "HEAD") == 0;
+        plan.size = queryValue(query, "size", 0);
+        plan.latency = std::chrono::milliseconds(queryValue(query, "latency", _options.latency.count()));
+        plan.rate = queryValue(query, "rate", _options.rate);
+        plan.ranges = queryValue(query, "ranges", _options.ranges ? 1 : 0) != 0;
+        plan.ifRange = queryValue(query, "ifrange", 1) != 0;
+
+        int64_t change = queryValue(query, "change", 0);
+        plan.version = change > 0 && earlierRequests >= change ? 1 : 0;
+        if (earlierRequests < queryValue(query, "faults", 1))
+        {
+            plan.drop = queryValue(query, "drop", -1);
+            plan.truncate = queryValue(query, "truncate", -1);
+            plan.stall = queryValue(query, "stall", -1);
+            plan.stallDuration = std::chrono::milliseconds(queryValue(query, "stallms", 0));
+            plan.status = static_cast<int>(queryValue(query, "status", 0));
+            plan.retryAfter = queryValue(query, "retryafter", -1);
+        }
+
+        std::string etag = "\"v" + std::to_string(plan.version) + "\"";
+        std::string lastModified = plan.version == 0 ? "Mon, 05 Jan 2026 10:00:00 GMT" : "Tue, 06 Jan 2026 10:00:00 GMT";
+        std::string ifRange = headerValue(request, "If-Range");
+        bool rangeValid = !plan.ifRange || ifRange.empty() || ifRange == etag || ifRange == lastModified;
+        std::string ifNoneMatch = headerValue(request, "If-None-Match");
+        std::string ifModifiedSince = headerValue(request, "If-Modified-Since");
+        bool notModified = !ifNoneMatch.empty() ? ifNoneMatch == etag : ifModifiedSince == lastModified;
+
+        std::string range = headerValue(request, "Range");
+        if (plan.ranges && rangeValid && range.rfind("bytes=", 0) == 0)
+        {
+            char *end = nullptr;
+            plan.rangeStart = std::strtoll(range.c_str() + 6, &end, 10);
+            if (end && *end == '-' && end[1] != '\0')
+                plan.rangeEnd = std::strtoll(end + 1, nullptr, 10);
+        }
+
+        if (plan.latency.count() > 0)
+            std::this_thread::sleep_for(plan.latency);
+
+        int64_t first = 0, last = plan.size - 1;
+        std::string headers;
+        if (plan.status != 0)
+        {
+            headers = statusLine(plan.status);
+            if (plan.retryAfter >= 0)
+                headers += "Retry-After: " + std::to_string(plan.retryAfter) + "\r\n";
+            headers += "Content-Length: 0\r\n\r\n";
+            last = -1;
+        }
+        else if (notModified)
+        {
+            headers = statusLine(304) + "ETag: " + etag + "\r\nLast-Modified: " + lastModified + "\r\n\r\n";
+            last = -1;
+        }
+        else if (plan.rangeStart >= 0 && plan.rangeStart >= plan.size)
+        {
+            headers = statusLine(416) + "Content-Range: bytes */" + std::to_string(plan.size) +
+                      "\r\nContent-Length: 0\r\n\r\n";
+            last = -1;
+        }
+        else if (plan.rangeStart >= 0)
+        {
+            first = plan.rangeStart;
+            if (plan.rangeEnd >= 0)
+                last = std::min(plan.rangeEnd, plan.size - 1);
+            headers = statusLine(206) + "Content-Range: bytes " + std::to_string(first) + "-" +
+                      std::to_string(last) + "/" + std::to_string(plan.size) + "\r\n";
+        }
+        else
+        {
+            headers = statusLine(200);
+        }
+
+        if (last >= first)
+        {
+            headers += "Content-Type: application/octet-stream\r\n";
+            headers += plan.ranges ? "Accept-Ranges: bytes\r\n" : "Accept-Ranges: none\r\n";
+            headers += "ETag: " + etag + "\r\n";
+            headers += "Last-Modified: " + lastModified + "\r\n";
+            headers += "Content-Length: " + std::to_string(last - first + 1) + "\r\n\r\n";
+        }
+        if (!sendAll(fd, headers.data(), headers.size()))
+            break;
+        if (plan.head)
+            continue;
+
+        // Shaped by sleeping until each chunk is due at the requested rate
+        auto start = std::chrono::steady_clock::now();
+        int64_t sent = 0;
+        for (int64_t offset = first; offset <= last;)
+        {
+            if (offset == plan.drop)
+            {
+                resetConnection(fd);
+                return;
+            }
+            if (offset == plan.truncate)
+            {
+                close(fd);
+                return;
+            }
+            if (offset == plan.stall)
+            {
+                std::this_thread::sleep_for(plan.stallDuration);
+                start += plan.stallDuration;
+            }
+
+            // Chunks end at the next fault, so that it happens at exactly its offset
+            int64_t end = last + 1;
+            for (int64_t faultOffset : {plan.drop, plan.truncate, plan.stall})
+            {
+                if (faultOffset > offset)
+                    end = std::min(end, faultOffset);
+            }
+
+            size_t count = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(body.size()), end - offset));
+            if (plan.rate > 0)
+                count = static_cast<size_t>(std::clamp<int64_t>(plan.rate / 20, 1, static_cast<int64_t>(count)));
+
+            fillContent(offset, body.data(), count, plan.version);
+            if (!sendAll(fd, body.data(), count))
+            {
+                close(fd);
+                return;
+            }
+            _counters->bytesSent.fetch_add(static_cast<int64_t>(count));
+            offset += static_cast<int64_t>(count);
+            sent += static_cast<int64_t>(count);
+
+            if (plan.rate > 0)
+                std::this_thread::sleep_until(start + std::chrono::microseconds(sent * 1000000 / plan.rate));
+        }
+    }
+    close(fd);
+}
@@ -0,0 +1,85 @@
+#ifndef TESTSERVER_HPP
+#define TESTSERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+
+// Defaults for every response; each request can override them in its query string
+struct TestServerOptions
+{
+    std::chrono::milliseconds latency{0}; // Delay before the response headers
+    int64_t rate = 0;                     // Bytes per second per connection; 0 is unlimited
+    bool ranges = true;                   // Honour Range requests and advertise Accept-Ranges
+};
+
+// Local HTTP/1.1 server standing in for remote hosts in the benchmarks
+//
+// Files are synthetic: a request names its size and any overrides in the query string,
+//   /<name>?size=<bytes>&latency=<ms>&rate=<bytes per second>&ranges=0
+// and every byte is a function of its offset and version (see fillContent), so downloads are verified
+// without storing anything. GET and HEAD are served, with single Range requests and keep-alive.
+//
+// Faults are injected into the first `faults` requests for a name (1 by default), counted per name:
+//   drop=<offset>             reset the connection once the body reaches that file offset
+//   truncate=<offset>         close the connection cleanly at that offset, short of the Content-Length
+//   stall=<offset>&stallms=<ms>  stop sending at that offset for a while, keeping the connection open
+//   status=<code>&retryafter=<s> answer with an error status and a Retry-After header instead
+// and change=<n> serves version 1 of the content, with a new ETag and Last-Modified, from the
+// request after the first n.
+//
+// A Range request with an If-Range header that matches neither the current ETag nor Last-Modified is
+// answered with the whole file, as HTTP requires; ifrange=0 ignores If-Range like a careless server.
+// A request whose If-None-Match, or failing that If-Modified-Since, names the current version is
+// answered with 304 Not Modified.
+//
+// The server runs in a child process so that its CPU time is not charged to the benchmark;
+// start it before the benchmark creates any threads. Counters live in memory shared with the child.
+class TestServer
+{
+public:
+    explicit TestServer(const TestServerOptions &options = TestServerOptions());
+    ~TestServer();
+
+    TestServer(const TestServer &) = delete;
+    TestServer &operator=(const TestServer &) = delete;
+
+    bool start(std::string &error);
+    void stop();
+
+    std::string url(const std::string &name, int64_t size, const std::string &query = "") const;
+
+    int64_t getBytesSent() const;
+    int64_t getRequests() const;
+
+    static void fillContent(int64_t offset, char *buffer, size_t length, int version = 0);
+    static bool verifyFile(const std::string &path, int64_t size, int version = 0);
+
+private:
+    struct Counters
+    {
+        std::atomic<int64_t> bytesSent{0}; // Body bytes written to sockets
+        std::atomic<int64_t> requests{0};
+    };
+
+    void serve();
+    void handleConnection(int fd);
+    int countRequest(const std::string &name);
+
+    TestServerOptions _options;
+    int _listenFd = -1;
+    int _port = 0;
+    pid_t _pid = -1;
+    Counters *_counters = nullptr;
+
+    // Only used in the server process
+    std::mutex _namesMutex;
+    std::map<std::string, int> _requestsByName;
+};
+
+#endif
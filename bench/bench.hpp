@@ -0,0 +1,64 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+// Minimal timing helpers shared by the benchmarks; results are printed one line per case
+
+namespace bench
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Keeps the optimiser from discarding a computed value
+    template <typename T>
+    inline void doNotOptimize(const T &value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    inline double secondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Reads a positive integer from argv[index], falling back to a default
+    inline long argOr(int argc, char **argv, int index, long fallback)
+    {
+        if (index < argc)
+        {
+            long value = std::strtol(argv[index], nullptr, 10);
+            if (value > 0)
+                return value;
+        }
+        return fallback;
+    }
+
+    // Points HOME at a fresh directory so that a DownloadManager created by a benchmark
+    // neither reads nor overwrites the user's state; returns the directory
+    inline std::string useTemporaryHome()
+    {
+        char directory[] = "/tmp/sdm-bench-XXXXXX";
+        if (!mkdtemp(directory))
+        {
+            std::perror("mkdtemp");
+            std::exit(1);
+        }
+        setenv("HOME", directory, 1);
+        return directory;
+    }
+
+    inline void report(const std::string &name, double seconds, double operations, const char *unit)
+    {
+        std::printf("%-40s %10.3f ms %12.2f ns/%s\n",
+                    name.c_str(),
+                    seconds * 1e3,
+                    operations > 0 ? seconds * 1e9 / operations : 0.0,
+                    unit);
+    }
+}
+
+#endif
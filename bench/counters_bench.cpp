@@ -0,0 +1,127 @@
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bench.hpp"
+#include "core/DownloadTask.hpp"
+
+// Compares the per-task counter layout before and after splitting the hot counters onto their own
+// cache line. Each writer thread plays one transfer's progress callback; a reader thread plays the UI,
+// repeatedly scanning every task's metadata and counters.
+//
+// usage: bench_counters [tasks] [updates per task]
+
+namespace
+{
+    // Layout before: adjacent doubles next to the metadata, tasks packed back to back
+    struct PackedTask
+    {
+        TaskId id{0};
+        const char *url{nullptr};
+        std::atomic<double> totalBytes{0.0};
+        std::atomic<double> bytesDownloaded{0.0};
+        std::atomic<double> progress{0.0};
+        std::atomic<double> resumeOffset{0.0};
+    };
+
+    // Layout after: the same metadata followed by the padded counters
+    struct PaddedTask
+    {
+        TaskId id{0};
+        const char *url{nullptr};
+        TransferCounters counters;
+    };
+
+    void update(PackedTask &task, int64_t now)
+    {
+        double offset = task.resumeOffset.load(std::memory_order_relaxed);
+        double total = 1e9 + offset;
+        if (total > task.totalBytes.load(std::memory_order_relaxed))
+            task.totalBytes.store(total, std::memory_order_relaxed);
+        double downloaded = static_cast<double>(now) + offset;
+        task.progress.store(downloaded / total * 100.0, std::memory_order_relaxed);
+        task.bytesDownloaded.store(downloaded, std::memory_order_relaxed);
+    }
+
+    void update(PaddedTask &task, int64_t now)
+    {
+        TransferCounters &counters = task.counters;
+        int64_t offset = counters.resumeOffset.load(std::memory_order_relaxed);
+        int64_t total = 1000000000 + offset;
+        if (total > counters.totalBytes.load(std::memory_order_relaxed))
+            counters.totalBytes.store(total, std::memory_order_relaxed);
+        counters.bytesDownloaded.store(now + offset, std::memory_order_relaxed);
+    }
+
+    double read(const PackedTask &task)
+    {
+        return static_cast<double>(task.id) + (task.url ? 1 : 0) +
+               task.bytesDownloaded.load(std::memory_order_relaxed) +
+               task.progress.load(std::memory_order_relaxed);
+    }
+
+    double read(const PaddedTask &task)
+    {
+        return static_cast<double>(task.id) + (task.url ? 1 : 0) +
+               static_cast<double>(task.counters.bytesDownloaded.load(std::memory_order_relaxed));
+    }
+
+    template <typename Task>
+    void run(const char *name, size_t taskCount, long updates)
+    {
+        std::unique_ptr<Task[]> tasks(new Task[taskCount]);
+        for (size_t i = 0; i < taskCount; ++i)
+        {
+            tasks[i].id = i + 1;
+            tasks[i].url = name;
+        }
+
+        std::atomic<bool> writing{true};
+        std::atomic<long> scans{0};
+        std::thread reader([&]
+                           {
+            double sink = 0.0;
+            while (writing.load(std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < taskCount; ++i)
+                    sink += read(tasks[i]);
+                scans.fetch_add(1, std::memory_order_relaxed);
+            }
+            bench::doNotOptimize(sink); });
+
+        auto start = bench::Clock::now();
+        std::vector<std::thread> writers;
+        for (size_t i = 0; i < taskCount; ++i)
+        {
+            writers.emplace_back([&, i]
+                                 {
+                for (long n = 1; n <= updates; ++n)
+                    update(tasks[i], n); });
+        }
+        for (auto &writer : writers)
+            writer.join();
+        double elapsed = bench::secondsSince(start);
+
+        writing.store(false);
+        reader.join();
+
+        bench::report(name, elapsed, static_cast<double>(updates) * taskCount, "update");
+        std::printf("%-40s %10ld UI scans\n", "", scans.load());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t hardware = std::thread::hardware_concurrency();
+    size_t taskCount = static_cast<size_t>(bench::argOr(argc, argv, 1, hardware > 1 ? hardware - 1 : 1));
+    long updates = bench::argOr(argc, argv, 2, 5000000);
+
+    std::printf("%zu tasks, %ld updates each, sizeof packed=%zu padded=%zu\n",
+                taskCount, updates, sizeof(PackedTask), sizeof(PaddedTask));
+
+    run<PackedTask>("packed atomic<double> counters", taskCount, updates);
+    run<PaddedTask>("cache-line padded int64 counters", taskCount, updates);
+    return 0;
+}
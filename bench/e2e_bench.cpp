@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "TestServer.hpp"
+#include "core/DownloadManager.hpp"
+
+// Downloads synthetic files from a local TestServer through a headless DownloadManager:
+//   - large:  1 x 10 GB
+//   - medium: 100 x 100 MB
+//   - small:  100,000 x 4 KB
+//   - resume: 1 x 1 GB, the downloading process killed halfway and the download resumed by a new manager
+//   - duplicate: 20 x 64 MB, each URL queued 5 times with different destinations, as concurrent
+//     pipelines asking for the same artifacts would; reports how many bytes the server sent per byte written
+//   - cached: 20 x 64 MB downloaded twice with the download cache enabled; reports the second round,
+//     which should be served from the cache after 304 replies
+// Each scenario reports throughput, client CPU time per GB and the p50/p99 time per file, and checks
+// every byte written. The divisor shrinks a scenario for quick runs: it divides the number of files,
+// or the file size for the single-file scenarios.
+//
+// Files are written to a temporary directory under the working directory and removed afterwards.
+//
+// usage: bench_e2e [large|medium|small|resume|duplicate|cached|all] [divisor] [concurrency]
+
+namespace
+{
+    constexpr int64_t MB = 1024 * 1024;
+    constexpr int64_t GB = 1024 * MB;
+
+    struct Scenario
+    {
+        const char *name;
+        long files;
+        int64_t size;
+    };
+
+    const Scenario SCENARIOS[] = {
+        {"large", 1, 10 * GB},
+        {"medium", 100, 100 * MB},
+        {"small", 100000, 4096},
+    };
+
+    struct RunResult
+    {
+        double seconds = 0;
+        double cpuSeconds = 0;
+        long completed = 0;
+        long failed = 0;
+        std::vector<int64_t> latenciesUs; // Time of each file's final request
+    };
+
+    double cpuSecondsUsed()
+    {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+               static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    double percentileMs(std::vector<int64_t> values, double fraction)
+    {
+        if (values.empty())
+            return 0.0;
+        std::sort(values.begin(), values.end());
+        size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * static_cast<double>(values.size())));
+        return static_cast<double>(values[index]) / 1e3;
+    }
+
+    int64_t fileSize(const std::string &path)
+    {
+        struct stat info{};
+        return stat(path.c_str(), &info) == 0 ? static_cast<int64_t>(info.st_size) : 0;
+    }
+
+    std::string fileName(const std::string &directory, long index)
+    {
+        return directory + "/file" + std::to_string(index) + ".bin";
+    }
+
+    // Drives the manager until nothing is queued or running, the way the batch mode does
+    void drive(DownloadManager &manager)
+    {
+        while (!manager.getQueued().empty() || !manager.getActive().empty())
+        {
+            pollfd fd{manager.getEventFd(), POLLIN, 0};
+            auto timeout = std::min<long long>(manager.timeUntilNextUpdate().count(), 100);
+            poll(&fd, 1, static_cast<int>(std::max<long long>(timeout, 0)));
+            manager.consumeEventSignal();
+            manager.update();
+        }
+    }
+
+    void collectResults(DownloadManager &manager, RunResult &result)
+    {
+        manager.setTaskFinishedCallback([&result](const DownloadTask &task)
+                                        {
+            if (task.getStatus() == DownloadStatus::COMPLETED)
+                result.completed++;
+            else
+                result.failed++;
+            result.latenciesUs.push_back(task.getTimings().totalUs); });
+    }
+
+    // Checks every file against the server's content and removes it; returns the number that differ
+    long verifyAndRemove(const std::string &directory, long files, int64_t size)
+    {
+        long corrupt = 0;
+        for (long i = 0; i < files; ++i)
+        {
+            std::string path = fileName(directory, i);
+            if (!TestServer::verifyFile(path, size))
+                corrupt++;
+            unlink(path.c_str());
+        }
+        return corrupt;
+    }
+
+    void printResult(const char *name, long files, int64_t size, const RunResult &result, long corrupt)
+    {
+        double gigabytes = static_cast<double>(files) * static_cast<double>(size) / static_cast<double>(GB);
+        std::printf("%-8s %7ld files x %-12lld %9.2f s %9.1f MB/s %8.3f CPU s/GB  p50 %8.2f ms  p99 %8.2f ms  %ld failed  %ld corrupt\n",
+                    name, files, static_cast<long long>(size),
+                    result.seconds,
+                    gigabytes * 1024.0 / std::max(result.seconds, 1e-9),
+                    result.cpuSeconds / std::max(gigabytes, 1e-9),
+                    percentileMs(result.latenciesUs, 0.50),
+                    percentileMs(result.latenciesUs, 0.99),
+                    result.failed, corrupt);
+    }
+
+    void runScenario(TestServer &server, const Scenario &scenario, const std::string &directory, long divisor, size_t concurrency)
+    {
+        long files = scenario.files > 1 ? std::max(scenario.files / divisor, 1L) : scenario.files;
+        int64_t size = scenario.files > 1 ? scenario.size : std::max<int64_t>(scenario.size / divisor, 1);
+
+        ManagerOptions options;
+        options.concurrency = concurrency;
+        options.persistent = false;
+
+        RunResult result;
+        {
+            DownloadManager manager(options);
+            collectResults(manager, result);
+
+            double cpuStart = cpuSecondsUsed();
+            auto start = bench::Clock::now();
+            for (long i = 0; i < files; ++i)
+                manager.queueDownload(server.url(scenario.name + std::to_string(i), size), fileName(directory, i));
+            drive(manager);
+            result.seconds = bench::secondsSince(start);
+            result.cpuSeconds = cpuSecondsUsed() - cpuStart;
+        }
+
+        printResult(scenario.name, files, size, result, verifyAndRemove(directory, files, size));
+    }
+
+    // Starts the download in a child process, kills it once half the file is on disk,
+    // then lets a new manager pick the task up from the saved state
+    void runResume(TestServer &server, const std::string &directory, long divisor, size_t concurrency)
+    {
+        int64_t size = std::max<int64_t>(GB / divisor, 1);
+        int64_t rate = std::max<int64_t>(size / 4, 1); // Leaves time for the state to be saved before the kill
+        std::string path = fileName(directory, 0);
+        std::string url = server.url("resume", size, "rate=" + std::to_string(rate));
+
+        ManagerOptions options;
+        options.concurrency = concurrency;
+        options.persistent = true;
+
+        int64_t sentBefore = server.getBytesSent();
+        pid_t child = fork();
+        if (child == 0)
+        {
+            DownloadManager manager(options);
+            manager.queueDownload(url, path);
+            drive(manager);
+            _exit(0);
+        }
+
+        while (fileSize(path) < size / 2 && waitpid(child, nullptr, WNOHANG) == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+        int64_t restartOffset = fileSize(path);
+
+        RunResult result;
+        {
+            DownloadManager manager(options);
+            collectResults(manager, result);
+
+            double cpuStart = cpuSecondsUsed();
+            auto start = bench::Clock::now();
+            drive(manager);
+            result.seconds = bench::secondsSince(start);
+            result.cpuSeconds = cpuSecondsUsed() - cpuStart;
+        }
+
+        if (result.completed + result.failed == 0)
+            std::printf("resume   the restarted manager found no task to resume\n");
+        printResult("resume", 1, size, result, verifyAndRemove(directory, 1, size));
+        std::printf("%-8s restarted at %lld of %lld bytes, %lld bytes downloaded twice\n", "",
+                    static_cast<long long>(restartOffset), static_cast<long long>(size),
+                    static_cast<long long>(server.getBytesSent() - sentBefore - size));
+    }
+
+    // Queues every URL several times, each copy to its own file, and checks every copy
+    void runDuplicates(TestServer &server, const std::string &directory, long divisor, size_t concurrency)
+    {
+        const long urls = 20, copies = 5;
+        int64_t size = std::max<int64_t>(64 * MB / divisor, 1);
+
+        ManagerOptions options;
+        options.concurrency = concurrency;
+        options.persistent = false;
+
+        RunResult result;
+        int64_t sentBefore = server.getBytesSent();
+        {
+            DownloadManager manager(options);
+            collectResults(manager, result);
+
+            double cpuStart = cpuSecondsUsed();
+            auto start = bench::Clock::now();
+            for (long copy = 0; copy < copies; ++copy)
+            {
+                for (long i = 0; i < urls; ++i)
+                    manager.queueDownload(server.url("duplicate" + std::to_string(i), size), fileName(directory, copy * urls + i));
+            }
+            drive(manager);
+            result.seconds = bench::secondsSince(start);
+            result.cpuSeconds = cpuSecondsUsed() - cpuStart;
+        }
+
+        long files = urls * copies;
+        printResult("duplicate", files, size, result, verifyAndRemove(directory, files, size));
+        std::printf("%-8s %lld bytes sent for %lld bytes written (%.2fx)\n", "",
+                    static_cast<long long>(server.getBytesSent() - sentBefore), static_cast<long long>(files * size),
+                    static_cast<double>(server.getBytesSent() - sentBefore) / static_cast<double>(files * size));
+    }
+
+    // Deletes the download cache the managers created under the temporary home
+    void removeCache()
+    {
+        std::string cache = DownloadManager::getStateFilePath(SDM_CACHE_DIRECTORY);
+        std::string objects = cache + "/objects";
+        if (DIR *dir = opendir(objects.c_str()))
+        {
+            while (dirent *item = readdir(dir))
+                unlink((objects + "/" + item->d_name).c_str());
+            closedir(dir);
+        }
+        rmdir(objects.c_str());
+        unlink((cache + "/index").c_str());
+        rmdir(cache.c_str());
+    }
+
+    // Downloads the same URLs twice with the cache enabled and reports the second round, which the
+    // server should answer with 304 replies alone
+    void runCached(TestServer &server, const std::string &directory, long divisor, size_t concurrency)
+    {
+        const long urls = 20;
+        int64_t size = std::max<int64_t>(64 * MB / divisor, 1);
+
+        ManagerOptions options;
+        options.concurrency = concurrency;
+        options.persistent = false;
+        options.cacheBytes = 2 * urls * size;
+
+        RunResult result;
+        int64_t sentBefore = 0;
+        for (int round = 0; round < 2; ++round)
+        {
+            result = RunResult();
+            sentBefore = server.getBytesSent();
+            DownloadManager manager(options);
+            collectResults(manager, result);
+
+            double cpuStart = cpuSecondsUsed();
+            auto start = bench::Clock::now();
+            for (long i = 0; i < urls; ++i)
+                manager.queueDownload(server.url("cached" + std::to_string(i), size), fileName(directory, round * urls + i));
+            drive(manager);
+            result.seconds = bench::secondsSince(start);
+            result.cpuSeconds = cpuSecondsUsed() - cpuStart;
+        }
+
+        printResult("cached", urls, size, result, verifyAndRemove(directory, 2 * urls, size));
+        std::printf("%-8s %lld bytes sent for %lld bytes written in the second round\n", "",
+                    static_cast<long long>(server.getBytesSent() - sentBefore), static_cast<long long>(urls * size));
+        removeCache();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string which = argc > 1 ? argv[1] : "all";
+    long divisor = bench::argOr(argc, argv, 2, 1);
+    auto concurrency = static_cast<size_t>(bench::argOr(argc, argv, 3, static_cast<long>(SDM_DEFAULT_CONCURRENCY)));
+
+    // Forked before the manager creates any threads
+    TestServer server;
+    std::string error;
+    if (!server.start(error))
+    {
+        std::fprintf(stderr, "test server: %s\n", error.c_str());
+        return 1;
+    }
+
+    bench::useTemporaryHome();
+    char directory[] = "sdm-e2e-XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        std::perror("mkdtemp");
+        return 1;
+    }
+
+    std::printf("divisor %ld, %zu concurrent transfers\n", divisor, concurrency);
+    bool known = false;
+    for (const auto &scenario : SCENARIOS)
+    {
+        if (which == "all" || which == scenario.name)
+        {
+            runScenario(server, scenario, directory, divisor, concurrency);
+            known = true;
+        }
+    }
+    if (which == "all" || which == "resume")
+    {
+        runResume(server, directory, divisor, concurrency);
+        known = true;
+    }
+    if (which == "all" || which == "duplicate")
+    {
+        runDuplicates(server, directory, divisor, concurrency);
+        known = true;
+    }
+    if (which == "all" || which == "cached")
+    {
+        runCached(server, directory, divisor, concurrency);
+        known = true;
+    }
+
+    rmdir(directory);
+    if (!known)
+    {
+        std::fprintf(stderr, "unknown scenario: %s\n", which.c_str());
+        return 1;
+    }
+    return 0;
+}
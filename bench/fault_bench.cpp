@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "TestServer.hpp"
+#include "core/DownloadManager.hpp"
+
+// Downloads one file per scenario from a TestServer that injects a fault into the first request(s),
+// and checks how well the download recovers:
+//   - the file must end up intact
+//   - the bytes the server sent beyond one copy of the file must stay under the scenario's limit, plus
+//     IN_FLIGHT_ALLOWANCE for data the kernel had buffered when a connection broke
+//   - the download must finish within the scenario's time limit
+// A failed task is retried the way a user would, with the manager's retry command, up to
+// MANUAL_RETRIES times. The exit status is 1 if any scenario misses its limits.
+//
+// usage: bench_faults [size in MB] [scenario]
+
+namespace
+{
+    constexpr int64_t MB = 1024 * 1024;
+    constexpr int MANUAL_RETRIES = 5;
+    constexpr int64_t IN_FLIGHT_ALLOWANCE = 8 * MB; // Loopback socket buffers hold several MB
+
+    struct FaultScenario
+    {
+        const char *name;
+        const char *description;
+        std::string query;      // Fault parameters for the test server
+        int version;            // Content version the finished file must match
+        double maxRedownloaded; // Fraction of the file the server may send more than once
+        double maxSeconds;
+        bool pauseHalfway;      // Pause and resume the task once half the file is on disk
+    };
+
+    std::vector<FaultScenario> buildScenarios(int64_t size)
+    {
+        std::string half = std::to_string(size / 2);
+        std::string rate = std::to_string(size / 2); // Two seconds for the whole file
+        return {
+            {"pause", "paused at 50% and resumed", "rate=" + rate, 0, 0.05, 10, true},
+            {"drop", "connection reset at 50%", "drop=" + half, 0, 0.10, 10, false},
+            {"truncate", "body cut short at 50%", "truncate=" + half, 0, 0.05, 10, false},
+            {"stall", "no data for 60 s at 50%", "stall=" + half + "&stallms=60000", 0, 0.10, 30, false},
+            {"503", "503 with Retry-After: 1, twice", "status=503&retryafter=1&faults=2", 0, 0.0, 10, false},
+            {"429", "429 with Retry-After: 1", "status=429&retryafter=1", 0, 0.0, 10, false},
+            {"norange", "Range ignored, reset at 50%", "ranges=0&drop=" + half, 0, 0.5, 10, false},
+            {"changed", "content changed after a reset at 50%", "change=1&drop=" + half, 1, 0.5, 10, false},
+            {"ifrange", "changed as above, If-Range ignored", "change=1&ifrange=0&drop=" + half, 1, 0.5, 10, false},
+        };
+    }
+
+    struct FaultResult
+    {
+        bool finished = false;
+        bool intact = false;
+        int manualRetries = 0;
+        int64_t requests = 0;
+        int64_t redownloaded = 0;
+        double seconds = 0;
+    };
+
+    FaultResult runScenario(TestServer &server, const FaultScenario &scenario, int64_t size, const std::string &directory)
+    {
+        DownloadManager manager;
+        manager.clearHistory();
+
+        std::string finalPath;
+        bool failed = false;
+        manager.setTaskFinishedCallback([&](const DownloadTask &task)
+                                        {
+            if (task.getStatus() == DownloadStatus::COMPLETED)
+                finalPath = task.getDestination();
+            else
+                failed = true; });
+
+        FaultResult result;
+        int64_t sentBefore = server.getBytesSent();
+        int64_t requestsBefore = server.getRequests();
+        bool paused = false;
+
+        auto start = bench::Clock::now();
+        TaskId id = manager.queueDownload(server.url(scenario.name, size, scenario.query),
+                                          directory + "/" + scenario.name + ".bin");
+        while (finalPath.empty() && id != 0)
+        {
+            pollfd fd{manager.getEventFd(), POLLIN, 0};
+            poll(&fd, 1, 10);
+            manager.consumeEventSignal();
+            manager.update();
+
+            if (scenario.pauseHalfway && !paused)
+            {
+                auto task = manager.getTask(id);
+                if (task && task->getBytesDownloaded() >= size / 2 && manager.pauseDownload(id))
+                {
+                    manager.resumeDownload(id);
+                    paused = true;
+                }
+            }
+
+            if (failed)
+            {
+                failed = false;
+                if (result.manualRetries == MANUAL_RETRIES)
+                    break;
+                result.manualRetries++;
+                manager.retryAllDownloads();
+            }
+
+            if (manager.getQueued().empty() && manager.getActive().empty() && finalPath.empty() && !failed)
+                break; // Nothing left to wait for
+        }
+        result.seconds = bench::secondsSince(start);
+
+        result.finished = !finalPath.empty();
+        result.intact = result.finished && TestServer::verifyFile(finalPath, size, scenario.version);
+        result.requests = server.getRequests() - requestsBefore;
+        result.redownloaded = std::max<int64_t>(server.getBytesSent() - sentBefore - size, 0);
+        return result;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int64_t size = bench::argOr(argc, argv, 1, 64) * MB;
+    std::string which = argc > 2 ? argv[2] : "";
+
+    // Forked before the manager creates any threads
+    TestServer server;
+    std::string error;
+    if (!server.start(error))
+    {
+        std::fprintf(stderr, "test server: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::string directory = bench::useTemporaryHome() + "/downloads";
+    std::filesystem::create_directory(directory);
+
+    std::printf("%-9s %-38s %-6s %8s %8s %14s %9s\n", "scenario", "fault", "result", "retries", "requests", "re-downloaded", "seconds");
+    bool allPassed = true;
+    for (const auto &scenario : buildScenarios(size))
+    {
+        if (!which.empty() && which != scenario.name)
+            continue;
+
+        FaultResult result = runScenario(server, scenario, size, directory);
+        std::string failures;
+        if (!result.finished)
+            failures += " unfinished";
+        else if (!result.intact)
+            failures += " corrupt";
+        if (static_cast<double>(result.redownloaded) >
+            scenario.maxRedownloaded * static_cast<double>(size) + static_cast<double>(IN_FLIGHT_ALLOWANCE))
+            failures += " re-downloaded";
+        if (result.seconds > scenario.maxSeconds)
+            failures += " slow";
+        allPassed &= failures.empty();
+
+        std::printf("%-9s %-38s %-6s %8d %8lld %13.1f%% %9.2f%s\n",
+                    scenario.name, scenario.description, failures.empty() ? "ok" : "FAIL",
+                    result.manualRetries, static_cast<long long>(result.requests),
+                    100.0 * static_cast<double>(result.redownloaded) / static_cast<double>(size),
+                    result.seconds, failures.c_str());
+
+        for (const auto &entry : std::filesystem::directory_iterator(directory))
+            std::filesystem::remove(entry.path());
+    }
+
+    return allPassed ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "core/DownloadManager.hpp"
+#include "aux/StateSnapshot.hpp"
+#include "util/args.hpp"
+#include "util/file.hpp"
+
+// Times the paths that slow down as the number of tasks grows:
+//   - writing and reading the binary snapshot, on its own and through a manager's load and final save,
+//     at 1,000, 100,000 and 1,000,000 tasks
+//   - moving tasks between statuses with updateTaskStatus()
+//   - getUniqueFilename() when many earlier downloads already took the name
+//   - extractArguments() on typical command lines
+// Screen layout and the formatting helpers are covered by bench_render.
+//
+// usage: bench_micro [largest task count]
+
+namespace
+{
+    const long TASK_COUNTS[] = {1000, 100000, 1000000};
+
+    std::vector<TaskRecord> syntheticRecords(long count)
+    {
+        std::vector<TaskRecord> records(static_cast<size_t>(count));
+        time_t now = std::time(nullptr);
+        for (long i = 0; i < count; ++i)
+        {
+            TaskRecord &record = records[static_cast<size_t>(i)];
+            record.id = static_cast<uint64_t>(i + 1);
+            record.url = "https://example.com/files/paused-" + std::to_string(i) + ".bin";
+            record.destination = "paused-" + std::to_string(i) + ".bin";
+            record.bytesDownloaded = static_cast<double>((i * 4096) % 1000000);
+            record.totalBytes = 1000000.0;
+            record.status = static_cast<int>(DownloadStatus::PAUSED);
+            record.addedAt = now;
+        }
+        return records;
+    }
+
+    std::string taskLabel(const char *what, long count)
+    {
+        return std::string(what) + ", " + std::to_string(count) + " tasks";
+    }
+
+    // Serialisation alone, then the manager's own load on construction and final save on destruction
+    void persistence(long count)
+    {
+        std::string path = DownloadManager::getStateFilePath(SDM_STATE_FILENAME);
+        std::vector<TaskRecord> records = syntheticRecords(count);
+
+        auto start = bench::Clock::now();
+        snapshot::writeBinary(path, records);
+        bench::report(taskLabel("snapshot write", count), bench::secondsSince(start), static_cast<double>(count), "task");
+
+        size_t visited = 0;
+        start = bench::Clock::now();
+        snapshot::readBinary(path, [&visited](const TaskRecord &)
+                             { visited++; });
+        bench::report(taskLabel("snapshot read", count), bench::secondsSince(start), static_cast<double>(count), "task");
+        bench::doNotOptimize(visited);
+        records.clear();
+
+        start = bench::Clock::now();
+        auto manager = std::make_unique<DownloadManager>();
+        bench::report(taskLabel("manager load", count), bench::secondsSince(start), static_cast<double>(count), "task");
+
+        start = bench::Clock::now();
+        manager.reset();
+        bench::report(taskLabel("manager save on exit", count), bench::secondsSince(start), static_cast<double>(count), "task");
+
+        unlink(path.c_str());
+    }
+
+    // Resumes and pauses tasks spread across a registry of the given size
+    void statusTransitions(long count)
+    {
+        ManagerOptions options;
+        options.persistent = false;
+        DownloadManager manager(options);
+
+        std::string path = DownloadManager::getStateFilePath("transitions.txt");
+        snapshot::writeText(path, syntheticRecords(count));
+        manager.importState(path);
+        unlink(path.c_str());
+
+        std::vector<std::shared_ptr<DownloadTask>> tasks;
+        for (const auto &task : manager.getPaused())
+            tasks.push_back(task);
+        const long transitions = 200000;
+
+        auto start = bench::Clock::now();
+        for (long i = 0; i < transitions; i += 2)
+        {
+            auto &task = tasks[static_cast<size_t>(i * 7919) % tasks.size()]; // Not in registry order
+            manager.updateTaskStatus(task, DownloadStatus::QUEUED);
+            manager.updateTaskStatus(task, DownloadStatus::PAUSED);
+        }
+        bench::report(taskLabel("updateTaskStatus", count), bench::secondsSince(start), static_cast<double>(transitions), "call");
+    }
+
+    void uniqueFilenames(const std::string &directory, long collisions)
+    {
+        std::string path = directory + "/download.bin";
+        std::vector<std::string> created;
+        for (long i = 0; i <= collisions; ++i)
+        {
+            created.push_back(getUniqueFilename(path));
+            std::ofstream(created.back()).put('x');
+        }
+
+        const long calls = std::max(100000 / (collisions + 1), 10L);
+        auto start = bench::Clock::now();
+        for (long i = 0; i < calls; ++i)
+            bench::doNotOptimize(getUniqueFilename(path));
+        bench::report("getUniqueFilename, " + std::to_string(collisions) + " collisions",
+                      bench::secondsSince(start), static_cast<double>(calls), "call");
+
+        for (const auto &file : created)
+            unlink(file.c_str());
+    }
+
+    void arguments()
+    {
+        const char *commands[] = {
+            "pause 12",
+            "download https://example.com/releases/v1.2.3/archive.tar.gz",
+            "download https://example.com/files/report.pdf \"Quarterly Report (final).pdf\"",
+        };
+        const long calls = 1000000;
+
+        for (const char *command : commands)
+        {
+            std::string line = command;
+            auto start = bench::Clock::now();
+            for (long i = 0; i < calls; ++i)
+                bench::doNotOptimize(extractArguments(line, 2));
+            bench::report("extractArguments, " + std::to_string(line.size()) + " chars",
+                          bench::secondsSince(start), static_cast<double>(calls), "call");
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long largest = bench::argOr(argc, argv, 1, 1000000);
+    std::string home = bench::useTemporaryHome();
+
+    for (long count : TASK_COUNTS)
+    {
+        if (count <= largest)
+            persistence(count);
+    }
+    for (long count : TASK_COUNTS)
+    {
+        if (count <= largest)
+            statusTransitions(count);
+    }
+    for (long collisions : {0L, 10L, 100L, 1000L})
+        uniqueFilenames(home, collisions);
+    arguments();
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "bench.hpp"
+#include "aux/ThreadPool.hpp"
+
+// Compares the work-stealing ThreadPool with the single-queue pool it replaced, on short tasks
+// where the pool's own overhead dominates:
+//   - one thread submitting every task
+//   - several threads submitting at once
+//   - tasks that submit further tasks from inside the pool
+//   - submit() and waiting on each future, one at a time (work-stealing pool only)
+//
+// usage: bench_pool [workers] [tasks]
+
+namespace
+{
+    // The previous pool: one std::queue behind one mutex and condition variable
+    class SingleQueuePool
+    {
+    public:
+        explicit SingleQueuePool(size_t nThreads)
+        {
+            for (size_t i = 0; i < nThreads; ++i)
+                _workers.emplace_back(&SingleQueuePool::workerThread, this);
+        }
+
+        ~SingleQueuePool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(_queueMutex);
+                _stop = true;
+            }
+            _condition.notify_all();
+            for (auto &worker : _workers)
+                worker.join();
+        }
+
+        void enqueue(std::function<void()> f)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_queueMutex);
+                _tasks.push(std::move(f));
+            }
+            _condition.notify_one();
+        }
+
+    private:
+        void workerThread()
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(_queueMutex);
+                    _condition.wait(lock, [this]
+                                    { return _stop || !_tasks.empty(); });
+                    if (_stop && _tasks.empty())
+                        return;
+                    task = std::move(_tasks.front());
+                    _tasks.pop();
+                }
+                task();
+            }
+        }
+
+        std::vector<std::thread> _workers;
+        std::queue<std::function<void()>> _tasks;
+        std::mutex _queueMutex;
+        std::condition_variable _condition;
+        bool _stop = false;
+    };
+
+    void waitFor(const std::atomic<long> &done, long expected)
+    {
+        while (done.load(std::memory_order_acquire) < expected)
+            std::this_thread::yield();
+    }
+
+    // A little work per task, so that tasks are short but not empty
+    void spin(std::atomic<long> &done)
+    {
+        unsigned value = 1;
+        for (int i = 0; i < 64; ++i)
+            value = value * 1664525u + 1013904223u;
+        bench::doNotOptimize(value);
+        done.fetch_add(1, std::memory_order_release);
+    }
+
+    template <typename Pool>
+    void singleProducer(const char *name, size_t workers, long tasks)
+    {
+        Pool pool(workers);
+        std::atomic<long> done{0};
+
+        auto start = bench::Clock::now();
+        for (long i = 0; i < tasks; ++i)
+            pool.enqueue([&done]
+                         { spin(done); });
+        waitFor(done, tasks);
+        bench::report(name, bench::secondsSince(start), static_cast<double>(tasks), "task");
+    }
+
+    template <typename Pool>
+    void multiProducer(const char *name, size_t workers, long tasks)
+    {
+        Pool pool(workers);
+        std::atomic<long> done{0};
+        long perProducer = tasks / static_cast<long>(workers);
+
+        auto start = bench::Clock::now();
+        std::vector<std::thread> producers;
+        for (size_t p = 0; p < workers; ++p)
+        {
+            producers.emplace_back([&]
+                                   {
+                for (long i = 0; i < perProducer; ++i)
+                    pool.enqueue([&done]
+                                 { spin(done); }); });
+        }
+        for (auto &producer : producers)
+            producer.join();
+        waitFor(done, perProducer * static_cast<long>(workers));
+        bench::report(name, bench::secondsSince(start), static_cast<double>(perProducer * workers), "task");
+    }
+
+    // Each of a few root tasks submits its children from inside the pool
+    template <typename Pool>
+    void nested(const char *name, size_t workers, long tasks)
+    {
+        Pool pool(workers);
+        std::atomic<long> done{0};
+        long roots = static_cast<long>(workers) * 4;
+        long children = tasks / roots;
+
+        auto start = bench::Clock::now();
+        for (long r = 0; r < roots; ++r)
+        {
+            pool.enqueue([&]
+                         {
+                for (long i = 0; i < children; ++i)
+                    pool.enqueue([&done]
+                                 { spin(done); }); });
+        }
+        waitFor(done, roots * children);
+        bench::report(name, bench::secondsSince(start), static_cast<double>(roots * children), "task");
+    }
+
+    void futures(const char *name, size_t workers, long tasks)
+    {
+        ThreadPool pool(workers);
+        long sum = 0;
+
+        auto start = bench::Clock::now();
+        for (long i = 0; i < tasks; ++i)
+            sum += pool.submit([i]
+                               { return i; })
+                       .get();
+        bench::doNotOptimize(sum);
+        bench::report(name, bench::secondsSince(start), static_cast<double>(tasks), "task");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t hardware = std::thread::hardware_concurrency();
+    size_t workers = static_cast<size_t>(bench::argOr(argc, argv, 1, hardware > 1 ? static_cast<long>(hardware) : 2));
+    long tasks = bench::argOr(argc, argv, 2, 1000000);
+
+    std::printf("%zu workers, %ld tasks per case\n", workers, tasks);
+
+    singleProducer<SingleQueuePool>("single queue: one producer", workers, tasks);
+    singleProducer<ThreadPool>("work stealing: one producer", workers, tasks);
+    multiProducer<SingleQueuePool>("single queue: producer per worker", workers, tasks);
+    multiProducer<ThreadPool>("work stealing: producer per worker", workers, tasks);
+    nested<SingleQueuePool>("single queue: nested submissions", workers, tasks);
+    nested<ThreadPool>("work stealing: nested submissions", workers, tasks);
+    futures("work stealing: submit and wait", workers, tasks / 10);
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "bench.hpp"
+#include "core/DownloadManager.hpp"
+#include "ui/UI.hpp"
+#include "ui/ActiveScreen.hpp"
+#include "ui/HistoryScreen.hpp"
+#include "util/format.hpp"
+
+// Measures the cost of laying out the screen body for a manager holding many tasks, and of the
+// formatting helpers used on the render path. No terminal is needed: screens draw into a Frame, and the
+// full-frame case paints into a curses pad whose terminal output is discarded.
+//
+// usage: bench_render [tasks]
+
+namespace
+{
+    constexpr int VISIBLE_ROWS = 50;
+
+    // Writes an import file with the given number of paused tasks and as many completed ones
+    std::string writeSyntheticState(const std::string &directory, long taskCount)
+    {
+        std::string path = directory + "/synthetic.txt";
+        std::ofstream out(path);
+        time_t now = std::time(nullptr);
+
+        for (long i = 0; i < taskCount; ++i)
+        {
+            // url destination bytesDownloaded totalBytes status httpStatus errorCode addedAt endedAt id
+            out << "\"https://example.com/files/paused-" << i << ".bin\" \"paused-" << i << ".bin\" "
+                << (i * 4096) % 1000000 << " 1000000 2 0 0 " << now << " 0 " << i + 1 << "\n";
+            out << "\"https://example.com/files/done-" << i << ".bin\" \"done-" << i << ".bin\" "
+                << "1000000 1000000 3 200 0 " << now << " " << now - i << " 0\n";
+        }
+
+        return path;
+    }
+
+    // Draws the same viewport repeatedly and reports the time per frame
+    void drawFrames(const char *name, Screen &screen, int firstRow, int rowCount, long frames)
+    {
+        Frame frame;
+        int height = 0;
+
+        auto start = bench::Clock::now();
+        for (long i = 0; i < frames; ++i)
+        {
+            int currentRow = 0;
+            frame.reset(firstRow, rowCount);
+            screen.drawScreen(currentRow, frame);
+            height = currentRow;
+        }
+        bench::report(name, bench::secondsSince(start), static_cast<double>(frames), "frame");
+        bench::doNotOptimize(height);
+    }
+
+    // Lays out the viewport and writes every row into an off-screen pad, as UI does after a resize,
+    // then lets curses compute the terminal update; the terminal output goes to /dev/null
+    void drawCursesFrames(const char *name, Screen &screen, long frames)
+    {
+        FILE *output = std::fopen("/dev/null", "w");
+        FILE *input = std::fopen("/dev/null", "r");
+        SCREEN *terminal = newterm("xterm-256color", output, input);
+        if (!terminal)
+        {
+            std::fprintf(stderr, "%s: no terminfo entry for xterm-256color\n", name);
+            return;
+        }
+        resize_term(VISIBLE_ROWS, 160);
+        WINDOW *pad = newpad(VISIBLE_ROWS, 160);
+        Frame frame;
+
+        auto start = bench::Clock::now();
+        for (long i = 0; i < frames; ++i)
+        {
+            int currentRow = 0;
+            frame.reset(0, VISIBLE_ROWS);
+            screen.drawScreen(currentRow, frame);
+
+            werase(pad);
+            for (int row = 0; row < frame.getRowCount(); ++row)
+            {
+                const std::string &text = frame.getVisibleRow(row);
+                mvwaddnstr(pad, row, 0, text.c_str(), std::min(static_cast<int>(text.size()), 160));
+            }
+            pnoutrefresh(pad, 0, 0, 0, 0, VISIBLE_ROWS - 1, 159);
+            doupdate();
+        }
+        bench::report(name, bench::secondsSince(start), static_cast<double>(frames), "frame");
+
+        delwin(pad);
+        endwin();
+        delscreen(terminal);
+        std::fclose(output);
+        std::fclose(input);
+    }
+
+    // The ostringstream implementation formatBytes() had before it wrote into caller buffers
+    std::string formatBytesWithStream(double bytes)
+    {
+        std::ostringstream oss;
+        oss << std::fixed;
+        if (bytes < 1024.0 * 1024.0)
+            oss << std::setprecision(0) << (bytes / 1024.0) << " KB";
+        else
+            oss << std::setprecision(1) << (bytes / (1024.0 * 1024.0)) << " MB";
+        return oss.str();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long taskCount = bench::argOr(argc, argv, 1, 10000);
+    std::string home = bench::useTemporaryHome();
+
+    // Not destroyed at the end: teardown pauses and persists every task, which is not measured here
+    auto *manager = new DownloadManager();
+    manager->importState(writeSyntheticState(home, taskCount));
+    std::printf("%zu paused tasks, %zu history entries, state in %s\n",
+                manager->getPaused().size(),
+                manager->getHistory().count(HistoryQuery{}),
+                home.c_str());
+
+    UI ui(*manager); // Curses is only set up by UI::run()
+    ActiveScreen activeScreen(*manager, ui);
+    HistoryScreen historyScreen(*manager, ui);
+
+    int totalRows = static_cast<int>(taskCount) * TASK_ROWS + 8;
+    drawFrames("active screen, top viewport", activeScreen, 0, VISIBLE_ROWS, 20000);
+    drawFrames("active screen, scrolled to the middle", activeScreen, totalRows / 2, VISIBLE_ROWS, 20000);
+    drawFrames("active screen, every row visible", activeScreen, 0, totalRows, 20);
+    drawFrames("history screen, one page", historyScreen, 0, VISIBLE_ROWS, 20000);
+    drawCursesFrames("active screen, full frame into curses", activeScreen, 20000);
+
+    const long formats = 1000000;
+    char buffer[FORMAT_BYTES_SIZE];
+
+    auto start = bench::Clock::now();
+    for (long i = 0; i < formats; ++i)
+        bench::doNotOptimize(formatBytesWithStream(static_cast<double>(i) * 1031.0));
+    bench::report("formatBytes via ostringstream", bench::secondsSince(start), formats, "call");
+
+    start = bench::Clock::now();
+    for (long i = 0; i < formats; ++i)
+        bench::doNotOptimize(formatBytes(buffer, sizeof(buffer), static_cast<double>(i) * 1031.0));
+    bench::report("formatBytes into a buffer", bench::secondsSince(start), formats, "call");
+
+    char timeBuffer[FORMAT_TIME_SIZE];
+    time_t now = std::time(nullptr);
+    start = bench::Clock::now();
+    for (long i = 0; i < formats; ++i)
+        bench::doNotOptimize(formatTime(timeBuffer, sizeof(timeBuffer), now - i % 20)); // One history page
+    bench::report("formatTime, repeated timestamps", bench::secondsSince(start), formats, "call");
+
+    start = bench::Clock::now();
+    for (long i = 0; i < formats; ++i)
+        bench::doNotOptimize(formatTime(timeBuffer, sizeof(timeBuffer), now - i));
+    bench::report("formatTime, distinct timestamps", bench::secondsSince(start), formats, "call");
+
+    return 0;
+}
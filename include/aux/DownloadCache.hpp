@@ -0,0 +1,75 @@
+#ifndef DOWNLOADCACHE_HPP
+#define DOWNLOADCACHE_HPP
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <unordered_map>
+
+// A cached download: the object holding its content and the validators to revalidate it with
+struct CacheEntry
+{
+    std::string objectPath;
+    int64_t size{0};
+    std::string etag;
+    std::string lastModified;
+};
+
+// On-disk cache of completed downloads, shared by the workers
+//
+// Content is stored once per SHA-256 digest under objects/, so identical bodies served from different
+// URLs share storage, and an index maps each normalized URL to its object and validators. A cached URL
+// is fetched with a conditional request; a 304 reply is served by a reflink or a copy of the object, never
+// a hard link, so that no file outside the cache shares an object's inode. Objects are also read-only.
+// When the objects outgrow the capacity, the least recently used URLs are dropped along with objects no
+// other URL refers to
+class DownloadCache
+{
+public:
+    DownloadCache(const std::string &directory, int64_t capacityBytes);
+    ~DownloadCache();
+
+    DownloadCache(const DownloadCache &) = delete;
+    DownloadCache &operator=(const DownloadCache &) = delete;
+
+    bool lookup(const std::string &url, CacheEntry &entry) const;
+    void touch(const std::string &url);
+    bool store(const std::string &url, const std::string &path, const std::string &digest, int64_t size,
+               const std::string &etag, const std::string &lastModified);
+
+    int64_t getStoredBytes() const;
+
+private:
+    struct Entry
+    {
+        std::string digest;
+        int64_t size{0};
+        std::string etag;
+        std::string lastModified;
+        time_t lastUsed{0};
+    };
+
+    std::string _directory;
+    int64_t _capacity;
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, Entry> _entries; // By normalized URL
+    std::unordered_map<std::string, int> _objectRefs; // URLs referring to each digest
+    int64_t _storedBytes = 0;                         // Size of all objects
+    bool _dirty = false;                              // The entries differ from the saved index
+    std::chrono::steady_clock::time_point _lastSave{};
+    uint64_t _generation = 0;                         // Index contents formatted so far
+    std::mutex _saveMutex;                            // Orders the index writes; never taken with _mutex held
+    uint64_t _savedGeneration = 0;                    // Latest index contents written
+    std::atomic<uint64_t> _tempCounter{0};            // Names temporary copies, so that concurrent stores do not clash
+
+    std::string objectPath(const std::string &digest) const;
+    void load();
+    void saveIndex(bool force);
+    void release(const std::string &digest, int64_t size);
+    void evict(const std::string &keep);
+};
+
+#endif
@@ -12,8 +12,11 @@ public:
 
     bool isOpen() const;
     void write(const char* data, size_t size);
+    bool truncate();
+    bool close();
 
 private:
+    std::string _path;
     std::ofstream _out;
 };
 
@@ -0,0 +1,111 @@
+#ifndef HISTORYSTORE_HPP
+#define HISTORYSTORE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+
+#include "aux/StateSnapshot.hpp"
+
+static constexpr size_t HISTORY_STATUS_SLOTS = 8;
+
+// Criteria for selecting history entries; empty fields match anything
+struct HistoryQuery
+{
+    int status = -1;         // Status value to match, or -1 for any
+    std::string host;        // Exact (case-insensitive) URL host
+    std::string destination; // Exact destination path
+    time_t since = 0;        // Only entries that ended at or after this time
+};
+
+struct HistoryEntry
+{
+    uint64_t id;
+    TaskRecord record;
+};
+
+// Request phase times of the downloads from one host, summed over every timed request
+struct HostTimingSummary
+{
+    std::string host;
+    size_t downloads = 0;
+    size_t requests = 0; // Timed HEAD and GET requests
+    size_t redirects = 0;
+    int64_t lookupUs = 0;
+    int64_t connectUs = 0;
+    int64_t tlsUs = 0;
+    int64_t waitUs = 0;
+    size_t completedWithTimings = 0; // Completed downloads, whose final runs make up the transfer totals
+    int64_t transferUs = 0;
+    double transferBytes = 0; // Includes bytes of earlier runs for resumed downloads
+};
+
+// Append-only on-disk store of finished downloads
+// Records live in a data file; a fixed-size index entry per record (time, host, status, destination)
+// allows queries and paging without loading the history into memory
+class HistoryStore
+{
+public:
+    explicit HistoryStore(const std::string &path);
+    ~HistoryStore();
+
+    HistoryStore(const HistoryStore &) = delete;
+    HistoryStore &operator=(const HistoryStore &) = delete;
+
+    uint64_t append(const TaskRecord &record);
+    bool read(uint64_t id, TaskRecord &record) const;
+    bool remove(uint64_t id);
+    void clear();
+
+    std::vector<HistoryEntry> query(const HistoryQuery &query, size_t offset, size_t limit) const;
+    size_t count(const HistoryQuery &query) const;
+
+    size_t countByStatus(int status) const;
+    std::vector<HostTimingSummary> summarizeHosts(const HistoryQuery &query) const;
+    uint64_t getRevision() const { return _revision; }
+
+private:
+    struct IndexHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t reserved;
+        uint64_t statusCounts[HISTORY_STATUS_SLOTS];
+    };
+
+    struct IndexEntry
+    {
+        uint64_t offset;
+        int64_t endedAt;
+        uint32_t hostHash;
+        uint32_t destinationHash;
+        uint32_t length;
+        uint8_t status;
+        uint8_t flags;
+        uint16_t reserved;
+    };
+
+    std::string _dataPath;
+    std::string _indexPath;
+    int _dataFd = -1;
+    int _indexFd = -1;
+    uint64_t _dataSize = 0;
+    uint64_t _entryCount = 0;
+    int64_t _lastEndedAt = 0;
+    uint64_t _revision = 0;
+    IndexHeader _header{};
+
+    void open();
+    void close();
+    void writeHeader();
+
+    bool readEntry(uint64_t id, IndexEntry &entry) const;
+    bool matches(const IndexEntry &entry, const HistoryQuery &query, uint32_t hostHash, uint32_t destinationHash) const;
+
+    template <typename Visitor>
+    void scanNewestFirst(const HistoryQuery &query, Visitor visit) const;
+};
+
+#endif
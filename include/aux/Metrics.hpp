@@ -0,0 +1,90 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+static constexpr size_t METRICS_CURL_CODES = 128;    // Above every CURLcode value
+static constexpr size_t METRICS_HTTP_STATUSES = 600; // Status codes 0-599
+static constexpr size_t METRICS_MAX_BUCKETS = 12;    // Finite buckets per histogram
+
+enum class MetricsRequest
+{
+    HEAD, // Filename resolution before a download is queued
+    GET   // One run of a download
+};
+
+enum class MetricsHistogram
+{
+    DURATION,   // Seconds from the start of a completed run to its end
+    FIRST_BYTE, // Seconds from the start of a run to its first response byte
+    THROUGHPUT, // Average bytes per second of a completed run
+    COUNT
+};
+
+// Counters, gauges and histograms describing the downloads of one manager
+//
+// Every thread that records gets its own cache-line aligned shard, so the write path is a
+// relaxed load and store on memory no other thread writes: no locks and no contended lines.
+// render() sums the shards into the Prometheus text exposition format; it may run on any thread.
+class Metrics
+{
+public:
+    Metrics();
+
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+    // Write path, callable from any thread
+    void addBytes(int64_t bytes);
+    void recordRequest(MetricsRequest request);
+    void recordCompleted();
+    void recordFailure(int curlCode, int httpStatus);
+    void recordRetry();
+    void recordCacheHit();
+    void observe(MetricsHistogram histogram, double value);
+
+    // Gauges, set by the thread that owns the manager
+    void setTaskCounts(size_t queued, size_t active, size_t paused);
+
+    int64_t getBytesTransferred() const;
+    void render(std::string &out) const;
+
+private:
+    struct alignas(64) Shard
+    {
+        std::thread::id owner;
+        std::atomic<int64_t> bytes{0};
+        std::atomic<uint64_t> requests[2] = {};
+        std::atomic<uint64_t> completed{0};
+        std::atomic<uint64_t> failed{0};
+        std::atomic<uint64_t> retries{0};
+        std::atomic<uint64_t> cacheHits{0};
+        std::atomic<uint64_t> curlErrors[METRICS_CURL_CODES] = {};
+        std::atomic<uint64_t> httpErrors[METRICS_HTTP_STATUSES] = {};
+        std::atomic<uint64_t> buckets[static_cast<size_t>(MetricsHistogram::COUNT)][METRICS_MAX_BUCKETS + 1] = {};
+        std::atomic<double> sums[static_cast<size_t>(MetricsHistogram::COUNT)] = {};
+    };
+
+    Shard &localShard();
+
+    template <typename Reader>
+    uint64_t sum(Reader reader) const;
+
+    const uint64_t _instance; // Distinguishes managers in the per-thread shard cache
+
+    mutable std::mutex _shardsMutex; // Held when a thread records for the first time and while reading
+    std::vector<std::unique_ptr<Shard>> _shards;
+
+    std::atomic<size_t> _queued{0};
+    std::atomic<size_t> _active{0};
+    std::atomic<size_t> _paused{0};
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef METRICSEXPORTER_HPP
+#define METRICSEXPORTER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "aux/Metrics.hpp"
+#include "aux/Notifier.hpp"
+
+static constexpr std::chrono::seconds METRICS_DEFAULT_INTERVAL{10}; // Period of metrics file rewrites
+static constexpr size_t METRICS_MAX_REQUEST_LENGTH = 8 * 1024;
+
+// Publishes a Metrics registry from a background thread, so that scrapes never wait on the UI
+// Serves GET /metrics over HTTP on a loopback port, and/or rewrites a file periodically
+// (e.g. for the node_exporter textfile collector), replacing it atomically each time
+class MetricsExporter
+{
+public:
+    explicit MetricsExporter(const Metrics &metrics);
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter &) = delete;
+    MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+    bool start(int port, const std::string &filePath, std::chrono::milliseconds interval, std::string &error);
+    void stop();
+
+private:
+    void run();
+    void serveClient(int fd);
+    void writeFile();
+
+    const Metrics &_metrics;
+    int _listenFd = -1;
+    std::string _filePath;
+    std::chrono::milliseconds _interval{METRICS_DEFAULT_INTERVAL};
+
+    Notifier _stopNotifier;
+    std::atomic<bool> _stopping{false};
+    std::thread _thread;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef MPSCQUEUE_HPP
+#define MPSCQUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free multi-producer single-consumer queue (Vyukov)
+// Any thread may push; only one thread may call pop() and empty()
+template <typename T>
+class MpscQueue
+{
+public:
+    MpscQueue() : _head(&_stub), _tail(&_stub) {}
+
+    ~MpscQueue()
+    {
+        T discarded;
+        while (pop(discarded))
+        {
+        }
+
+        if (_tail != &_stub)
+            delete _tail;
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    // Publishes a value; wait-free for producers
+    void push(T value)
+    {
+        Node *node = new Node{{nullptr}, std::move(value)};
+        Node *prev = _head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // Takes the oldest value, returning false if none is visible yet
+    bool pop(T &out)
+    {
+        Node *tail = _tail;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+
+        out = std::move(next->value);
+        _tail = next;
+        if (tail != &_stub)
+            delete tail;
+        return true;
+    }
+
+    bool empty() const
+    {
+        return _tail->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node *> next;
+        T value;
+    };
+
+    Node _stub{{nullptr}, T{}};
+    std::atomic<Node *> _head; // Most recently pushed node, shared by producers
+    Node *_tail;               // Last consumed node, owned by the consumer
+};
+
+#endif
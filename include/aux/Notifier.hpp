@@ -0,0 +1,27 @@
+#ifndef NOTIFIER_HPP
+#define NOTIFIER_HPP
+
+#include <atomic>
+
+// Wakes a thread blocked in poll() from any other thread
+// Backed by a non-blocking self-pipe; notifications raised before the waiter drains are coalesced
+class Notifier
+{
+public:
+    Notifier();
+    ~Notifier();
+
+    Notifier(const Notifier &) = delete;
+    Notifier &operator=(const Notifier &) = delete;
+
+    void notify();
+    bool drain();
+
+    int getFd() const { return _fds[0]; }
+
+private:
+    int _fds[2] = {-1, -1};
+    std::atomic<bool> _signalled{false};
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SPEEDESTIMATOR_HPP
+#define SPEEDESTIMATOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Estimates transfer speed from a fixed ring of (steady clock, byte count) samples
+// One thread records samples; any thread may read the speed concurrently without locks
+class SpeedEstimator
+{
+public:
+    static constexpr size_t CAPACITY = 64;
+    static constexpr std::chrono::milliseconds SAMPLE_INTERVAL{100}; // Minimum spacing between samples
+    static constexpr std::chrono::seconds WINDOW{5};                 // Span the speed is averaged over
+
+    using Clock = std::chrono::steady_clock;
+
+    void record(Clock::time_point now, int64_t bytes);
+    void reset();
+
+    double bytesPerSecond() const;
+
+private:
+    // Each slot is guarded by a sequence counter that is odd while the writer is updating it
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence{0};
+        std::atomic<int64_t> timeNs{0};
+        std::atomic<int64_t> bytes{0};
+    };
+
+    bool readSlot(uint64_t index, int64_t &timeNs, int64_t &bytes) const;
+
+    Slot _slots[CAPACITY];
+    std::atomic<uint64_t> _count{0}; // Total samples written since the last reset
+    int64_t _lastRecordNs = 0;       // Writer-only
+};
+
+#endif
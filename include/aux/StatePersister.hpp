@@ -0,0 +1,66 @@
+#ifndef STATEPERSISTER_HPP
+#define STATEPERSISTER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "aux/StateSnapshot.hpp"
+
+// Tasks whose saved form changed since the previous submission
+struct StateChanges
+{
+    std::vector<std::pair<uint64_t, TaskRecord>> saved; // Records by their position in the snapshot
+    std::vector<uint64_t> removed;                      // Ids of tasks that are no longer saved
+};
+
+// Writes state snapshots on a background thread
+// The writer keeps its own copy of the saved tasks and is handed only what changed, so the caller
+// does work in proportion to the changes rather than to the number of tasks.
+// Changes are tracked with a dirty flag and coalesced so that at most one write happens per interval
+class StatePersister
+{
+public:
+    StatePersister(const std::string &path, std::chrono::milliseconds interval);
+    ~StatePersister();
+
+    void markDirty();
+    bool isDue() const;
+    std::chrono::milliseconds timeUntilDue() const;
+
+    void load(StateChanges changes);
+    void submit(StateChanges changes);
+    void flush(StateChanges changes);
+
+private:
+    void writerThread();
+    void apply(StateChanges &changes);
+    void write();
+
+    std::string _path;
+    std::chrono::milliseconds _interval;
+    std::chrono::steady_clock::time_point _lastSubmitTime;
+    std::atomic<bool> _dirty{false};
+
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::vector<StateChanges> _pending; // Submitted changes not yet applied, oldest first
+    bool _stop = false;
+
+    // The saved tasks in snapshot order, and the position of each by id
+    // Only the writer thread touches them, apart from load() before anything is submitted and flush()
+    // once the writer has stopped
+    std::map<uint64_t, TaskRecord> _saved;
+    std::unordered_map<uint64_t, uint64_t> _positions;
+
+    std::thread _writer; // Declared last so it starts after the state it waits on is constructed
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef STATESNAPSHOT_HPP
+#define STATESNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+
+// Phase times libcurl reports for one request, in microseconds since the request started
+// Each time is cumulative, so phases are the differences between consecutive fields; a phase the
+// request skipped (name lookup or connect on a reused connection, TLS over plain HTTP) stays zero
+struct TransferTimings
+{
+    int64_t nameLookupUs{0};    // Name resolved
+    int64_t connectUs{0};       // TCP connection established
+    int64_t appConnectUs{0};    // TLS handshake completed
+    int64_t startTransferUs{0}; // First response byte received
+    int64_t totalUs{0};         // Request finished
+    int32_t redirects{0};       // Redirects followed; the times above include them
+
+    bool isEmpty() const { return totalUs == 0; }
+
+    // Duration of each phase; a skipped phase takes no time
+    int64_t lookupPhaseUs() const { return nameLookupUs; }
+    int64_t connectPhaseUs() const { return phase(nameLookupUs, connectUs); }
+    int64_t tlsPhaseUs() const { return appConnectUs == 0 ? 0 : phase(connectUs, appConnectUs); }
+    int64_t waitPhaseUs() const { return phase(appConnectUs == 0 ? connectUs : appConnectUs, startTransferUs); }
+    int64_t transferPhaseUs() const { return phase(startTransferUs, totalUs); }
+
+private:
+    static int64_t phase(int64_t from, int64_t to) { return to > from ? to - from : 0; }
+};
+
+// Plain representation of a single persisted download task
+struct TaskRecord
+{
+    uint64_t id{0};
+    std::string url;
+    std::string destination;
+    double bytesDownloaded{0.0};
+    double totalBytes{0.0};
+    int status{0};
+    int httpStatus{0};
+    int errorCode{0};
+    time_t addedAt{0};
+    time_t endedAt{0};
+    TransferTimings headTimings; // Filename resolution request, if one was made
+    TransferTimings timings;     // Latest download run
+    std::string etag;            // Validators of the latest response, sent as If-Range when resuming
+    std::string lastModified;
+    std::vector<std::string> extraDestinations; // Later requests for the same URL, filled in on completion
+};
+
+using TaskRecordCallback = std::function<void(const TaskRecord &)>;
+using TaskRecordVisitor = std::function<void(const TaskRecordCallback &)>; // Calls its argument with each record
+
+namespace snapshot
+{
+    static constexpr char MAGIC[4] = {'S', 'D', 'M', 'S'};
+    static constexpr uint32_t VERSION = 5;
+
+    // On-disk form of TransferTimings with explicit padding, shared by the snapshot and history files
+    struct RawTimings
+    {
+        int64_t nameLookupUs;
+        int64_t connectUs;
+        int64_t appConnectUs;
+        int64_t startTransferUs;
+        int64_t totalUs;
+        int32_t redirects;
+        uint32_t reserved;
+    };
+
+    RawTimings toRaw(const TransferTimings &timings);
+    TransferTimings fromRaw(const RawTimings &raw);
+
+    // Extra destinations are stored in the binary files as one string, a line per destination
+    std::string joinDestinations(const std::vector<std::string> &destinations);
+    std::vector<std::string> splitDestinations(const std::string &joined);
+
+    // Returns true if the file at the given path starts with the binary snapshot header
+    bool isBinarySnapshot(const std::string &path);
+
+    // Binary snapshot: header, fixed-size records, then a string arena
+    // The reader maps the file into memory and visits every record in a single pass
+    bool readBinary(const std::string &path, const TaskRecordCallback &onRecord);
+    bool writeBinary(const std::string &path, const std::vector<TaskRecord> &records);
+    bool writeBinary(const std::string &path, size_t count, const TaskRecordVisitor &forEach);
+
+    // Legacy line-based text format, kept for import/export
+    bool readText(const std::string &path, const TaskRecordCallback &onRecord);
+    bool writeText(const std::string &path, const std::vector<TaskRecord> &records);
+}
+
+#endif
@@ -1,30 +1,89 @@
 #ifndef THREADPOOL_HPP
 #define THREADPOOL_HPP
 
-#include <vector>
-#include <queue>
+#include <deque>
+#include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <future>
 #include <condition_variable>
 #include <functional>
+#include <type_traits>
 
+static constexpr size_t THREADPOOL_MAX_WORKERS = 256;
+
+// Lanes of the pool's queues; a worker always runs the most urgent task it can find
+enum class TaskPriority
+{
+    HIGH,   // Short tasks that others wait on, e.g. metadata requests
+    NORMAL, // Transfers
+    LOW,    // Background work
+    COUNT
+};
+
+// Work-stealing thread pool
+//
+// Every worker owns a deque per priority lane. Tasks submitted from a worker go to its own deques,
+// other submissions are spread round-robin, and an idle worker steals from the others before it sleeps,
+// so no single lock is shared by every submission and every worker.
+// Tasks in one worker's lane start in submission order; across workers the order is not guaranteed.
 class ThreadPool
 {
 public:
     explicit ThreadPool(size_t nThreads);
     ~ThreadPool();
 
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
     size_t size() const;
-    void enqueue(std::function<void()> func);
+    void enqueue(std::function<void()> func, TaskPriority priority = TaskPriority::NORMAL);
+
+    // Runs func on the pool; the future yields its result or rethrows its exception
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F &&func, TaskPriority priority = TaskPriority::NORMAL)
+    {
+        using Result = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(func));
+        std::future<Result> result = task->get_future();
+        enqueue([task]()
+                { (*task)(); },
+                priority);
+        return result;
+    }
+
+    void resize(size_t nThreads);
+    void shutdown();
 
 private:
-    void workerThread();
+    // Slots are never freed while the pool exists, so other threads can scan them without a lock
+    struct Worker
+    {
+        std::mutex mutex; // Guards the deques; taken by the owner and by thieves
+        std::deque<std::function<void()>> lanes[static_cast<size_t>(TaskPriority::COUNT)];
+        std::atomic<size_t> queued[static_cast<size_t>(TaskPriority::COUNT)] = {}; // Lane sizes, read without the lock
+        std::atomic<bool> retiring{false}; // Set when the pool shrinks; the worker takes no new tasks
+        std::atomic<bool> exited{false};   // Its thread has returned and may be joined
+        std::thread thread;
+    };
+
+    void startWorker(size_t index);
+    void workerThread(size_t index);
+    bool takeTask(size_t index, std::function<void()> &task);
 
-    std::vector<std::thread> _workers;
-    std::queue<std::function<void()>> _tasks;
-    std::mutex _queueMutex;
+    std::unique_ptr<Worker> _workers[THREADPOOL_MAX_WORKERS];
+    std::atomic<size_t> _slots{0};      // Slots in use, including retired workers
+    std::atomic<size_t> _size{0};       // Workers that are not retiring
+    std::atomic<size_t> _nextWorker{0}; // Round-robin cursor for submissions from other threads
+
+    std::mutex _sleepMutex;
     std::condition_variable _condition;
-    bool _stop;
+    std::atomic<long> _pending{0};    // Tasks queued and not yet taken
+    std::atomic<size_t> _sleepers{0}; // Workers waiting on _condition; enqueue only notifies if there are any
+    std::atomic<bool> _stop{false};
+
+    std::mutex _lifecycleMutex; // Serialises resize() and shutdown()
 };
 
-#endif
\ No newline at end of file
+#endif
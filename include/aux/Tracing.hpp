@@ -0,0 +1,69 @@
+#ifndef TRACING_HPP
+#define TRACING_HPP
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+struct TransferTimings;
+
+static constexpr size_t TRACE_MAX_EVENTS_PER_THREAD = 1 << 20; // Later events are counted as dropped
+
+// Process-wide timeline of scheduler, pool, transfer and persistence activity, written as
+// Chrome trace-event JSON (open it in Perfetto or chrome://tracing)
+//
+// Tracing is off unless enable() is called; until then every recording call returns after one relaxed load.
+// Each thread appends to its own buffer, so recording threads never wait on each other.
+// Names, categories and argument names must be string literals: events keep the pointers.
+namespace tracing
+{
+    namespace detail
+    {
+        extern std::atomic<bool> enabled;
+    }
+
+    inline bool isEnabled()
+    {
+        return detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    void enable();
+    int64_t now(); // Microseconds since enable()
+
+    void setThreadName(const std::string &name);
+
+    void complete(const char *category, const char *name, int64_t startUs, int64_t durationUs, int64_t id = -1);
+    void instant(const char *category, const char *name, int64_t id = -1);
+    void counter(const char *name, const char *series, int64_t value);
+
+    // One span for a curl request and one per phase inside it, from the start of the perform
+    void transfer(const char *name, int64_t startUs, const TransferTimings &timings, int64_t id);
+
+    bool write(const std::string &path, std::string &error);
+
+    // Records a complete event covering its own lifetime
+    class Scope
+    {
+    public:
+        Scope(const char *category, const char *name, int64_t id = -1)
+            : _category(category), _name(name), _id(id), _start(isEnabled() ? now() : -1) {}
+
+        ~Scope()
+        {
+            if (_start >= 0)
+                complete(_category, _name, _start, now() - _start, _id);
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const char *_category;
+        const char *_name;
+        int64_t _id;
+        int64_t _start;
+    };
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef UNIXSOCKET_HPP
+#define UNIXSOCKET_HPP
+
+#include <string>
+
+// Thin wrappers around local (AF_UNIX) stream sockets
+namespace unixsocket
+{
+    // Binds and listens on the given path, replacing a stale socket file left by a process that exited
+    // Returns the listening descriptor, or -1 with a message in error
+    int listen(const std::string &path, std::string &error);
+
+    // Connects to the socket at the given path, returning the descriptor or -1
+    int connect(const std::string &path);
+
+    // Writes all of data to a blocking descriptor, returning false if the peer has gone away
+    bool sendAll(int fd, const std::string &data);
+
+    // Reads one line (without the newline) from a blocking descriptor
+    // Bytes read past the line are kept in buffer for the next call; returns false at end of stream
+    bool readLine(int fd, std::string &buffer, std::string &line);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef BATCHRUNNER_HPP
+#define BATCHRUNNER_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+#include "core/DownloadManager.hpp"
+#include "aux/Notifier.hpp"
+
+static constexpr int BATCH_EXIT_SUCCESS = 0;       // Every download completed
+static constexpr int BATCH_EXIT_FAILURES = 1;      // At least one download failed
+static constexpr int BATCH_EXIT_USAGE = 2;         // Bad arguments or unreadable input list
+static constexpr int BATCH_EXIT_INTERRUPTED = 130; // Stopped by SIGINT or SIGTERM
+
+// One download requested on the command line or in an input list
+struct BatchItem
+{
+    std::string url;
+    std::string destination; // Empty resolves the filename from the server
+};
+
+// Runs a fixed list of downloads to completion without a terminal and reports on them
+// as JSON lines, one object per line:
+//   {"event":"queued","id":1,"url":"...","file":"..."}
+//   {"event":"joined","id":1,"url":"...","file":"..."}
+//   {"event":"progress","id":1,"bytes":512,"total":1024,"bps":2048}
+//   {"event":"completed","id":1,"url":"...","file":"...","bytes":1024,"http":200}
+//   {"event":"failed","id":1,"url":"...","file":"...","http":404,"curl":22,"error":"..."}
+//   {"event":"summary","completed":1,"failed":1,"canceled":0,"elapsed":1.25}
+// A download that fails before it is queued (e.g. its HEAD request) is reported with id 0
+// An item for a URL already being downloaded joins that task instead of being queued; once the task
+// finishes, a completed or failed event is reported for each of its items, with each item's file
+class BatchRunner
+{
+public:
+    BatchRunner(DownloadManager &manager, std::chrono::milliseconds progressInterval, std::ostream &out);
+    ~BatchRunner();
+
+    int run(const std::vector<BatchItem> &items);
+    void stop();
+
+private:
+    void onQueued(const BatchItem &item, TaskId id);
+    void onTaskFinished(const DownloadTask &task);
+    void emitOutcome(const DownloadTask &task, const std::string &file);
+    void emitProgress();
+    void emit(const std::string &line);
+    bool hasUnfinishedTasks() const;
+    int calcWaitTimeoutMs(std::chrono::steady_clock::time_point nextProgress) const;
+
+    DownloadManager &_manager;
+    std::chrono::milliseconds _progressInterval; // Zero disables progress events
+    std::ostream &_out;
+
+    size_t _unqueued = 0; // Items whose filename is still being looked up
+    size_t _completed = 0;
+    size_t _failed = 0;
+    std::unordered_set<TaskId> _queued;                            // Tasks the items were queued as
+    std::unordered_map<TaskId, std::vector<std::string>> _joined; // Files of the items that joined each task
+
+    Notifier _stopNotifier; // Lets stop() wake the loop, including from a signal handler
+    std::atomic<bool> _stopping{false};
+};
+
+#endif
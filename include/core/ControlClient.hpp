@@ -0,0 +1,41 @@
+#ifndef CONTROLCLIENT_HPP
+#define CONTROLCLIENT_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+
+// A connection to a daemon's control socket that sends requests without waiting for their responses
+// Responses arrive in request order; receive() hands each complete one to the callback of its request,
+// so a caller polling getFd() never blocks on a request the daemon has not answered yet
+class ControlClient
+{
+public:
+    // Called with true and the data lines of an "OK <n>" response, or false and the message of an "ERR"
+    using ResponseCallback = std::function<void(bool ok, const std::vector<std::string> &lines)>;
+
+    ControlClient() = default;
+    ~ControlClient();
+
+    ControlClient(const ControlClient &) = delete;
+    ControlClient &operator=(const ControlClient &) = delete;
+
+    bool connect(const std::string &socketPath);
+    bool send(const std::string &request, ResponseCallback onResponse);
+    bool receive();
+
+    bool isConnected() const { return _fd >= 0; }
+    int getFd() const { return _fd; }
+    size_t getOutstanding() const { return _callbacks.size(); }
+
+private:
+    void handleResponses();
+    void disconnect();
+
+    int _fd = -1;
+    std::string _input;                     // Received bytes not yet part of a complete response
+    std::deque<ResponseCallback> _callbacks; // One per request awaiting its response, oldest first
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef CONTROLSERVER_HPP
+#define CONTROLSERVER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+#include "core/DownloadManager.hpp"
+#include "aux/Notifier.hpp"
+
+static constexpr std::chrono::milliseconds DAEMON_UPDATE_INTERVAL{500}; // Manager update period while transfers run
+static constexpr size_t CONTROL_MAX_REQUEST_LENGTH = 64 * 1024;
+static constexpr size_t CONTROL_CLIENT_WINDOW = 256; // Requests a piped client sends ahead of their responses
+
+// Runs a download manager headless and serves it to local clients over a Unix domain socket
+//
+// Each request is one line holding a command and its arguments, quoted as in the TUI:
+//   queue <url> [file]   pause [id]   resume [id]   cancel [id [file]]   status   shutdown
+// Each response is "OK <n>" followed by n data lines, or a single "ERR <message>" line, in request order.
+// A queue without a file is answered once the server has named the file; the loop keeps serving meanwhile.
+// status lists one task per line: <id> <status> <bytes> <total bytes> <bytes/s> "<url>" "<file>" followed by
+// the files of the requests that joined the task, which "cancel <id> <file>" withdraws
+class ControlServer
+{
+public:
+    explicit ControlServer(const std::string &socketPath);
+    ~ControlServer();
+
+    bool start(std::string &error);
+    void run(DownloadManager &manager);
+    void stop();
+
+private:
+    // A response that is sent once every response before it is
+    struct PendingResponse
+    {
+        bool ready = false;
+        std::string text;
+    };
+
+    struct Client
+    {
+        uint64_t id = 0;
+        int fd = -1;
+        std::string input;
+        std::string output;
+        std::deque<PendingResponse> pending; // From the oldest unanswered queue request on, in request order
+        uint64_t firstPending = 0;           // Sequence number of pending.front()
+        bool finished = false; // The client closed its side; it is dropped once its responses are sent
+    };
+
+    void acceptClients();
+    bool readClient(Client &client);
+    bool writeClient(Client &client);
+    void handleRequest(Client &client, const std::string &request, std::string &response);
+    void queueAsync(Client &client, const std::string &url);
+    void respond(Client &client, std::string response);
+    void completeResponse(uint64_t clientId, uint64_t sequence, std::string response);
+    void appendStatus(std::string &response);
+    int calcWaitTimeoutMs() const;
+
+    DownloadManager *_manager = nullptr; // Set while run() is serving
+    std::string _socketPath;
+    int _listenFd = -1;
+    std::vector<Client> _clients;
+    uint64_t _nextClientId = 1;
+
+    Notifier _stopNotifier; // Lets stop() wake the loop, including from a signal handler
+    std::atomic<bool> _stopping{false};
+};
+
+#endif
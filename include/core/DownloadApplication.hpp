@@ -1,13 +1,62 @@
 #ifndef DOWNLOADAPPLICATION_HPP
 #define DOWNLOADAPPLICATION_HPP
 
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstddef>
+
+#include "aux/MetricsExporter.hpp"
+#include "core/DownloadManager.hpp"
+
+enum class ApplicationMode
+{
+    INTERACTIVE, // Curses TUI
+    DAEMON,      // Headless, controlled over a Unix socket
+    CLIENT,      // Sends commands to a running daemon
+    BATCH        // Runs a fixed list of downloads and exits
+};
+
+struct ApplicationOptions
+{
+    ApplicationMode mode = ApplicationMode::INTERACTIVE;
+    std::string socketPath;             // Empty selects the default in the state directory
+    std::vector<std::string> arguments; // Command sent by a client, or the URLs of a batch
+    std::string inputPath;              // Batch list file, one "url [file]" per line
+    size_t concurrency = 0;             // Simultaneous transfers; 0 keeps the manager default
+    int retries = -1;                   // Automatic retries of a transient failure; -1 keeps the manager default
+    long stallTimeout = -1;             // Seconds below the minimum speed before a request is retried; -1 keeps the default
+    long minSpeed = 0;                  // Minimum speed in bytes per second; 0 keeps the default
+    long cacheSize = 0;                 // Capacity of the download cache in megabytes; 0 disables it
+    std::chrono::milliseconds progressInterval{1000}; // Batch progress report period; 0 disables
+    int metricsPort = 0;                                // Loopback port serving /metrics; 0 disables
+    std::string metricsPath;                            // File rewritten with the metrics; empty disables
+    std::chrono::milliseconds metricsInterval{METRICS_DEFAULT_INTERVAL};
+    std::string tracePath;                              // Trace-event JSON written on exit; empty disables tracing
+};
+
 class DownloadApplication
 {
 public:
-    DownloadApplication();
+    explicit DownloadApplication(ApplicationOptions options);
     ~DownloadApplication();
 
-    void run();
+    static bool parseOptions(int argc, char *argv[], ApplicationOptions &options, std::string &error);
+    static void printUsage(const char *program);
+
+    int run();
+
+private:
+    ApplicationOptions _options;
+
+    int runInteractive();
+    int runDaemon();
+    int runClient();
+    int runBatch();
+    int runMode();
+    ManagerOptions makeManagerOptions() const;
+    bool startMetrics(const Metrics &metrics, std::unique_ptr<MetricsExporter> &exporter) const;
 };
 
 #endif
@@ -4,29 +4,83 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <atomic>
 
 #include "core/DownloadTask.hpp"
+#include "core/TaskRegistry.hpp"
 #include "aux/ThreadPool.hpp"
+#include "aux/MpscQueue.hpp"
+#include "aux/Notifier.hpp"
+#include "aux/StateSnapshot.hpp"
+#include "aux/StatePersister.hpp"
+#include "aux/HistoryStore.hpp"
+#include "aux/SpeedEstimator.hpp"
+#include "aux/Metrics.hpp"
+#include "aux/DownloadCache.hpp"
 
 static constexpr const char SDM_STATE_DIRECTORY[] = "sdm";
 static constexpr const char SDM_STATE_FILENAME[] = "downloads";
+static constexpr const char SDM_HISTORY_FILENAME[] = "history";
+static constexpr const char SDM_SOCKET_FILENAME[] = "sdm.sock";
+static constexpr const char SDM_CACHE_DIRECTORY[] = "cache";
+static constexpr int SDM_STATE_SAVE_INTERVAL_MS = 1000;
+static constexpr size_t SDM_DEFAULT_CONCURRENCY = 5;
+static constexpr size_t SDM_RESOLVER_THREADS = 4; // Filename requests of queueDownloadAsync() running at once
+static constexpr int SDM_DEFAULT_MAX_RETRIES = 5;
+static constexpr std::chrono::seconds SDM_RETRY_BASE_DELAY{1};   // Backoff before the first retry, doubled for each next one
+static constexpr std::chrono::seconds SDM_RETRY_MAX_DELAY{60};   // Longest backoff
+static constexpr std::chrono::seconds SDM_RETRY_AFTER_LIMIT{600}; // Longest Retry-After honoured
+
+// Settings fixed for the lifetime of a manager
+struct ManagerOptions
+{
+    size_t concurrency = SDM_DEFAULT_CONCURRENCY; // Transfers run at the same time
+    bool persistent = true;                       // Load and save state and history under ~/.sdm
+    int maxRetries = SDM_DEFAULT_MAX_RETRIES;     // Automatic retries of a transient failure; 0 disables them
+    StallPolicy stall;                            // When a request is abandoned as stalled
+    int64_t cacheBytes = 0;                       // Capacity of the download cache in ~/.sdm/cache; 0 disables it
+};
+
+using TaskFinishedCallback = std::function<void(const DownloadTask &)>;
+using QueuedCallback = std::function<void(TaskId)>; // Receives the queued task's id, or 0 if it failed
+
+// Published by a worker thread when a task's run ends
+struct TaskEvent
+{
+    TaskId id{0};
+    DownloadStatus status{DownloadStatus::QUEUED};
+};
 
 class DownloadManager
 {
 public:
-    DownloadManager();
+    explicit DownloadManager(const ManagerOptions &options = ManagerOptions());
     ~DownloadManager();
 
-    void queueDownload(const std::string &url, const std::string &destination);
+    static std::string getStateFilePath(const char *filename);
+
+    TaskId queueDownload(const std::string &url, const std::string &destination);
+    void queueDownloadAsync(const std::string &url, const std::string &destination, QueuedCallback onQueued);
 
     void update();
+    void setTaskFinishedCallback(TaskFinishedCallback callback) { _onTaskFinished = std::move(callback); }
+    int getEventFd() const { return _notifier.getFd(); }
+    bool consumeEventSignal() { return _notifier.drain(); }
+    std::chrono::milliseconds timeUntilNextUpdate() const;
 
     void updateTaskStatus(std::shared_ptr<DownloadTask> task, DownloadStatus newStatus);
 
-    void pauseDownload(size_t index);
-    void resumeDownload(size_t index);
-    void cancelDownload(size_t index);
-    void retryDownload(size_t index);
+    bool pauseDownload(TaskId id);
+    bool resumeDownload(TaskId id);
+    bool cancelDownload(TaskId id);
+    bool withdrawDestination(TaskId id, const std::string &destination);
+    void retryDownload(uint64_t historyId);
     void pauseAllDownloads();
     void resumeAllDownloads();
     void cancelAllDownloads();
@@ -34,27 +88,84 @@ public:
 
     void clearHistory();
 
-    const std::vector<std::shared_ptr<DownloadTask>> &getQueued() const { return _queued; }
-    const std::vector<std::shared_ptr<DownloadTask>> &getActive() const { return _active; }
-    const std::vector<std::shared_ptr<DownloadTask>> &getPaused() const { return _paused; }
-    const std::vector<std::shared_ptr<DownloadTask>> &getCompleted() const { return _completed; }
-    const std::vector<std::shared_ptr<DownloadTask>> &getFailed() const { return _failed; }
+    bool importState(const std::string &path);
+    bool exportState(const std::string &path) const;
+
+    double getThroughputBps() const { return _throughput.bytesPerSecond(); }
+    size_t getConcurrency() const { return _threadPool.size(); }
+    void setConcurrency(size_t concurrency);
+
+    std::shared_ptr<DownloadTask> getTask(TaskId id) const { return _tasks.find(id); }
+    TaskRegistry::ListView getQueued() const { return _tasks.list(DownloadStatus::QUEUED); }
+    TaskRegistry::ListView getActive() const { return _tasks.list(DownloadStatus::ACTIVE); }
+    TaskRegistry::ListView getPaused() const { return _tasks.list(DownloadStatus::PAUSED); }
+    const HistoryStore &getHistory() const { return _history; }
+    const Metrics &getMetrics() const { return _metrics; }
 
 private:
+    ManagerOptions _options;
+    TaskFinishedCallback _onTaskFinished;
+
+    // A task whose destination a resolver thread has looked up, waiting to be queued by update()
+    struct Resolution
+    {
+        std::shared_ptr<DownloadTask> task;
+        std::string destination;
+        QueuedCallback onQueued;
+    };
+
+    // Shared with the workers, so these outlive the thread pools
+    Notifier _notifier;
+    Metrics _metrics;
+    MpscQueue<Resolution> _resolutions;
     ThreadPool _threadPool;
+    ThreadPool _resolvers; // Filename requests, kept apart from the transfers that hold a worker for their whole run
     std::string _stateFilePath;
+    HistoryStore _history;
+    StatePersister _persister;
+    std::unique_ptr<DownloadCache> _cache; // Null when the cache is disabled
+    std::atomic<bool> _stopping{false};    // Set by the destructor
+
+    TaskRegistry _tasks;
+    MpscQueue<TaskEvent> _events;
+    SpeedEstimator _throughput; // Aggregate speed of all transfers, sampled in update()
+
+    // Tasks waiting out a backoff, by the time their retry starts
+    // They stay in the active list but hold no worker, so they are not counted against the concurrency
+    std::multimap<std::chrono::steady_clock::time_point, TaskId> _retryTimers;
+    std::minstd_rand _jitter;
 
-    std::vector<std::shared_ptr<DownloadTask>> _queued;
-    std::vector<std::shared_ptr<DownloadTask>> _active;
-    std::vector<std::shared_ptr<DownloadTask>> _paused;
-    std::vector<std::shared_ptr<DownloadTask>> _completed;
-    std::vector<std::shared_ptr<DownloadTask>> _failed;
+    // Unfinished tasks by the hash of their normalized URL, so that a request for a URL already being
+    // downloaded joins that transfer instead of starting another; a lookup compares the URLs themselves
+    std::unordered_map<size_t, TaskId> _tasksByUrl;
+
+    // Tasks changed since their state was last handed to the persister, which only receives these
+    std::unordered_set<TaskId> _unsavedTasks;
 
     void loadState();
-    void saveState() const;
+    void saveState();
+    void saveTask(const DownloadTask &task);
+    StateChanges collectChanges();
+    std::vector<TaskRecord> collectRecords() const;
 
     void addTaskToStatusContainer(std::shared_ptr<DownloadTask> task);
-    void removeTaskFromCurrentContainer(std::shared_ptr<DownloadTask> task);
+    void requeueFailed(const TaskRecord &record);
+
+    TaskId joinInFlight(const std::string &url, const std::string &destination);
+    void resolveDestination(std::shared_ptr<DownloadTask> task, QueuedCallback onQueued);
+    TaskId addResolvedTask(std::shared_ptr<DownloadTask> task, const std::string &resolvedDestination);
+    void applyResolutions();
+
+    std::shared_ptr<DownloadTask> findInFlight(const std::string &url) const;
+    static size_t urlKey(DownloadTask &task);
+    void trackUrl(DownloadTask &task);
+    void untrackUrl(DownloadTask &task);
+    void cloneToExtraDestinations(const DownloadTask &task);
+
+    bool scheduleRetry(const std::shared_ptr<DownloadTask> &task);
+    void cancelRetry(DownloadTask &task);
+    void startDueRetries();
+    std::chrono::milliseconds calcRetryDelay(int retries, int64_t retryAfterSeconds);
 };
 
 #endif
\ No newline at end of file
@@ -2,11 +2,47 @@
 #define DOWNLOADTASK_HPP
 
 #include <string>
-#include <deque>
+#include <vector>
 #include <atomic>
+#include <mutex>
 #include <chrono>
+#include <cstdint>
+#include <cstddef>
 #include <curl/curl.h>
 
+#include "aux/SpeedEstimator.hpp"
+#include "aux/Metrics.hpp"
+#include "aux/StateSnapshot.hpp"
+#include "aux/DownloadCache.hpp"
+
+class FileWriter;
+
+using TaskId = uint64_t;
+
+static constexpr size_t SDM_CACHE_LINE_SIZE = 64;
+static constexpr std::chrono::seconds SDM_STALL_WINDOW{15};
+static constexpr int64_t SDM_STALL_MIN_SPEED = 1; // Bytes per second; anything at all counts as progress
+static constexpr std::chrono::seconds SDM_CONNECT_TIMEOUT{30};
+
+// When a request counts as stalled: libcurl aborts it with CURLE_OPERATION_TIMEDOUT, a transient
+// error, so that the manager retries it from the bytes already on disk
+struct StallPolicy
+{
+    std::chrono::seconds window = SDM_STALL_WINDOW;      // Slower than minBytesPerSecond for this long; 0 disables
+    int64_t minBytesPerSecond = SDM_STALL_MIN_SPEED;
+    std::chrono::seconds connectTimeout = SDM_CONNECT_TIMEOUT;
+};
+
+// Byte counters the worker updates on every progress callback
+// Aligned and padded to a whole cache line so these writes never invalidate the line holding
+// the task's read-mostly metadata, or the counters of a task allocated next to it
+struct alignas(SDM_CACHE_LINE_SIZE) TransferCounters
+{
+    std::atomic<int64_t> bytesDownloaded{0};
+    std::atomic<int64_t> totalBytes{0};
+    std::atomic<int64_t> resumeOffset{0};
+};
+
 enum class DownloadStatus
 {
     QUEUED,
@@ -24,63 +60,118 @@ public:
 
     void run();
     void resume();
+    void restart();
+    bool acceptResponse(int httpStatus, const std::string &etag, const std::string &lastModified, FileWriter &writer);
 
     bool isPaused() const;
     bool isFailed() const;
     bool isCanceled() const;
 
-    void recordSpeedSample(time_t time, double bytesDownloaded);
+    bool transitionStatus(DownloadStatus expected, DownloadStatus desired);
+    bool requestStatus(DownloadStatus desired);
+
+    void recordSpeedSample(std::chrono::steady_clock::time_point time, int64_t bytesDownloaded);
+    void reportTransferred(int64_t runBytes);
     double calcEstimatedTimeRemaining() const;
     double calcCurrentSpeedBps() const;
 
-    std::string getUrl() const { return _url; }
-    std::string getDestination() const { return _destination; }
+    TaskId getId() const { return _id; }
+    const std::string &getUrl() const { return _url; }
+    const std::string &getDestination() const { return _destination; }
     time_t getAddedAt() const { return _addedAt; }
-    time_t getEndedAt() const { return _endedAt; }
-    double getTotalBytes() const { return _totalBytes.load(); }
-    double getBytesDownloaded() const { return _bytesDownloaded.load(); }
-    double getProgress() const { return _progress.load(); }
-    double getResumeOffset() const { return _resumeOffset.load(); }
-    DownloadStatus getStatus() const { return _status; }
+    time_t getEndedAt() const { return _endedAt.load(); }
+    int64_t getTotalBytes() const { return _counters.totalBytes.load(std::memory_order_relaxed); }
+    int64_t getBytesDownloaded() const { return _counters.bytesDownloaded.load(std::memory_order_relaxed); }
+    int64_t getResumeOffset() const { return _counters.resumeOffset.load(std::memory_order_relaxed); }
+    double getProgress() const;
+    DownloadStatus getStatus() const { return _status.load(); }
     int getHttpStatus() const { return _httpStatus.load(); }
-    CURLcode getErrorCode() const { return _errorCode; }
-    std::string getErrorMessage() const { return curl_easy_strerror(_errorCode); }
+    CURLcode getErrorCode() const { return _errorCode.load(); }
+    std::string getErrorMessage() const { return curl_easy_strerror(_errorCode.load()); }
+    TransferTimings getHeadTimings() const;
+    TransferTimings getTimings() const;
+    std::string getEtag() const;
+    std::string getLastModified() const;
+    const std::vector<std::string> &getExtraDestinations() const { return _extraDestinations; }
+    size_t getUrlKey() const { return _urlKey; }
+    int64_t getRunBytes() const { return _runBytesReported; }
+    int64_t getRetryAfterSeconds() const { return _retryAfterSeconds.load(); }
+    int getRetries() const { return _retries; }
+    std::chrono::steady_clock::time_point getRetryAt() const { return _retryAt; }
+    bool isWaitingToRetry() const { return _retryAt != std::chrono::steady_clock::time_point(); }
 
+    void setId(TaskId id) { _id = id; }
     void setDestination(const std::string &dest) { _destination = dest; }
     void setAddedAt(time_t t) { _addedAt = t; }
-    void setEndedAt(time_t t) { _endedAt = t; }
-    void setTotalBytes(double d) { _totalBytes.store(d); }
-    void setBytesDownloaded(double d) { _bytesDownloaded.store(d); }
-    void setProgress(double p) { _progress.store(p); }
-    void setStatus(DownloadStatus s) { _status = s; }
+    void setEndedAt(time_t t) { _endedAt.store(t); }
+    void setTotalBytes(int64_t bytes) { _counters.totalBytes.store(bytes, std::memory_order_relaxed); }
+    void setBytesDownloaded(int64_t bytes) { _counters.bytesDownloaded.store(bytes, std::memory_order_relaxed); }
+    void setStatus(DownloadStatus s) { _status.store(s); }
     void setHttpStatus(int status) { _httpStatus.store(status); }
-    void setErrorCode(CURLcode code) { _errorCode = code; }
+    void setRetryAfterSeconds(int64_t seconds) { _retryAfterSeconds.store(seconds); }
+    void setErrorCode(CURLcode code) { _errorCode.store(code); }
+    void setMetrics(Metrics *metrics) { _metrics = metrics; }
+    void setCache(DownloadCache *cache) { _cache = cache; }
+    void setStallPolicy(const StallPolicy &policy) { _stallPolicy = policy; }
+    const StallPolicy &getStallPolicy() const { return _stallPolicy; }
+    void setHeadTimings(const TransferTimings &timings);
+    void setTimings(const TransferTimings &timings);
+    void setValidators(const std::string &etag, const std::string &lastModified);
+    void setExtraDestinations(const std::vector<std::string> &destinations) { _extraDestinations = destinations; }
+    void addExtraDestination(const std::string &destination) { _extraDestinations.push_back(destination); }
+    void setUrlKey(size_t key) { _urlKey = key; }
+    void setRetries(int retries) { _retries = retries; }
+    void setRetryAt(std::chrono::steady_clock::time_point time) { _retryAt = time; }
 
 
 private:
+    // Read-mostly metadata, shared by the UI and the manager
+    TaskId _id{0};
     std::string _url;
     std::string _destination;
     time_t _addedAt{0};
-    time_t _endedAt{0};
-    std::atomic<double> _totalBytes{0.0};
-    std::atomic<double> _bytesDownloaded{0.0};
-    std::atomic<double> _progress{0.0};
-    std::atomic<double> _resumeOffset{0.0};
-    DownloadStatus _status{DownloadStatus::QUEUED};
+    std::atomic<time_t> _endedAt{0}; // Written by the worker before the status that publishes the run
+    std::atomic<DownloadStatus> _status{DownloadStatus::QUEUED};
     std::atomic<int> _httpStatus{0};
-    CURLcode _errorCode{CURLE_OK};
-
+    std::atomic<CURLcode> _errorCode{CURLE_OK};
     std::atomic<bool> _resumeEnabled{false};
     std::atomic<bool> _cancelRequested{false};
+    Metrics *_metrics = nullptr; // Shared by all tasks, owned by the manager
+    DownloadCache *_cache = nullptr; // Shared by all tasks, owned by the manager; null without a cache
+    StallPolicy _stallPolicy;    // Set by the manager before each run
+    TransferTimings _headTimings;     // Filename resolution request
+    TransferTimings _timings;         // Latest run; written by the worker as it ends, read when saving state
+    mutable std::mutex _timingsMutex; // Guards both timings
+    std::string _etag;                // Validators of the latest response; resuming sends one as If-Range
+    std::string _lastModified;
+    mutable std::mutex _validatorsMutex;
+    std::atomic<int64_t> _retryAfterSeconds{-1}; // Retry-After of the latest run's response; -1 without one
+
+    // Owned by the manager's thread
+    std::vector<std::string> _extraDestinations; // Files of later requests for the same URL, made on completion
+    size_t _urlKey = 0; // Hash of the normalized URL, computed once by the manager; 0 until then
+
+    // Automatic retries, owned by the manager's thread
+    int _retries = 0; // Consecutive failed runs retried without progress in between
+    std::chrono::steady_clock::time_point _retryAt{}; // When the next retry starts; default while not waiting
+
+    // Written by the worker while the transfer runs
+    TransferCounters _counters;
+    SpeedEstimator _speed;
+    int64_t _runBytesReported = 0; // Bytes of the current run already added to the transfer sink
     std::chrono::steady_clock::time_point _startTime;
-    std::deque<std::pair<time_t, double>> _speedSamples;
+    std::mutex _runMutex;
 
-    void configureResume(CURL *curlHandle);
+    curl_slist *configureResume(CURL *curlHandle);
+    std::string chooseIfRange() const;
+    curl_slist *configureRevalidation(CURL *curlHandle, const CacheEntry &cached);
+    bool copyFromCache(const CacheEntry &cached);
+    void addToCache(std::string digest);
+    void recordRunMetrics(CURL *curlHandle, CURLcode res, const TransferTimings &timings, bool published);
 
-    void onDownloadPause();
     void onDownloadCancel();
-    void onDownloadComplete();
-    void onDownloadError(const CURLcode res);
+    bool onDownloadComplete();
+    bool onDownloadError(const CURLcode res);
 };
 
 #endif
\ No newline at end of file
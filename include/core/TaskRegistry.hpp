@@ -0,0 +1,101 @@
+#ifndef TASKREGISTRY_HPP
+#define TASKREGISTRY_HPP
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <unordered_map>
+
+#include "core/DownloadTask.hpp"
+
+// Owns all unfinished tasks in a slab and threads them onto one intrusive list per status
+// Tasks are addressed by stable numeric ids; adding, moving and removing a task are O(1)
+class TaskRegistry
+{
+    static constexpr uint32_t NIL = UINT32_MAX;
+    static constexpr size_t LIST_COUNT = 6; // One per DownloadStatus value
+
+    struct Slot
+    {
+        std::shared_ptr<DownloadTask> task;
+        uint32_t prev = NIL;
+        uint32_t next = NIL;
+        uint8_t list = 0;
+        uint64_t sequence = 0; // When the task entered its list; later entries have larger numbers
+    };
+
+    struct List
+    {
+        uint32_t head = NIL;
+        uint32_t tail = NIL;
+        size_t size = 0;
+
+        // Position of the last seek, so that scrolling walks from there instead of from an end
+        // Reset whenever the list changes
+        mutable uint32_t cursorSlot = NIL;
+        mutable size_t cursorIndex = 0;
+    };
+
+public:
+    // Forward iterator over the tasks of one list, in insertion order
+    class Iterator
+    {
+    public:
+        Iterator(const std::vector<Slot> *slots, uint32_t slot) : _slots(slots), _slot(slot) {}
+
+        const std::shared_ptr<DownloadTask> &operator*() const { return (*_slots)[_slot].task; }
+        Iterator &operator++()
+        {
+            _slot = (*_slots)[_slot].next;
+            return *this;
+        }
+        bool operator!=(const Iterator &other) const { return _slot != other._slot; }
+
+    private:
+        const std::vector<Slot> *_slots;
+        uint32_t _slot;
+    };
+
+    // Read-only view of the tasks currently holding one status
+    class ListView
+    {
+    public:
+        ListView(const std::vector<Slot> *slots, const List *list) : _slots(slots), _list(list) {}
+
+        Iterator begin() const { return Iterator(_slots, _list->head); }
+        Iterator end() const { return Iterator(_slots, NIL); }
+        size_t size() const { return _list->size; }
+        bool empty() const { return _list->size == 0; }
+        const std::shared_ptr<DownloadTask> &front() const { return (*_slots)[_list->head].task; }
+        const std::shared_ptr<DownloadTask> &back() const { return (*_slots)[_list->tail].task; }
+        Iterator seek(size_t index) const;
+
+    private:
+        const std::vector<Slot> *_slots;
+        const List *_list;
+    };
+
+    TaskId add(std::shared_ptr<DownloadTask> task, DownloadStatus status);
+    bool move(TaskId id, DownloadStatus status);
+    bool erase(TaskId id);
+
+    std::shared_ptr<DownloadTask> find(TaskId id) const;
+    std::shared_ptr<DownloadTask> find(TaskId id, DownloadStatus status) const;
+    uint64_t getSequence(TaskId id) const;
+
+    ListView list(DownloadStatus status) const;
+    size_t size() const { return _idToSlot.size(); }
+
+private:
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _freeSlots;
+    std::unordered_map<TaskId, uint32_t> _idToSlot;
+    List _lists[LIST_COUNT];
+    TaskId _nextId = 1;
+    uint64_t _nextSequence = 1;
+
+    void link(uint32_t slot, uint8_t list);
+    void unlink(uint32_t slot);
+};
+
+#endif
@@ -11,18 +11,24 @@ public:
 
     std::vector<CommandEntry> getCommandTable() const override { return _commandTable; } 
     void drawAvailableCommands(int &currentRow, WINDOW *window) override;
-    void drawScreen(int &currentRow, WINDOW *window) override;
+    void drawScreen(int &currentRow, Frame &frame) override;
 
 private:
+    DownloadManager &_manager;
     const std::vector<CommandEntry> _commandTable;
 
     void parseDownloadCommand(const std::string &command);
     void parsePauseCommand(const std::string &command);
     void parseResumeCommand(const std::string &command);
     void parseCancelCommand(const std::string &command);
+    void parseExportCommand(const std::string &command);
+    void parseImportCommand(const std::string &command);
+    void drawTaskList(int &currentRow,
+                      Frame &frame,
+                      const TaskRegistry::ListView &tasks,
+                      bool isActive);
     void drawDownloadProgress(int &currentRow,
-                              WINDOW *win,
-                              size_t index,
+                              Frame &frame,
                               const std::shared_ptr<DownloadTask> &task,
                               bool isActive);
 };
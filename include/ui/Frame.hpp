@@ -0,0 +1,31 @@
+#ifndef FRAME_HPP
+#define FRAME_HPP
+
+#include <string>
+#include <vector>
+
+// Text of the visible part of the screen body, one string per row
+// Screens lay out every row but only rows inside the viewport are stored, so drawing costs
+// O(visible rows); the UI compares each frame with the previous one and rewrites changed rows
+class Frame
+{
+public:
+    void reset(int firstRow, int rowCount);
+    void print(int row, int col, const char *format, ...) __attribute__((format(printf, 4, 5)));
+    void extendTo(int row);
+
+    bool isVisible(int row) const { return row >= _firstRow && row < _firstRow + getRowCount(); }
+    int getFirstRow() const { return _firstRow; }
+    int getRowCount() const { return static_cast<int>(_rows.size()); }
+    int getHeight() const { return _height; }
+
+    // Row relative to the top of the viewport
+    const std::string &getVisibleRow(int index) const { return _rows[index]; }
+
+private:
+    std::vector<std::string> _rows; // Buffers are kept between frames
+    int _firstRow = 0;
+    int _height = 0; // Rows laid out, visible or not
+};
+
+#endif
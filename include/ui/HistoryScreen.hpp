@@ -4,6 +4,8 @@
 #include "ui/Screen.hpp"
 #include "ui/UI.hpp"
 
+static constexpr size_t HISTORY_PAGE_SIZE = 20;
+
 class HistoryScreen : public Screen
 {
 public:
@@ -11,12 +13,32 @@ public:
 
     std::vector<CommandEntry> getCommandTable() const override { return _commandTable; } 
     void drawAvailableCommands(int &currentRow, WINDOW *window) override;
-    void drawScreen(int &currentRow, WINDOW *window) override;
+    void drawScreen(int &currentRow, Frame &frame) override;
 
 private:
+    DownloadManager &_manager;
     const std::vector<CommandEntry> _commandTable;
 
+    HistoryQuery _query;
+    std::string _filterDescription;
+    size_t _page = 0;
+
+    // Entries of the current page, refreshed only when the history or the page changes
+    std::vector<HistoryEntry> _pageEntries;
+    size_t _matchCount = 0;
+    uint64_t _cachedRevision = UINT64_MAX;
+
+    // Per-host timing summary, shown instead of the entries while _showHosts is set
+    bool _showHosts = false;
+    std::vector<HostTimingSummary> _hostSummaries;
+    uint64_t _hostsRevision = UINT64_MAX;
+
     void parseRetryCommand(const std::string &command);
+    void parseFilterCommand(const std::string &command);
+    void changePage(int delta);
+    void refreshPage();
+    void drawTimings(int &currentRow, Frame &frame, const TaskRecord &record);
+    void drawHostSummaries(int &currentRow, Frame &frame);
 };
 
-#endif
\ No newline at end of file
+#endif
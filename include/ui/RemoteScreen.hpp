@@ -0,0 +1,54 @@
+#ifndef REMOTE_SCREEN_HPP
+#define REMOTE_SCREEN_HPP
+
+#include <chrono>
+
+#include "ui/Screen.hpp"
+#include "ui/UI.hpp"
+#include "core/ControlClient.hpp"
+
+// Shows and controls the downloads of a running daemon through its control socket
+// The task list is the daemon's status reply, requested once per render interval on its own connection,
+// so that commands waiting on a filename lookup do not hold up the list
+class RemoteScreen : public Screen
+{
+public:
+    explicit RemoteScreen(ControlClient &commands, ControlClient &status, UI &ui);
+
+    void refresh() override;
+    std::vector<CommandEntry> getCommandTable() const override { return _commandTable; }
+    void drawAvailableCommands(int &currentRow, WINDOW *window) override;
+    void drawScreen(int &currentRow, Frame &frame) override;
+
+private:
+    // One line of the status reply
+    struct RemoteTask
+    {
+        uint64_t id = 0;
+        std::string status;
+        int64_t bytesDownloaded = 0;
+        int64_t totalBytes = 0;
+        int64_t speedBps = 0;
+        std::string url;
+        std::string destination;
+    };
+
+    ControlClient &_commands;
+    ControlClient &_status;
+    const std::vector<CommandEntry> _commandTable;
+
+    std::vector<RemoteTask> _active; // Running and retrying tasks
+    std::vector<RemoteTask> _paused;
+    size_t _queuedCount = 0;
+    std::string _message; // The last error, or the reply to a concurrency command
+
+    bool _statusOutstanding = false;
+    std::chrono::steady_clock::time_point _lastStatusTime;
+
+    void sendCommand(const std::string &command, const std::vector<std::string> &args);
+    void parseStatus(const std::vector<std::string> &lines);
+    void drawTaskList(int &currentRow, Frame &frame, const std::vector<RemoteTask> &tasks, bool isActive);
+    void drawDownloadProgress(int &currentRow, Frame &frame, const RemoteTask &task, bool isActive);
+};
+
+#endif
@@ -6,7 +6,7 @@
 #include <vector>
 #include <functional>
 
-#include "core/DownloadManager.hpp"
+#include "ui/Frame.hpp"
 
 class UI;
 
@@ -32,15 +32,17 @@ enum class ScreenType
 class Screen
 {
 public:
-    explicit Screen(DownloadManager &manager, UI &ui) : _manager(manager), _ui(ui) {}
+    explicit Screen(UI &ui) : _ui(ui) {}
     virtual ~Screen() = default;
 
+    // Brings the screen's data up to date before it is drawn; a screen fed by a daemon requests it here
+    virtual void refresh() {}
+
     virtual std::vector<CommandEntry> getCommandTable() const = 0;
     virtual void drawAvailableCommands(int &currentRow, WINDOW *window) = 0;
-    virtual void drawScreen(int &currentRow, WINDOW *window) = 0;
+    virtual void drawScreen(int &currentRow, Frame &frame) = 0;
 
 protected:
-    DownloadManager &_manager;
     UI &_ui;
 
 private:
@@ -9,22 +9,31 @@
 #include <functional>
 
 #include "ui/Screen.hpp"
+#include "ui/Frame.hpp"
 #include "core/DownloadManager.hpp"
+#include "core/ControlClient.hpp"
 
 static constexpr int LEFT_PADDING = 2;
 static constexpr int BAR_WIDTH = 32;
+static constexpr int TASK_ROWS = 3; // Title, progress bar and a gap
+static constexpr std::chrono::milliseconds RENDER_INTERVAL{500}; // Progress redraw period while transfers run
 
 class UI
 {
 public:
     explicit UI(DownloadManager &manager);
+    UI(ControlClient &commands, ControlClient &status);
 
     void run();
     void stop();
     void changeScreen(ScreenType newScreen);
 
 private:
-    DownloadManager &_manager;
+    // The manager running the downloads in this process, or else the connections to the daemon running them
+    DownloadManager *_manager = nullptr;
+    ControlClient *_commands = nullptr;
+    ControlClient *_status = nullptr;
+
     bool _isRunning;
     std::string _commandBuffer;
     std::chrono::steady_clock::time_point _lastFullUpdateTime;
@@ -33,10 +42,13 @@ private:
     WINDOW *_headerWin = nullptr;
     WINDOW *_cmdLineWin = nullptr;
     WINDOW *_bodyPad = nullptr;
+    Frame _frame;     // Visible body being drawn
+    Frame _lastFrame; // Visible body currently in the pad
 
     int _cmdLineHeight = 0;
     int _headerHeight = 0;
-    int _padHeight = 0;
+    int _padHeight = 0; // Rows of content, used for scrolling
+    int _padRows = 0;   // Rows in the pad, which holds only the visible part of the body
     int _padWidth = 0;
     int _scrollOffset = 0;
     int _maxContentHeight = 0;
@@ -54,13 +66,17 @@ private:
     void drawFullScreen();
     void drawHeader();
     void drawBody();
+    void applyFrame();
+    void resizePad(int rows, int cols);
     void drawMainContent();
     void drawCommandLine();
     void clearScreen();
     void scrollUp(int lines = 1);
     void scrollDown(int lines = 1);
 
-    void sleepBriefly(int intervalMs);
+    bool waitForActivity();
+    bool waitForDaemon();
+    int calcWaitTimeoutMs() const;
 };
 
 #endif
\ No newline at end of file
@@ -2,7 +2,11 @@
 #define ARGS_HPP
 
 #include <vector>
+#include <string>
+#include <cstdint>
 
 std::vector<std::string> extractArguments(const std::string &command, size_t maxArgs);
+uint64_t parseId(const std::string &text);
+std::string quoteArgument(const std::string &argument);
 
 #endif
\ No newline at end of file
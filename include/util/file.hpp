@@ -5,5 +5,6 @@
 
 bool fileExists(const std::string &path);
 std::string getUniqueFilename(const std::string &originalPath);
+bool cloneFile(const std::string &source, const std::string &destination);
 
 #endif
\ No newline at end of file
@@ -1,7 +1,28 @@
 #ifndef FORMAT_HPP
 #define FORMAT_HPP
 
+#include <string>
+#include <ctime>
+#include <cstddef>
+#include <cstdint>
+
+static constexpr size_t FORMAT_BYTES_SIZE = 32; // Buffer size that fits any formatBytes() result
+static constexpr size_t FORMAT_TIME_SIZE = 20;  // "HH:MM:SS dd/mm/yy" and the terminator
+static constexpr size_t FORMAT_DURATION_SIZE = 24;
+
+// Write into a caller-provided buffer without allocating and return the length written
+// The result is always null-terminated if size > 0
+size_t formatBytes(char *buffer, size_t size, double bytes);
+size_t formatTime(char *buffer, size_t size, time_t time);
+size_t formatDuration(char *buffer, size_t size, int64_t microseconds);
+
+// Fills size - 1 columns of a progress bar: '=' for the part done, then '>' while running or '|' otherwise
+size_t formatProgressBar(char *buffer, size_t size, int64_t done, int64_t total, bool running);
+
 std::string formatBytes(double bytes);
 std::string formatTime(time_t time);
 
+// Appends text as a quoted JSON string, escaping quotes, backslashes and control characters
+void appendJsonString(std::string &out, const std::string &text);
+
 #endif
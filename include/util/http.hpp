@@ -11,6 +11,12 @@ namespace http
 {
 
     std::string resolveFilenameFromServer(DownloadTask &task);
+    std::string extractHost(const std::string &url);
+    std::string normalizeUrl(const std::string &url);
+    void readTimings(CURL *curl, TransferTimings &timings);
+    bool isTransientError(CURLcode code, int httpStatus);
+    void applyStallPolicy(CURL *curl, const StallPolicy &policy);
+    bool readHeaderValue(const std::string &line, const char *name, std::string &value);
 }
 
 #endif
\ No newline at end of file
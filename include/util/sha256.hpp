@@ -0,0 +1,29 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Incremental SHA-256 (FIPS 180-4), used to address cached downloads by their content
+class Sha256
+{
+public:
+    Sha256() { reset(); }
+
+    void reset();
+    void update(const void *data, size_t length);
+    std::string finishHex(); // Lower-case hex digest; the hasher must be reset before further use
+
+    static bool hashFile(const std::string &path, std::string &hex);
+
+private:
+    uint32_t _state[8];
+    uint64_t _length = 0; // Bytes hashed so far
+    unsigned char _block[64];
+    size_t _blockUsed = 0;
+
+    void compress(const unsigned char *block);
+};
+
+#endif
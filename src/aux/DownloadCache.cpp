@@ -0,0 +1,256 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "aux/DownloadCache.hpp"
+#include "util/file.hpp"
+#include "util/http.hpp"
+
+namespace
+{
+    constexpr char INDEX_FILENAME[] = "index";
+    constexpr char OBJECTS_DIRECTORY[] = "objects";
+    constexpr std::chrono::seconds SAVE_INTERVAL{1}; // Shortest time between two writes of the index
+}
+
+// Opens the cache in the given directory, creating it if necessary
+DownloadCache::DownloadCache(const std::string &directory, int64_t capacityBytes)
+    : _directory(directory), _capacity(capacityBytes)
+{
+    mkdir(_directory.c_str(), 0755);
+    mkdir((_directory + "/" + OBJECTS_DIRECTORY).c_str(), 0755);
+    load();
+}
+
+// Writes any changes to the index not yet saved
+DownloadCache::~DownloadCache()
+{
+    saveIndex(true);
+}
+
+// Finds the cached copy of a URL; returns false if there is none
+bool DownloadCache::lookup(const std::string &url, CacheEntry &entry) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _entries.find(http::normalizeUrl(url));
+    if (it == _entries.end())
+        return false;
+
+    entry.objectPath = objectPath(it->second.digest);
+    entry.size = it->second.size;
+    entry.etag = it->second.etag;
+    entry.lastModified = it->second.lastModified;
+    return true;
+}
+
+// Marks a URL as used now, after the server confirmed the cached copy
+void DownloadCache::touch(const std::string &url)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(http::normalizeUrl(url));
+        if (it == _entries.end())
+            return;
+
+        it->second.lastUsed = std::time(nullptr);
+        _dirty = true;
+    }
+    saveIndex(false);
+}
+
+// Records a completed download of a URL, copying the file into the cache unless an object with the
+// same digest is already there, then evicts what no longer fits
+// The copy is made without the lock, which is only taken to look up and publish the entry, so that a
+// large copy does not hold up the other workers
+// Downloads without a validator are not stored, as they could never be revalidated
+bool DownloadCache::store(const std::string &url, const std::string &path, const std::string &digest, int64_t size,
+                          const std::string &etag, const std::string &lastModified)
+{
+    if ((etag.empty() && lastModified.empty()) || size > _capacity)
+        return false;
+
+    std::string key = http::normalizeUrl(url);
+    std::string object = objectPath(digest);
+    bool haveObject;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        haveObject = _objectRefs.count(digest) > 0;
+    }
+
+    if (!haveObject && !fileExists(object))
+    {
+        // The copy must not share the file itself with the download, which the user may change
+        // Each copy has its own temporary name, as two workers may store the same content at once
+        std::string tempPath = object + ".tmp" + std::to_string(_tempCounter.fetch_add(1));
+        if (!cloneFile(path, tempPath) || chmod(tempPath.c_str(), 0444) != 0 ||
+            std::rename(tempPath.c_str(), object.c_str()) != 0)
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(key);
+        bool sameObject = it != _entries.end() && it->second.digest == digest;
+        if (!sameObject)
+        {
+            if (_objectRefs.count(digest) == 0)
+            {
+                // Another URL's entry may have released the object while it was being copied
+                if (!fileExists(object))
+                    return false;
+                _storedBytes += size;
+            }
+            if (it != _entries.end())
+                release(it->second.digest, it->second.size);
+            _objectRefs[digest]++;
+        }
+
+        Entry &entry = _entries[key];
+        entry.digest = digest;
+        entry.size = size;
+        entry.etag = etag;
+        entry.lastModified = lastModified;
+        entry.lastUsed = std::time(nullptr);
+
+        evict(key);
+        _dirty = true;
+    }
+    saveIndex(false);
+    return true;
+}
+
+int64_t DownloadCache::getStoredBytes() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _storedBytes;
+}
+
+std::string DownloadCache::objectPath(const std::string &digest) const
+{
+    return _directory + "/" + OBJECTS_DIRECTORY + "/" + digest;
+}
+
+// Reads the index, one URL per line, dropping entries whose object is gone and objects no entry refers to
+void DownloadCache::load()
+{
+    std::ifstream inFile(_directory + "/" + INDEX_FILENAME);
+    std::string line;
+    while (std::getline(inFile, line))
+    {
+        std::istringstream iss(line);
+        std::string url;
+        Entry entry;
+        if (!(iss >> std::quoted(url) >> entry.digest >> entry.size >> entry.lastUsed >>
+              std::quoted(entry.etag) >> std::quoted(entry.lastModified)))
+        {
+            break; // Break on EOF or malformed data
+        }
+
+        if (!fileExists(objectPath(entry.digest)))
+        {
+            _dirty = true;
+            continue;
+        }
+        if (_objectRefs[entry.digest]++ == 0)
+            _storedBytes += entry.size;
+        _entries[url] = std::move(entry);
+    }
+
+    // Objects and temporary copies left behind by a crash between copying a download and saving the index
+    DIR *objects = opendir((_directory + "/" + OBJECTS_DIRECTORY).c_str());
+    if (objects)
+    {
+        while (dirent *item = readdir(objects))
+        {
+            std::string name = item->d_name;
+            if (name != "." && name != ".." && _objectRefs.count(name) == 0)
+                std::remove(objectPath(name).c_str());
+        }
+        closedir(objects);
+    }
+
+    evict("");
+}
+
+// Writes the index if it changed, at most once per SAVE_INTERVAL unless forced
+// The entries are formatted under the lock and written without it; a crash part-way through the write
+// leaves the previous index in place, and a crash before it loses only the latest uses and downloads
+void DownloadCache::saveIndex(bool force)
+{
+    std::ostringstream contents;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto now = std::chrono::steady_clock::now();
+        if (!_dirty || (!force && now - _lastSave < SAVE_INTERVAL))
+            return;
+
+        for (const auto &[url, entry] : _entries)
+        {
+            contents << std::quoted(url) << " "
+                     << entry.digest << " "
+                     << entry.size << " "
+                     << entry.lastUsed << " "
+                     << std::quoted(entry.etag) << " "
+                     << std::quoted(entry.lastModified) << "\n";
+        }
+        _dirty = false;
+        _lastSave = now;
+        generation = ++_generation;
+    }
+
+    // Writers finishing out of order must not replace a newer index with an older one
+    std::lock_guard<std::mutex> lock(_saveMutex);
+    if (generation < _savedGeneration)
+        return;
+
+    std::string path = _directory + "/" + INDEX_FILENAME;
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream outFile(tempPath, std::ios::out | std::ios::trunc);
+        outFile << contents.str();
+        if (!outFile)
+            return;
+    }
+    if (std::rename(tempPath.c_str(), path.c_str()) == 0)
+        _savedGeneration = generation;
+}
+
+// Drops one reference to an object, deleting it once no URL refers to it
+void DownloadCache::release(const std::string &digest, int64_t size)
+{
+    auto it = _objectRefs.find(digest);
+    if (it == _objectRefs.end() || --it->second > 0)
+        return;
+
+    _objectRefs.erase(it);
+    std::remove(objectPath(digest).c_str());
+    _storedBytes -= size;
+}
+
+// Drops the least recently used URLs until the objects fit the capacity, keeping the given one
+void DownloadCache::evict(const std::string &keep)
+{
+    while (_storedBytes > _capacity)
+    {
+        auto oldest = _entries.end();
+        for (auto it = _entries.begin(); it != _entries.end(); ++it)
+        {
+            if (it->first != keep && (oldest == _entries.end() || it->second.lastUsed < oldest->second.lastUsed))
+                oldest = it;
+        }
+        if (oldest == _entries.end())
+            break;
+
+        release(oldest->second.digest, oldest->second.size);
+        _entries.erase(oldest);
+        _dirty = true;
+    }
+}
@@ -1,14 +1,17 @@
 #include <iostream>
+#include <cstdio>
 
 #include "aux/FileWriter.hpp"
 
-FileWriter::FileWriter(const std::string& fp, bool isAppendMode)
+FileWriter::FileWriter(const std::string& fp, bool isAppendMode) : _path(fp)
 {
     std::ios::openmode mode = std::ios::binary; // Open file in binary mode
     if (isAppendMode) {
         mode |= std::ios::app; // Append bytes to end of file
     } else {
-        mode |= std::ios::trunc; // Overwrite existing file
+        // Replace an existing file rather than truncate it, as it may be a hard link that an older version made
+        std::remove(fp.c_str());
+        mode |= std::ios::trunc;
     }
 
     _out.open(fp, mode); // Open file for writing
@@ -33,4 +36,23 @@ void FileWriter::write(const char* data, size_t size)
         // Write data to file stream
         _out.write(data, static_cast<std::streamsize>(size));
     }
-}
\ No newline at end of file
+}
+
+// Discards everything written so far, including what the file held when it was opened
+bool FileWriter::truncate()
+{
+    _out.close();
+    _out.open(_path, std::ios::binary | std::ios::trunc);
+    return _out.is_open();
+}
+
+// Flushes and closes the file before the run ends; returns false if buffered data could not be written
+bool FileWriter::close()
+{
+    if (!_out.is_open()) {
+        return true;
+    }
+
+    _out.close();
+    return !_out.fail();
+}
@@ -0,0 +1,506 @@
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "aux/HistoryStore.hpp"
+#include "util/http.hpp"
+
+namespace
+{
+    constexpr char DATA_MAGIC[4] = {'S', 'D', 'M', 'H'};
+    constexpr char INDEX_MAGIC[4] = {'S', 'D', 'M', 'I'};
+    constexpr uint32_t HISTORY_VERSION = 1;
+
+    constexpr uint32_t HEADER_FLAG_TIME_ORDERED = 1; // Entries were appended in non-decreasing endedAt order
+    constexpr uint8_t ENTRY_FLAG_REMOVED = 1;
+
+    constexpr size_t SCAN_CHUNK_ENTRIES = 1024;
+
+    // Fixed part of a record in the data file, followed by the url, destination, ETag, Last-Modified
+    // and extra destination bytes
+    struct DataRecordHeader
+    {
+        uint32_t headerSize;
+        uint32_t urlLength;
+        uint32_t destinationLength;
+        uint32_t reserved;
+        double bytesDownloaded;
+        double totalBytes;
+        int64_t addedAt;
+        int64_t endedAt;
+        int32_t status;
+        int32_t httpStatus;
+        int32_t errorCode;
+        uint32_t reserved2;
+        snapshot::RawTimings headTimings; // Added after version 1; shorter records read as zero
+        snapshot::RawTimings timings;
+        uint32_t etagLength;              // Added after the timings; the validators follow the destination
+        uint32_t lastModifiedLength;
+        uint32_t extraDestinationsLength; // Added after the validators, and stored after them
+        uint32_t reserved3;
+    };
+
+    // Fields may be appended without a version bump, as each record stores the size of its fixed part
+    static_assert(sizeof(DataRecordHeader) == 176, "History record layout changed; append fields or bump HISTORY_VERSION");
+
+    // 32-bit FNV-1a, used to index hosts and destinations
+    uint32_t hashString(const std::string &value)
+    {
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : value)
+        {
+            hash ^= c;
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    bool writeFully(int fd, const void *buffer, size_t size, uint64_t offset)
+    {
+        const char *data = static_cast<const char *>(buffer);
+        while (size > 0)
+        {
+            ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+        return true;
+    }
+
+    bool readFully(int fd, void *buffer, size_t size, uint64_t offset)
+    {
+        char *data = static_cast<char *>(buffer);
+        while (size > 0)
+        {
+            ssize_t got = pread(fd, data, size, static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return false;
+            data += got;
+            size -= static_cast<size_t>(got);
+            offset += static_cast<uint64_t>(got);
+        }
+        return true;
+    }
+}
+
+HistoryStore::HistoryStore(const std::string &path)
+    : _dataPath(path),
+      _indexPath(path + ".idx")
+{
+    open();
+}
+
+HistoryStore::~HistoryStore()
+{
+    close();
+}
+
+// Opens (or creates) the data and index files and validates their headers
+// Files with an unknown layout are reset rather than misread
+void HistoryStore::open()
+{
+    if (_dataPath.empty())
+        return; // An in-memory manager records no history
+
+    _dataFd = ::open(_dataPath.c_str(), O_RDWR | O_CREAT, 0644);
+    _indexFd = ::open(_indexPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (_dataFd < 0 || _indexFd < 0)
+    {
+        close();
+        return;
+    }
+
+    struct stat dataStat{}, indexStat{};
+    fstat(_dataFd, &dataStat);
+    fstat(_indexFd, &indexStat);
+
+    char dataMagic[8] = {};
+    bool validData = readFully(_dataFd, dataMagic, sizeof(dataMagic), 0) &&
+                     std::memcmp(dataMagic, DATA_MAGIC, sizeof(DATA_MAGIC)) == 0;
+    bool validIndex = readFully(_indexFd, &_header, sizeof(_header), 0) &&
+                      std::memcmp(_header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                      _header.version == HISTORY_VERSION;
+
+    if (!validData || !validIndex)
+    {
+        clear();
+        return;
+    }
+
+    _dataSize = static_cast<uint64_t>(dataStat.st_size);
+    _entryCount = (static_cast<uint64_t>(indexStat.st_size) - sizeof(IndexHeader)) / sizeof(IndexEntry);
+
+    // Drop a partially written trailing index entry left by a crash
+    ftruncate(_indexFd, static_cast<off_t>(sizeof(IndexHeader) + _entryCount * sizeof(IndexEntry)));
+
+    IndexEntry last{};
+    if (_entryCount > 0 && readEntry(_entryCount - 1, last))
+        _lastEndedAt = last.endedAt;
+}
+
+void HistoryStore::close()
+{
+    if (_dataFd >= 0)
+        ::close(_dataFd);
+    if (_indexFd >= 0)
+        ::close(_indexFd);
+    _dataFd = -1;
+    _indexFd = -1;
+}
+
+void HistoryStore::writeHeader()
+{
+    writeFully(_indexFd, &_header, sizeof(_header), 0);
+}
+
+// Appends a finished download and returns its id (its position in the index)
+uint64_t HistoryStore::append(const TaskRecord &record)
+{
+    DataRecordHeader raw{};
+    raw.headerSize = sizeof(DataRecordHeader);
+    raw.urlLength = static_cast<uint32_t>(record.url.size());
+    raw.destinationLength = static_cast<uint32_t>(record.destination.size());
+    raw.bytesDownloaded = record.bytesDownloaded;
+    raw.totalBytes = record.totalBytes;
+    raw.addedAt = static_cast<int64_t>(record.addedAt);
+    raw.endedAt = static_cast<int64_t>(record.endedAt);
+    raw.status = record.status;
+    raw.httpStatus = record.httpStatus;
+    raw.errorCode = record.errorCode;
+    raw.headTimings = snapshot::toRaw(record.headTimings);
+    raw.timings = snapshot::toRaw(record.timings);
+    raw.etagLength = static_cast<uint32_t>(record.etag.size());
+    raw.lastModifiedLength = static_cast<uint32_t>(record.lastModified.size());
+    std::string extraDestinations = snapshot::joinDestinations(record.extraDestinations);
+    raw.extraDestinationsLength = static_cast<uint32_t>(extraDestinations.size());
+
+    std::string buffer(reinterpret_cast<const char *>(&raw), sizeof(raw));
+    buffer.append(record.url);
+    buffer.append(record.destination);
+    buffer.append(record.etag);
+    buffer.append(record.lastModified);
+    buffer.append(extraDestinations);
+
+    // Data is written before the index entry, so a crash in between only leaves unreferenced bytes
+    if (_dataFd < 0 || !writeFully(_dataFd, buffer.data(), buffer.size(), _dataSize))
+        return UINT64_MAX;
+
+    IndexEntry entry{};
+    entry.offset = _dataSize;
+    entry.endedAt = raw.endedAt;
+    entry.hostHash = hashString(http::extractHost(record.url));
+    entry.destinationHash = hashString(record.destination);
+    entry.length = static_cast<uint32_t>(buffer.size());
+    entry.status = static_cast<uint8_t>(record.status);
+
+    uint64_t id = _entryCount;
+    if (!writeFully(_indexFd, &entry, sizeof(entry), sizeof(IndexHeader) + id * sizeof(IndexEntry)))
+        return UINT64_MAX;
+
+    _dataSize += buffer.size();
+    _entryCount++;
+
+    if (entry.endedAt < _lastEndedAt)
+        _header.flags &= ~HEADER_FLAG_TIME_ORDERED;
+    _lastEndedAt = std::max(_lastEndedAt, entry.endedAt);
+
+    if (entry.status < HISTORY_STATUS_SLOTS)
+        _header.statusCounts[entry.status]++;
+    writeHeader();
+
+    _revision++;
+    return id;
+}
+
+// Reads the record with the given id; returns false if it does not exist or was removed
+bool HistoryStore::read(uint64_t id, TaskRecord &record) const
+{
+    IndexEntry entry{};
+    if (!readEntry(id, entry) || (entry.flags & ENTRY_FLAG_REMOVED) || entry.length < sizeof(uint32_t))
+        return false;
+
+    std::string buffer(entry.length, '\0');
+    if (!readFully(_dataFd, &buffer[0], buffer.size(), entry.offset))
+        return false;
+
+    // Records written by older versions may have a shorter fixed part; a corrupt size must not take the
+    // copy past the record
+    DataRecordHeader raw{};
+    uint32_t headerSize;
+    std::memcpy(&headerSize, buffer.data(), sizeof(headerSize));
+    if (headerSize < sizeof(headerSize) || headerSize > buffer.size())
+        return false;
+    std::memcpy(&raw, buffer.data(), std::min<size_t>(headerSize, sizeof(raw)));
+
+    uint64_t stringsEnd = static_cast<uint64_t>(headerSize) + raw.urlLength + raw.destinationLength +
+                          raw.etagLength + raw.lastModifiedLength + raw.extraDestinationsLength;
+    if (stringsEnd > buffer.size())
+        return false;
+
+    size_t offset = headerSize;
+    record.url.assign(buffer, offset, raw.urlLength);
+    offset += raw.urlLength;
+    record.destination.assign(buffer, offset, raw.destinationLength);
+    offset += raw.destinationLength;
+    record.etag.assign(buffer, offset, raw.etagLength);
+    offset += raw.etagLength;
+    record.lastModified.assign(buffer, offset, raw.lastModifiedLength);
+    offset += raw.lastModifiedLength;
+    record.extraDestinations = snapshot::splitDestinations(buffer.substr(offset, raw.extraDestinationsLength));
+    record.bytesDownloaded = raw.bytesDownloaded;
+    record.totalBytes = raw.totalBytes;
+    record.status = raw.status;
+    record.httpStatus = raw.httpStatus;
+    record.errorCode = raw.errorCode;
+    record.addedAt = static_cast<time_t>(raw.addedAt);
+    record.endedAt = static_cast<time_t>(raw.endedAt);
+    record.headTimings = snapshot::fromRaw(raw.headTimings);
+    record.timings = snapshot::fromRaw(raw.timings);
+    return true;
+}
+
+// Marks an entry as removed; its bytes stay in the data file until the history is cleared
+bool HistoryStore::remove(uint64_t id)
+{
+    IndexEntry entry{};
+    if (!readEntry(id, entry) || (entry.flags & ENTRY_FLAG_REMOVED))
+        return false;
+
+    entry.flags |= ENTRY_FLAG_REMOVED;
+    if (!writeFully(_indexFd, &entry, sizeof(entry), sizeof(IndexHeader) + id * sizeof(IndexEntry)))
+        return false;
+
+    if (entry.status < HISTORY_STATUS_SLOTS && _header.statusCounts[entry.status] > 0)
+        _header.statusCounts[entry.status]--;
+    writeHeader();
+
+    _revision++;
+    return true;
+}
+
+// Discards all history and writes fresh file headers
+void HistoryStore::clear()
+{
+    if (_dataFd < 0 || _indexFd < 0)
+        return;
+
+    ftruncate(_dataFd, 0);
+    ftruncate(_indexFd, 0);
+
+    char dataMagic[8] = {};
+    std::memcpy(dataMagic, DATA_MAGIC, sizeof(DATA_MAGIC));
+    std::memcpy(dataMagic + sizeof(DATA_MAGIC), &HISTORY_VERSION, sizeof(HISTORY_VERSION));
+    writeFully(_dataFd, dataMagic, sizeof(dataMagic), 0);
+
+    _header = IndexHeader{};
+    std::memcpy(_header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    _header.version = HISTORY_VERSION;
+    _header.flags = HEADER_FLAG_TIME_ORDERED;
+    writeHeader();
+
+    _dataSize = sizeof(dataMagic);
+    _entryCount = 0;
+    _lastEndedAt = 0;
+    _revision++;
+}
+
+// Returns up to limit matching entries, newest first, after skipping the first offset matches
+std::vector<HistoryEntry> HistoryStore::query(const HistoryQuery &query, size_t offset, size_t limit) const
+{
+    std::vector<HistoryEntry> results;
+    if (limit == 0)
+        return results;
+
+    size_t skipped = 0;
+    scanNewestFirst(query, [&](uint64_t id, const TaskRecord *record)
+                    {
+                        if (skipped < offset)
+                        {
+                            skipped++;
+                            return true;
+                        }
+
+                        HistoryEntry entry{id, {}};
+                        if (record)
+                            entry.record = *record;
+                        else if (!read(id, entry.record))
+                            return true;
+
+                        results.push_back(std::move(entry));
+                        return results.size() < limit; });
+
+    return results;
+}
+
+// Counts matching entries using only the index where possible
+size_t HistoryStore::count(const HistoryQuery &query) const
+{
+    if (query.host.empty() && query.destination.empty() && query.since == 0)
+    {
+        if (query.status < 0)
+        {
+            size_t total = 0;
+            for (uint64_t statusCount : _header.statusCounts)
+                total += statusCount;
+            return total;
+        }
+        return countByStatus(query.status);
+    }
+
+    size_t total = 0;
+    scanNewestFirst(query, [&](uint64_t, const TaskRecord *)
+                    {
+                        total++;
+                        return true; });
+    return total;
+}
+
+size_t HistoryStore::countByStatus(int status) const
+{
+    if (status < 0 || static_cast<size_t>(status) >= HISTORY_STATUS_SLOTS)
+        return 0;
+    return _header.statusCounts[status];
+}
+
+// Adds up the request timings of matching entries per host, busiest host first
+// Reads every matching record, so callers should cache the result until the revision changes
+std::vector<HostTimingSummary> HistoryStore::summarizeHosts(const HistoryQuery &query) const
+{
+    std::unordered_map<std::string, HostTimingSummary> hosts;
+
+    scanNewestFirst(query, [&](uint64_t id, const TaskRecord *matched)
+                    {
+                        TaskRecord record;
+                        if (matched)
+                            record = *matched;
+                        else if (!read(id, record))
+                            return true;
+
+                        std::string host = http::extractHost(record.url);
+                        HostTimingSummary &summary = hosts[host];
+                        summary.host = host;
+                        summary.downloads++;
+
+                        for (const TransferTimings *timings : {&record.headTimings, &record.timings})
+                        {
+                            if (timings->isEmpty())
+                                continue;
+                            summary.requests++;
+                            summary.redirects += static_cast<size_t>(timings->redirects);
+                            summary.lookupUs += timings->lookupPhaseUs();
+                            summary.connectUs += timings->connectPhaseUs();
+                            summary.tlsUs += timings->tlsPhaseUs();
+                            summary.waitUs += timings->waitPhaseUs();
+                        }
+
+                        if (record.status == static_cast<int>(DownloadStatus::COMPLETED) && !record.timings.isEmpty())
+                        {
+                            summary.completedWithTimings++;
+                            summary.transferUs += record.timings.transferPhaseUs();
+                            summary.transferBytes += record.bytesDownloaded;
+                        }
+                        return true; });
+
+    std::vector<HostTimingSummary> result;
+    result.reserve(hosts.size());
+    for (auto &entry : hosts)
+        result.push_back(std::move(entry.second));
+
+    std::sort(result.begin(), result.end(), [](const HostTimingSummary &a, const HostTimingSummary &b)
+              { return a.downloads != b.downloads ? a.downloads > b.downloads : a.host < b.host; });
+    return result;
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+bool HistoryStore::readEntry(uint64_t id, IndexEntry &entry) const
+{
+    if (_indexFd < 0 || id >= _entryCount)
+        return false;
+    return readFully(_indexFd, &entry, sizeof(entry), sizeof(IndexHeader) + id * sizeof(IndexEntry));
+}
+
+bool HistoryStore::matches(const IndexEntry &entry, const HistoryQuery &query, uint32_t hostHash, uint32_t destinationHash) const
+{
+    if (entry.flags & ENTRY_FLAG_REMOVED)
+        return false;
+    if (query.status >= 0 && entry.status != query.status)
+        return false;
+    if (query.since != 0 && entry.endedAt < query.since)
+        return false;
+    if (!query.host.empty() && entry.hostHash != hostHash)
+        return false;
+    if (!query.destination.empty() && entry.destinationHash != destinationHash)
+        return false;
+    return true;
+}
+
+// Walks the index from the newest entry backwards in chunks, calling visit(id, record) for each match
+// record is non-null when the record had to be read to rule out a hash collision
+// Stops when visit returns false, or early on time-bounded queries once older entries are reached
+template <typename Visitor>
+void HistoryStore::scanNewestFirst(const HistoryQuery &query, Visitor visit) const
+{
+    std::string host = query.host;
+    std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+    uint32_t hostHash = hashString(host);
+    uint32_t destinationHash = hashString(query.destination);
+    bool needsVerification = !query.host.empty() || !query.destination.empty();
+    bool timeOrdered = _header.flags & HEADER_FLAG_TIME_ORDERED;
+
+    std::vector<IndexEntry> chunk(SCAN_CHUNK_ENTRIES);
+    uint64_t end = _entryCount;
+    while (end > 0)
+    {
+        uint64_t begin = end > SCAN_CHUNK_ENTRIES ? end - SCAN_CHUNK_ENTRIES : 0;
+        size_t n = static_cast<size_t>(end - begin);
+        if (!readFully(_indexFd, chunk.data(), n * sizeof(IndexEntry), sizeof(IndexHeader) + begin * sizeof(IndexEntry)))
+            return;
+
+        for (size_t i = n; i-- > 0;)
+        {
+            const IndexEntry &entry = chunk[i];
+            if (timeOrdered && query.since != 0 && entry.endedAt < query.since)
+                return; // Everything older is out of range too
+
+            if (!matches(entry, query, hostHash, destinationHash))
+                continue;
+
+            uint64_t id = begin + i;
+            if (needsVerification)
+            {
+                TaskRecord record;
+                if (!read(id, record) ||
+                    (!query.host.empty() && http::extractHost(record.url) != host) ||
+                    (!query.destination.empty() && record.destination != query.destination))
+                {
+                    continue;
+                }
+                if (!visit(id, &record))
+                    return;
+            }
+            else if (!visit(id, nullptr))
+            {
+                return;
+            }
+        }
+
+        end = begin;
+    }
+}
@@ -0,0 +1,265 @@
+#include <charconv>
+#include <cstdio>
+#include <curl/curl.h>
+
+#include "aux/Metrics.hpp"
+
+namespace
+{
+    struct HistogramSpec
+    {
+        const char *name;
+        const char *help;
+        std::vector<double> bounds; // Upper bounds of the finite buckets, ascending
+    };
+
+    const HistogramSpec HISTOGRAMS[] = {
+        {"sdm_download_duration_seconds", "Duration of completed download runs.",
+         {0.1, 0.5, 1, 2.5, 5, 10, 30, 60, 300, 900, 3600}},
+        {"sdm_time_to_first_byte_seconds", "Time from the start of a download run to its first response byte.",
+         {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10}},
+        {"sdm_download_throughput_bytes_per_second", "Average throughput of completed download runs.",
+         {16e3, 64e3, 256e3, 1e6, 4e6, 16e6, 64e6, 256e6, 1e9}},
+    };
+
+    std::atomic<uint64_t> nextInstance{1};
+
+    // The shard this thread last recorded into, and the registry it belongs to
+    thread_local uint64_t cachedInstance = 0;
+    thread_local void *cachedShard = nullptr;
+
+    // Shards have a single writer, so a plain load and store replaces a locked read-modify-write
+    template <typename T>
+    void addLocal(std::atomic<T> &counter, T delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    void appendHeader(std::string &out, const char *name, const char *type, const char *help)
+    {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+
+    void appendSample(std::string &out, const char *name, const std::string &labels, double value)
+    {
+        // Shortest exact form without an exponent, so counters read as plain integers
+        char number[64];
+        auto result = std::to_chars(number, number + sizeof(number), value, std::chars_format::fixed);
+        if (result.ec != std::errc())
+            result = std::to_chars(number, number + sizeof(number), value);
+        out += name;
+        if (!labels.empty())
+            out += "{" + labels + "}";
+        out += ' ';
+        out.append(number, result.ptr);
+        out += '\n';
+    }
+}
+
+Metrics::Metrics() : _instance(nextInstance.fetch_add(1)) {}
+
+void Metrics::addBytes(int64_t bytes)
+{
+    addLocal(localShard().bytes, bytes);
+}
+
+void Metrics::recordRequest(MetricsRequest request)
+{
+    addLocal<uint64_t>(localShard().requests[static_cast<size_t>(request)], 1);
+}
+
+void Metrics::recordCompleted()
+{
+    addLocal<uint64_t>(localShard().completed, 1);
+}
+
+// Counts a failed request under its curl error and, for HTTP errors, its status code
+void Metrics::recordFailure(int curlCode, int httpStatus)
+{
+    Shard &shard = localShard();
+    addLocal<uint64_t>(shard.failed, 1);
+
+    if (curlCode > 0 && static_cast<size_t>(curlCode) < METRICS_CURL_CODES)
+        addLocal<uint64_t>(shard.curlErrors[curlCode], 1);
+    if (httpStatus >= 400 && static_cast<size_t>(httpStatus) < METRICS_HTTP_STATUSES)
+        addLocal<uint64_t>(shard.httpErrors[httpStatus], 1);
+}
+
+void Metrics::recordRetry()
+{
+    addLocal<uint64_t>(localShard().retries, 1);
+}
+
+void Metrics::recordCacheHit()
+{
+    addLocal<uint64_t>(localShard().cacheHits, 1);
+}
+
+void Metrics::observe(MetricsHistogram histogram, double value)
+{
+    size_t index = static_cast<size_t>(histogram);
+    const auto &bounds = HISTOGRAMS[index].bounds;
+
+    // Each observation lands in the first bucket that holds it; render() accumulates them
+    size_t bucket = 0;
+    while (bucket < bounds.size() && value > bounds[bucket])
+        bucket++;
+
+    Shard &shard = localShard();
+    addLocal<uint64_t>(shard.buckets[index][bucket], 1);
+    addLocal(shard.sums[index], value);
+}
+
+void Metrics::setTaskCounts(size_t queued, size_t active, size_t paused)
+{
+    _queued.store(queued, std::memory_order_relaxed);
+    _active.store(active, std::memory_order_relaxed);
+    _paused.store(paused, std::memory_order_relaxed);
+}
+
+int64_t Metrics::getBytesTransferred() const
+{
+    std::lock_guard<std::mutex> lock(_shardsMutex);
+    return static_cast<int64_t>(sum([](const Shard &shard)
+                                    { return static_cast<uint64_t>(shard.bytes.load(std::memory_order_relaxed)); }));
+}
+
+// Appends every metric in the Prometheus text exposition format (version 0.0.4)
+void Metrics::render(std::string &out) const
+{
+    std::lock_guard<std::mutex> lock(_shardsMutex);
+    auto total = [this](auto reader)
+    { return static_cast<double>(sum(reader)); };
+
+    appendHeader(out, "sdm_bytes_downloaded_total", "counter", "Bytes received by all downloads.");
+    appendSample(out, "sdm_bytes_downloaded_total", "", total([](const Shard &s)
+                                                              { return static_cast<uint64_t>(s.bytes.load(std::memory_order_relaxed)); }));
+
+    appendHeader(out, "sdm_requests_total", "counter", "HTTP requests made, by method.");
+    const char *methods[] = {"HEAD", "GET"};
+    for (size_t i = 0; i < 2; ++i)
+    {
+        appendSample(out, "sdm_requests_total", std::string("method=\"") + methods[i] + "\"",
+                     total([i](const Shard &s)
+                           { return s.requests[i].load(std::memory_order_relaxed); }));
+    }
+
+    appendHeader(out, "sdm_downloads_completed_total", "counter", "Downloads that completed.");
+    appendSample(out, "sdm_downloads_completed_total", "", total([](const Shard &s)
+                                                                 { return s.completed.load(std::memory_order_relaxed); }));
+
+    appendHeader(out, "sdm_downloads_failed_total", "counter", "Requests that failed, including filename resolution.");
+    appendSample(out, "sdm_downloads_failed_total", "", total([](const Shard &s)
+                                                              { return s.failed.load(std::memory_order_relaxed); }));
+
+    appendHeader(out, "sdm_retries_total", "counter", "Failed transfers retried, automatically or on request.");
+    appendSample(out, "sdm_retries_total", "", total([](const Shard &s)
+                                                     { return s.retries.load(std::memory_order_relaxed); }));
+
+    appendHeader(out, "sdm_cache_hits_total", "counter", "Downloads served from the local cache after the server confirmed them unchanged.");
+    appendSample(out, "sdm_cache_hits_total", "", total([](const Shard &s)
+                                                        { return s.cacheHits.load(std::memory_order_relaxed); }));
+
+    appendHeader(out, "sdm_curl_errors_total", "counter", "Failed requests by curl error code.");
+    for (size_t code = 1; code < METRICS_CURL_CODES; ++code)
+    {
+        double count = total([code](const Shard &s)
+                             { return s.curlErrors[code].load(std::memory_order_relaxed); });
+        if (count > 0)
+        {
+            std::string labels = "code=\"" + std::to_string(code) + "\",error=\"" +
+                                 curl_easy_strerror(static_cast<CURLcode>(code)) + "\"";
+            appendSample(out, "sdm_curl_errors_total", labels, count);
+        }
+    }
+
+    appendHeader(out, "sdm_http_errors_total", "counter", "Failed requests by HTTP status code.");
+    for (size_t status = 400; status < METRICS_HTTP_STATUSES; ++status)
+    {
+        double count = total([status](const Shard &s)
+                             { return s.httpErrors[status].load(std::memory_order_relaxed); });
+        if (count > 0)
+            appendSample(out, "sdm_http_errors_total", "status=\"" + std::to_string(status) + "\"", count);
+    }
+
+    appendHeader(out, "sdm_tasks", "gauge", "Unfinished downloads by status.");
+    appendSample(out, "sdm_tasks", "status=\"queued\"", static_cast<double>(_queued.load(std::memory_order_relaxed)));
+    appendSample(out, "sdm_tasks", "status=\"active\"", static_cast<double>(_active.load(std::memory_order_relaxed)));
+    appendSample(out, "sdm_tasks", "status=\"paused\"", static_cast<double>(_paused.load(std::memory_order_relaxed)));
+
+    for (size_t h = 0; h < static_cast<size_t>(MetricsHistogram::COUNT); ++h)
+    {
+        const HistogramSpec &spec = HISTOGRAMS[h];
+        appendHeader(out, spec.name, "histogram", spec.help);
+
+        std::string bucketName = std::string(spec.name) + "_bucket";
+        double cumulative = 0;
+        for (size_t b = 0; b <= spec.bounds.size(); ++b)
+        {
+            cumulative += total([h, b](const Shard &s)
+                                { return s.buckets[h][b].load(std::memory_order_relaxed); });
+
+            char bound[32];
+            if (b < spec.bounds.size())
+                std::snprintf(bound, sizeof(bound), "%g", spec.bounds[b]);
+            else
+                std::snprintf(bound, sizeof(bound), "+Inf");
+            appendSample(out, bucketName.c_str(), std::string("le=\"") + bound + "\"", cumulative);
+        }
+
+        double sumValue = 0;
+        for (const auto &shard : _shards)
+            sumValue += shard->sums[h].load(std::memory_order_relaxed);
+        appendSample(out, (std::string(spec.name) + "_sum").c_str(), "", sumValue);
+        appendSample(out, (std::string(spec.name) + "_count").c_str(), "", cumulative);
+    }
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+// Returns the calling thread's shard, creating it on the thread's first record
+// Only the first record after switching between managers takes the lock
+Metrics::Shard &Metrics::localShard()
+{
+    if (cachedInstance == _instance)
+        return *static_cast<Shard *>(cachedShard);
+
+    std::lock_guard<std::mutex> lock(_shardsMutex);
+    Shard *shard = nullptr;
+    for (const auto &candidate : _shards)
+    {
+        if (candidate->owner == std::this_thread::get_id())
+            shard = candidate.get();
+    }
+
+    if (!shard)
+    {
+        _shards.push_back(std::make_unique<Shard>());
+        shard = _shards.back().get();
+        shard->owner = std::this_thread::get_id();
+    }
+
+    cachedInstance = _instance;
+    cachedShard = shard;
+    return *shard;
+}
+
+// Adds up one counter across all shards; the caller holds _shardsMutex
+template <typename Reader>
+uint64_t Metrics::sum(Reader reader) const
+{
+    uint64_t value = 0;
+    for (const auto &shard : _shards)
+        value += reader(*shard);
+    return value;
+}
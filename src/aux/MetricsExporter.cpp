@@ -0,0 +1,185 @@
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+
+#include "aux/MetricsExporter.hpp"
+#include "aux/UnixSocket.hpp"
+#include "aux/Tracing.hpp"
+
+MetricsExporter::MetricsExporter(const Metrics &metrics) : _metrics(metrics) {}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+// Binds the port (0 disables the endpoint) and starts the exporter thread
+// An empty file path disables the file; fails if neither is enabled or the port is taken
+bool MetricsExporter::start(int port, const std::string &filePath, std::chrono::milliseconds interval, std::string &error)
+{
+    _filePath = filePath;
+    _interval = interval;
+
+    if (port > 0)
+    {
+        _listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (_listenFd < 0)
+        {
+            error = std::string("cannot create metrics socket: ") + std::strerror(errno);
+            return false;
+        }
+
+        int reuse = 1;
+        setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        // Loopback only: the metrics describe local files and URLs
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(_listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::listen(_listenFd, 16) != 0)
+        {
+            error = "cannot listen on 127.0.0.1:" + std::to_string(port) + ": " + std::strerror(errno);
+            close(_listenFd);
+            _listenFd = -1;
+            return false;
+        }
+    }
+
+    if (_listenFd < 0 && _filePath.empty())
+    {
+        error = "no metrics port or file given";
+        return false;
+    }
+
+    _thread = std::thread(&MetricsExporter::run, this);
+    return true;
+}
+
+// Stops the thread, writing the file one last time so it holds the final counts
+void MetricsExporter::stop()
+{
+    if (_stopping.exchange(true))
+        return;
+
+    _stopNotifier.notify();
+    if (_thread.joinable())
+        _thread.join();
+
+    if (_listenFd >= 0)
+    {
+        close(_listenFd);
+        _listenFd = -1;
+    }
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+void MetricsExporter::run()
+{
+    tracing::setThreadName("metrics exporter");
+    auto nextWrite = std::chrono::steady_clock::now();
+
+    while (!_stopping.load())
+    {
+        int timeout = -1;
+        if (!_filePath.empty())
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= nextWrite)
+            {
+                writeFile();
+                nextWrite = now + _interval;
+            }
+            timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(nextWrite - now).count()) + 1;
+        }
+
+        pollfd fds[2] = {{_stopNotifier.getFd(), POLLIN, 0}, {_listenFd, POLLIN, 0}};
+        poll(fds, _listenFd >= 0 ? 2 : 1, timeout);
+
+        if (_listenFd >= 0 && (fds[1].revents & POLLIN))
+        {
+            int client = accept4(_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0)
+            {
+                serveClient(client);
+                close(client);
+            }
+        }
+    }
+
+    if (!_filePath.empty())
+        writeFile();
+}
+
+// Answers one HTTP request; only GET /metrics (or /) is served
+// Scrapers send a request and wait, so the exchange is handled synchronously with a short timeout
+void MetricsExporter::serveClient(int fd)
+{
+    timeval timeout{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char chunk[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < METRICS_MAX_REQUEST_LENGTH)
+    {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+        request.append(chunk, static_cast<size_t>(n));
+    }
+
+    std::string response;
+    if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET / ", 0) == 0)
+    {
+        std::string body;
+        _metrics.render(body);
+        response = "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                   "Connection: close\r\n\r\n" + body;
+    }
+    else
+    {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+
+    unixsocket::sendAll(fd, response);
+}
+
+// Writes the metrics beside the target and renames them into place, so readers never see a partial file
+void MetricsExporter::writeFile()
+{
+    std::string body;
+    _metrics.render(body);
+
+    std::string tempPath = _filePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::trunc);
+        if (!file)
+            return;
+        file << body;
+        if (!file.flush())
+            return;
+    }
+
+    if (std::rename(tempPath.c_str(), _filePath.c_str()) != 0)
+        std::remove(tempPath.c_str());
+}
@@ -0,0 +1,54 @@
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "aux/Notifier.hpp"
+
+Notifier::Notifier()
+{
+    if (pipe(_fds) != 0)
+    {
+        _fds[0] = _fds[1] = -1;
+        return;
+    }
+
+    for (int fd : _fds)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+}
+
+Notifier::~Notifier()
+{
+    for (int fd : _fds)
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+// Makes the read end readable; only the first call before a drain touches the pipe
+void Notifier::notify()
+{
+    if (_fds[1] < 0 || _signalled.exchange(true))
+        return;
+
+    char byte = 1;
+    ssize_t written = write(_fds[1], &byte, 1);
+    (void)written; // A full pipe is already readable
+}
+
+// Empties the pipe and returns true if a notification was pending
+// The pipe is emptied before the flag is cleared, so a notify() racing with this call either
+// finds the flag still set (and its event is handled by the caller) or writes a fresh byte
+bool Notifier::drain()
+{
+    if (!_signalled.load())
+        return false;
+
+    char buffer[64];
+    while (read(_fds[0], buffer, sizeof(buffer)) > 0)
+    {
+    }
+    return _signalled.exchange(false);
+}
@@ -0,0 +1,78 @@
+#include "aux/SpeedEstimator.hpp"
+
+// Records a sample unless one was taken less than SAMPLE_INTERVAL ago
+// Must only be called from a single thread at a time
+void SpeedEstimator::record(Clock::time_point now, int64_t bytes)
+{
+    int64_t nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+    uint64_t count = _count.load(std::memory_order_relaxed);
+
+    if (count > 0 && nowNs - _lastRecordNs < std::chrono::nanoseconds(SAMPLE_INTERVAL).count())
+        return;
+
+    Slot &slot = _slots[count % CAPACITY];
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed); // Odd: write in progress
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.timeNs.store(nowNs, std::memory_order_relaxed);
+    slot.bytes.store(bytes, std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+
+    _lastRecordNs = nowNs;
+    _count.store(count + 1, std::memory_order_release);
+}
+
+// Discards all samples, e.g. when a new run starts from a different offset
+void SpeedEstimator::reset()
+{
+    _count.store(0, std::memory_order_release);
+    _lastRecordNs = 0;
+}
+
+// Returns the average speed between the newest sample and the oldest one inside WINDOW
+double SpeedEstimator::bytesPerSecond() const
+{
+    uint64_t count = _count.load(std::memory_order_acquire);
+    if (count < 2)
+        return 0.0;
+
+    int64_t newestNs, newestBytes;
+    if (!readSlot(count - 1, newestNs, newestBytes))
+        return 0.0;
+
+    // Leave one slot of slack for the writer, which may be overwriting the oldest sample
+    uint64_t available = count < CAPACITY - 1 ? count : CAPACITY - 1;
+    int64_t windowNs = std::chrono::nanoseconds(WINDOW).count();
+    int64_t oldestNs = newestNs, oldestBytes = newestBytes;
+
+    for (uint64_t back = 2; back <= available; ++back)
+    {
+        int64_t timeNs, bytes;
+        if (!readSlot(count - back, timeNs, bytes) || newestNs - timeNs > windowNs)
+            break;
+        oldestNs = timeNs;
+        oldestBytes = bytes;
+    }
+
+    double seconds = static_cast<double>(newestNs - oldestNs) / 1e9;
+    double deltaBytes = static_cast<double>(newestBytes - oldestBytes);
+    if (seconds <= 0.0 || deltaBytes <= 0.0)
+        return 0.0;
+
+    return deltaBytes / seconds;
+}
+
+// Reads a consistent sample, returning false if the writer is updating or has reused the slot
+bool SpeedEstimator::readSlot(uint64_t index, int64_t &timeNs, int64_t &bytes) const
+{
+    const Slot &slot = _slots[index % CAPACITY];
+
+    uint32_t before = slot.sequence.load(std::memory_order_acquire);
+    timeNs = slot.timeNs.load(std::memory_order_relaxed);
+    bytes = slot.bytes.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t after = slot.sequence.load(std::memory_order_relaxed);
+
+    return (before & 1) == 0 && before == after;
+}
@@ -0,0 +1,158 @@
+#include <algorithm>
+
+#include "aux/StatePersister.hpp"
+#include "aux/Tracing.hpp"
+
+StatePersister::StatePersister(const std::string &path, std::chrono::milliseconds interval)
+    : _path(path),
+      _interval(interval),
+      _lastSubmitTime(std::chrono::steady_clock::now() - interval),
+      _writer(&StatePersister::writerThread, this)
+{
+}
+
+// Stops the writer thread once any pending snapshot has been written
+StatePersister::~StatePersister()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_stop)
+            return; // Already stopped by flush()
+        _stop = true;
+    }
+
+    _condition.notify_one();
+    _writer.join();
+}
+
+// Records that the state has changed since the last submitted snapshot
+void StatePersister::markDirty()
+{
+    _dirty.store(true);
+}
+
+// Returns true if the state is dirty and the debounce interval has elapsed
+bool StatePersister::isDue() const
+{
+    return _dirty.load() && std::chrono::steady_clock::now() - _lastSubmitTime >= _interval;
+}
+
+// Returns how long until a dirty state becomes due, or milliseconds::max() if the state is clean
+std::chrono::milliseconds StatePersister::timeUntilDue() const
+{
+    if (!_dirty.load())
+        return std::chrono::milliseconds::max();
+
+    auto elapsed = std::chrono::steady_clock::now() - _lastSubmitTime;
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(_interval - elapsed);
+    return std::max(remaining, std::chrono::milliseconds(0));
+}
+
+// Seeds the saved tasks with those already on disk, without writing them again
+// Called before anything is submitted, while the writer thread is idle
+void StatePersister::load(StateChanges changes)
+{
+    apply(changes);
+}
+
+// Hands the changes to the writer thread, which applies them to its copy of the saved tasks and writes
+// the snapshot; changes submitted while a write is in progress are applied together afterwards
+void StatePersister::submit(StateChanges changes)
+{
+    _dirty.store(false);
+    _lastSubmitTime = std::chrono::steady_clock::now();
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _pending.push_back(std::move(changes));
+    }
+
+    _condition.notify_one();
+}
+
+// Stops the writer thread and writes the final snapshot synchronously, including changes it had not
+// applied yet
+// Used on shutdown so the latest state is on disk before the process exits
+void StatePersister::flush(StateChanges changes)
+{
+    std::vector<StateChanges> pending;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stop = true;
+        pending.swap(_pending); // Written below rather than by the writer thread
+    }
+
+    _condition.notify_one();
+    if (_writer.joinable())
+        _writer.join();
+
+    for (auto &earlier : pending)
+        apply(earlier);
+    apply(changes);
+
+    _dirty.store(false);
+    write();
+}
+
+// Waits for submitted changes and writes the snapshot outside the lock
+void StatePersister::writerThread()
+{
+    tracing::setThreadName("state writer");
+
+    while (true)
+    {
+        std::vector<StateChanges> pending;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _condition.wait(lock, [this]
+                            { return _stop || !_pending.empty(); });
+
+            if (_pending.empty())
+                return; // Stopping with nothing left to write
+
+            pending.swap(_pending);
+        }
+
+        for (auto &changes : pending)
+            apply(changes);
+        write();
+    }
+}
+
+// Replaces the saved form of each changed task and drops the removed ones
+// A task whose position changed, e.g. because it moved to another list, is moved in the snapshot order
+void StatePersister::apply(StateChanges &changes)
+{
+    for (auto &[position, record] : changes.saved)
+    {
+        auto known = _positions.find(record.id);
+        if (known == _positions.end())
+        {
+            _positions.emplace(record.id, position);
+        }
+        else if (known->second != position)
+        {
+            _saved.erase(known->second);
+            known->second = position;
+        }
+        _saved[position] = std::move(record);
+    }
+
+    for (uint64_t id : changes.removed)
+    {
+        auto known = _positions.find(id);
+        if (known == _positions.end())
+            continue;
+        _saved.erase(known->second);
+        _positions.erase(known);
+    }
+}
+
+void StatePersister::write()
+{
+    tracing::Scope span("state", "write snapshot");
+    snapshot::writeBinary(_path, _saved.size(), [this](const TaskRecordCallback &visit)
+                          {
+                              for (const auto &entry : _saved)
+                                  visit(entry.second); });
+}
@@ -0,0 +1,421 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "aux/StateSnapshot.hpp"
+
+namespace
+{
+    // On-disk header; values are stored in host byte order as the file never leaves the machine
+    struct SnapshotHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t reserved;
+        uint64_t recordCount;
+        uint64_t arenaSize;
+    };
+
+    // Fixed-size on-disk record; strings are referenced by offset and length into the arena
+    struct SnapshotRecord
+    {
+        uint64_t urlOffset;
+        uint64_t destinationOffset;
+        uint32_t urlLength;
+        uint32_t destinationLength;
+        double bytesDownloaded;
+        double totalBytes;
+        int64_t addedAt;
+        int64_t endedAt;
+        int32_t status;
+        int32_t httpStatus;
+        int32_t errorCode;
+        uint32_t reserved;
+        uint64_t id;                      // Added in version 2
+        snapshot::RawTimings headTimings; // Added in version 3
+        snapshot::RawTimings timings;     // Added in version 3
+        uint64_t etagOffset;              // Added in version 4
+        uint64_t lastModifiedOffset;      // Added in version 4
+        uint32_t etagLength;
+        uint32_t lastModifiedLength;
+        uint64_t extraDestinationsOffset; // Added in version 5
+        uint32_t extraDestinationsLength;
+        uint32_t reserved2;
+    };
+
+    // Size of a version 1 record; newer fields are zero when reading older snapshots
+    constexpr uint32_t MIN_RECORD_SIZE = 72;
+
+    static_assert(sizeof(SnapshotHeader) == 32, "Snapshot header layout changed");
+    static_assert(sizeof(SnapshotRecord) == 216, "Snapshot record layout changed; bump snapshot::VERSION");
+
+    // Read-only memory mapping of a whole file, unmapped on destruction
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const std::string &path)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+
+            struct stat fileStat{};
+            if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+            {
+                void *addr = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr != MAP_FAILED)
+                {
+                    _data = static_cast<const char *>(addr);
+                    _size = static_cast<size_t>(fileStat.st_size);
+                    madvise(addr, _size, MADV_SEQUENTIAL); // Records are visited front to back
+                }
+            }
+
+            close(fd); // The mapping stays valid after the descriptor is closed
+        }
+
+        ~MappedFile()
+        {
+            if (_data)
+                munmap(const_cast<char *>(_data), _size);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *data() const { return _data; }
+        size_t size() const { return _size; }
+
+    private:
+        const char *_data = nullptr;
+        size_t _size = 0;
+    };
+
+    // Writes the buffer to a temporary file beside the target, syncs it, and renames it into place
+    // A crash part-way through leaves the previous file intact
+    bool writeFileAtomically(const std::string &path, const std::string &buffer)
+    {
+        std::string tempPath = path + ".tmp";
+        int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        const char *data = buffer.data();
+        size_t remaining = buffer.size();
+        while (remaining > 0)
+        {
+            ssize_t written = write(fd, data, remaining);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                close(fd);
+                unlink(tempPath.c_str());
+                return false;
+            }
+            data += written;
+            remaining -= static_cast<size_t>(written);
+        }
+
+        bool synced = fsync(fd) == 0;
+        close(fd);
+
+        if (!synced || rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            unlink(tempPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    // Appends a string to the arena, recording where it was placed
+    void appendToArena(std::string &arena, const std::string &value, uint64_t &offset, uint32_t &length)
+    {
+        offset = arena.size();
+        length = static_cast<uint32_t>(value.size());
+        arena.append(value);
+    }
+}
+
+namespace snapshot
+{
+    RawTimings toRaw(const TransferTimings &timings)
+    {
+        return {timings.nameLookupUs, timings.connectUs, timings.appConnectUs,
+                timings.startTransferUs, timings.totalUs, timings.redirects, 0};
+    }
+
+    TransferTimings fromRaw(const RawTimings &raw)
+    {
+        TransferTimings timings;
+        timings.nameLookupUs = raw.nameLookupUs;
+        timings.connectUs = raw.connectUs;
+        timings.appConnectUs = raw.appConnectUs;
+        timings.startTransferUs = raw.startTransferUs;
+        timings.totalUs = raw.totalUs;
+        timings.redirects = raw.redirects;
+        return timings;
+    }
+
+    std::string joinDestinations(const std::vector<std::string> &destinations)
+    {
+        std::string joined;
+        for (const auto &destination : destinations)
+        {
+            joined += destination;
+            joined += '\n';
+        }
+        return joined;
+    }
+
+    std::vector<std::string> splitDestinations(const std::string &joined)
+    {
+        std::vector<std::string> destinations;
+        size_t start = 0, end;
+        while ((end = joined.find('\n', start)) != std::string::npos)
+        {
+            destinations.push_back(joined.substr(start, end - start));
+            start = end + 1;
+        }
+        return destinations;
+    }
+
+    bool isBinarySnapshot(const std::string &path)
+    {
+        std::ifstream inFile(path, std::ios::binary);
+        char magic[sizeof(MAGIC)] = {};
+        if (!inFile.read(magic, sizeof(magic)))
+            return false;
+
+        return std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    }
+
+    // Maps the snapshot and decodes each record in place
+    // Returns false if the file is missing, truncated or of an unknown version
+    bool readBinary(const std::string &path, const TaskRecordCallback &onRecord)
+    {
+        MappedFile file(path);
+        if (!file.data() || file.size() < sizeof(SnapshotHeader))
+            return false;
+
+        SnapshotHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version > VERSION ||
+            header.recordSize < MIN_RECORD_SIZE)
+        {
+            return false;
+        }
+
+        // Validate that the record table and arena fit inside the file before touching them
+        // The checks subtract rather than add, so that corrupt sizes cannot wrap around and pass
+        if (header.recordCount > (file.size() - sizeof(SnapshotHeader)) / header.recordSize)
+            return false;
+        uint64_t recordsEnd = sizeof(SnapshotHeader) + header.recordCount * header.recordSize;
+        if (header.arenaSize > file.size() - recordsEnd)
+            return false;
+
+        // A string reference must start and end inside the arena
+        auto inArena = [&header](uint64_t offset, uint64_t length)
+        { return offset <= header.arenaSize && length <= header.arenaSize - offset; };
+
+        const char *records = file.data() + sizeof(SnapshotHeader);
+        const char *arena = file.data() + recordsEnd;
+
+        TaskRecord record; // Reused across iterations so string buffers are recycled
+        for (uint64_t i = 0; i < header.recordCount; ++i)
+        {
+            SnapshotRecord raw{};
+            std::memcpy(&raw, records + i * header.recordSize, std::min<size_t>(header.recordSize, sizeof(raw)));
+
+            if (!inArena(raw.urlOffset, raw.urlLength) ||
+                !inArena(raw.destinationOffset, raw.destinationLength) ||
+                !inArena(raw.etagOffset, raw.etagLength) ||
+                !inArena(raw.lastModifiedOffset, raw.lastModifiedLength) ||
+                !inArena(raw.extraDestinationsOffset, raw.extraDestinationsLength))
+            {
+                return false; // Corrupt string reference
+            }
+
+            record.id = raw.id;
+            record.url.assign(arena + raw.urlOffset, raw.urlLength);
+            record.destination.assign(arena + raw.destinationOffset, raw.destinationLength);
+            record.bytesDownloaded = raw.bytesDownloaded;
+            record.totalBytes = raw.totalBytes;
+            record.status = raw.status;
+            record.httpStatus = raw.httpStatus;
+            record.errorCode = raw.errorCode;
+            record.addedAt = static_cast<time_t>(raw.addedAt);
+            record.endedAt = static_cast<time_t>(raw.endedAt);
+            record.headTimings = snapshot::fromRaw(raw.headTimings);
+            record.timings = snapshot::fromRaw(raw.timings);
+            record.etag.assign(arena + raw.etagOffset, raw.etagLength);
+            record.lastModified.assign(arena + raw.lastModifiedOffset, raw.lastModifiedLength);
+            record.extraDestinations = splitDestinations(std::string(arena + raw.extraDestinationsOffset, raw.extraDestinationsLength));
+
+            onRecord(record);
+        }
+
+        return true;
+    }
+
+    // Serialises all records into one buffer and atomically replaces the file with it
+    bool writeBinary(const std::string &path, const std::vector<TaskRecord> &records)
+    {
+        return writeBinary(path, records.size(), [&records](const TaskRecordCallback &visit)
+                           {
+                               for (const auto &record : records)
+                                   visit(record); });
+    }
+
+    // Writes the records forEach visits, in that order, from whatever container holds them
+    // count is the number of records it visits, used to size the table up front
+    bool writeBinary(const std::string &path, size_t count, const TaskRecordVisitor &forEach)
+    {
+        std::vector<SnapshotRecord> table;
+        table.reserve(count);
+        std::string arena;
+
+        forEach([&table, &arena](const TaskRecord &record)
+        {
+            table.emplace_back();
+            SnapshotRecord &raw = table.back();
+
+            appendToArena(arena, record.url, raw.urlOffset, raw.urlLength);
+            appendToArena(arena, record.destination, raw.destinationOffset, raw.destinationLength);
+            raw.bytesDownloaded = record.bytesDownloaded;
+            raw.totalBytes = record.totalBytes;
+            raw.addedAt = static_cast<int64_t>(record.addedAt);
+            raw.endedAt = static_cast<int64_t>(record.endedAt);
+            raw.status = record.status;
+            raw.httpStatus = record.httpStatus;
+            raw.errorCode = record.errorCode;
+            raw.reserved = 0;
+            raw.id = record.id;
+            raw.headTimings = toRaw(record.headTimings);
+            raw.timings = toRaw(record.timings);
+            appendToArena(arena, record.etag, raw.etagOffset, raw.etagLength);
+            appendToArena(arena, record.lastModified, raw.lastModifiedOffset, raw.lastModifiedLength);
+            appendToArena(arena, joinDestinations(record.extraDestinations), raw.extraDestinationsOffset, raw.extraDestinationsLength);
+            raw.reserved2 = 0;
+        });
+
+        SnapshotHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.recordSize = sizeof(SnapshotRecord);
+        header.recordCount = table.size();
+        header.arenaSize = arena.size();
+
+        std::string buffer;
+        buffer.reserve(sizeof(header) + table.size() * sizeof(SnapshotRecord) + arena.size());
+        buffer.append(reinterpret_cast<const char *>(&header), sizeof(header));
+        buffer.append(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(SnapshotRecord));
+        buffer.append(arena);
+
+        return writeFileAtomically(path, buffer);
+    }
+
+    // Reads one task per line: quoted url and destination followed by numeric fields
+    // Returns false if the file cannot be opened or a line is malformed
+    bool readText(const std::string &path, const TaskRecordCallback &onRecord)
+    {
+        std::ifstream inFile(path);
+        if (!inFile.is_open())
+            return false;
+
+        std::string line;
+        TaskRecord record;
+        while (std::getline(inFile, line))
+        {
+            if (line.empty())
+                continue;
+
+            std::istringstream iss(line);
+
+            // Read a line of data for a single task
+            if (!(iss >> std::quoted(record.url)
+                      >> std::quoted(record.destination) // Enable reading strings with spaces
+                      >> record.bytesDownloaded
+                      >> record.totalBytes
+                      >> record.status
+                      >> record.httpStatus
+                      >> record.errorCode
+                      >> record.addedAt
+                      >> record.endedAt))
+            {
+                return false; // Malformed line; the records before it have been read
+            }
+
+            // Files written before task ids existed end after endedAt, those written before validators
+            // were recorded end after the id, and those written before extra destinations after the validators
+            // Extra destinations follow as a count and one quoted field each, so the record stays on one line
+            if (!(iss >> record.id))
+            {
+                record.id = 0;
+            }
+            if (!(iss >> std::quoted(record.etag) >> std::quoted(record.lastModified)))
+            {
+                record.etag.clear();
+                record.lastModified.clear();
+            }
+            record.extraDestinations.clear();
+            size_t extraCount = 0;
+            if (iss >> extraCount)
+            {
+                record.extraDestinations.resize(extraCount);
+                for (auto &destination : record.extraDestinations)
+                {
+                    if (!(iss >> std::quoted(destination)))
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            onRecord(record);
+        }
+
+        return true;
+    }
+
+    bool writeText(const std::string &path, const std::vector<TaskRecord> &records)
+    {
+        std::ofstream outFile(path, std::ios::out | std::ios::trunc);
+        if (!outFile.is_open())
+            return false;
+
+        for (const auto &record : records)
+        {
+            outFile << std::quoted(record.url) << " "
+                    << std::quoted(record.destination) << " "
+                    << record.bytesDownloaded << " "
+                    << record.totalBytes << " "
+                    << record.status << " "
+                    << record.httpStatus << " "
+                    << record.errorCode << " "
+                    << record.addedAt << " "
+                    << record.endedAt << " "
+                    << record.id << " "
+                    << std::quoted(record.etag) << " "
+                    << std::quoted(record.lastModified) << " "
+                    << record.extraDestinations.size();
+            for (const auto &destination : record.extraDestinations)
+            {
+                outFile << " " << std::quoted(destination);
+            }
+            outFile << "\n";
+        }
+
+        return static_cast<bool>(outFile);
+    }
+}
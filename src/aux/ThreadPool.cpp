@@ -1,80 +1,216 @@
+#include <algorithm>
+#include <string>
+
 #include "aux/ThreadPool.hpp"
+#include "aux/Tracing.hpp"
+
+namespace
+{
+    // The worker running on this thread, so that tasks submitted from a task stay on its deques
+    thread_local const void *currentPool = nullptr;
+    thread_local size_t currentWorker = 0;
+}
 
 ThreadPool::ThreadPool(size_t nThreads)
-    : _stop(false)
 {
     // Create and launch worker threads
-    for (size_t i = 0; i < nThreads; ++i)
-    {
-        _workers.emplace_back(&ThreadPool::workerThread, this);
-    }
+    resize(nThreads);
 }
 
-// Signal all worker threads to stop and waits for them to finish
 ThreadPool::~ThreadPool()
 {
+    shutdown();
+}
+
+// Signals all worker threads to stop and waits for them to finish the queued work
+// Tasks enqueued afterwards are discarded; safe to call more than once
+void ThreadPool::shutdown()
+{
+    std::lock_guard<std::mutex> lifecycle(_lifecycleMutex);
     {
-        // Acquire lock to synchronise access to the task queue
-        std::unique_lock<std::mutex> lock(_queueMutex);
-        _stop = true;
+        // Taken so that no worker misses the wake-up between checking the flag and sleeping
+        std::lock_guard<std::mutex> lock(_sleepMutex);
+        _stop.store(true);
     }
 
     // Notify all threads that they should wake up and check the stop condition
     _condition.notify_all();
 
     // Join each thread to ensure they have completed execution
-    for (auto &worker : _workers)
+    for (size_t i = 0; i < _slots.load(); ++i)
     {
-        if (worker.joinable())
+        if (_workers[i]->thread.joinable())
         {
-            worker.join();
+            _workers[i]->thread.join();
         }
     }
 }
 
 size_t ThreadPool::size() const
 {
-    return _workers.size();
+    return _size.load();
 }
 
 // Add a new task to the thread pool's queue
 // The task is a function with no parameters and no return value
-void ThreadPool::enqueue(std::function<void()> f)
+void ThreadPool::enqueue(std::function<void()> f, TaskPriority priority)
 {
+    if (_stop.load())
+        return;
+
+    // Prefer the submitting worker's own deques; retiring workers take no new tasks
+    // A task that still lands on a worker as it retires is stolen by the others
+    size_t slots = _slots.load();
+    size_t target = currentWorker;
+    if (currentPool != this || _workers[target]->retiring.load())
+    {
+        do
+        {
+            target = _nextWorker.fetch_add(1, std::memory_order_relaxed) % slots;
+        } while (_workers[target]->retiring.load());
+    }
+
+    // Counted under the deque lock, so the task is never taken before it is counted
+    // and a woken worker never finds the count raised before the task is there
+    {
+        std::lock_guard<std::mutex> queueLock(_workers[target]->mutex);
+        _workers[target]->lanes[static_cast<size_t>(priority)].push_back(std::move(f));
+        _workers[target]->queued[static_cast<size_t>(priority)].fetch_add(1, std::memory_order_relaxed);
+        _pending.fetch_add(1);
+    }
+    tracing::instant("pool", "enqueue");
+
+    // Pairs with the sleeper count being raised before the pending count is checked in workerThread()
+    if (_sleepers.load() > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_sleepMutex);
+        }
+        _condition.notify_one();
+    }
+}
+
+// Changes the number of workers without waiting for running tasks
+// Removed workers finish their current task and the tasks on their own deques, then exit;
+// their slots are reused when the pool grows again
+void ThreadPool::resize(size_t nThreads)
+{
+    std::lock_guard<std::mutex> lifecycle(_lifecycleMutex);
+    nThreads = std::clamp<size_t>(nThreads, 1, THREADPOOL_MAX_WORKERS);
+    if (_stop.load())
+        return;
+
+    // Grow by restarting retired workers whose threads have exited, then by adding slots
+    for (size_t i = 0; i < _slots.load() && _size.load() < nThreads; ++i)
+    {
+        Worker &worker = *_workers[i];
+        if (worker.retiring.load() && worker.exited.load())
+        {
+            worker.thread.join();
+            worker.retiring.store(false);
+            worker.exited.store(false);
+            startWorker(i);
+        }
+    }
+    while (_size.load() < nThreads && _slots.load() < THREADPOOL_MAX_WORKERS)
+    {
+        size_t index = _slots.load();
+        _workers[index] = std::make_unique<Worker>();
+        _slots.store(index + 1); // Publishes the slot to enqueue() and thieves
+        startWorker(index);
+    }
+
+    // Retire from the end, so the oldest workers keep their deques
+    for (size_t i = _slots.load(); i-- > 0 && _size.load() > nThreads;)
+    {
+        if (!_workers[i]->retiring.exchange(true))
+            _size.fetch_sub(1);
+    }
+
     {
-        // Lock the task queue to ensure safe access
-        std::unique_lock<std::mutex> lock(_queueMutex);
-        _tasks.push(std::move(f));
+        std::lock_guard<std::mutex> lock(_sleepMutex);
     }
+    _condition.notify_all();
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
 
-    // Notify a worker thread that a new task is available
-    _condition.notify_one();
+void ThreadPool::startWorker(size_t index)
+{
+    _workers[index]->thread = std::thread(&ThreadPool::workerThread, this, index);
+    _size.fetch_add(1);
 }
 
 // Executed by each worker thread
-// Continuously retrieves and executes tasks until the pool is signalled to stop
-void ThreadPool::workerThread()
+// Runs tasks from its own deques and steals from the others until the pool stops or the worker retires
+void ThreadPool::workerThread(size_t index)
 {
+    Worker &self = *_workers[index];
+    currentPool = this;
+    currentWorker = index;
+    tracing::setThreadName("worker " + std::to_string(index + 1));
+
     while (true)
     {
         std::function<void()> task;
+        if (!takeTask(index, task))
         {
-            // Lock the task queue while waiting for a task
-            std::unique_lock<std::mutex> lock(_queueMutex);
+            if (self.retiring.load())
+            {
+                self.exited.store(true); // Its own deques are empty
+                return;
+            }
+
             // Wait until there is a task available or the thread pool is stopping
-            _condition.wait(lock, [this]
-                            { return _stop || !_tasks.empty(); });
+            std::unique_lock<std::mutex> lock(_sleepMutex);
+            _sleepers.fetch_add(1);
+            _condition.wait(lock, [this, &self]
+                            { return _pending.load() > 0 || _stop.load() || self.retiring.load(); });
+            _sleepers.fetch_sub(1);
 
             // If the pool is stopping and there are no remaining tasks, exit
-            if (_stop && _tasks.empty())
+            if (_stop.load() && _pending.load() == 0)
                 return;
-
-            // Retrieve the next task from the queue
-            task = std::move(_tasks.front());
-            _tasks.pop();
+            continue;
         }
 
-        // Execute the retrieved task outside of the lock scope
+        // Execute the retrieved task outside of any lock
+        tracing::Scope span("pool", "task");
         task();
     }
-}
\ No newline at end of file
+}
+
+// Takes the most urgent task, preferring the worker's own deque within each lane
+// A retiring worker only empties its own deques
+bool ThreadPool::takeTask(size_t index, std::function<void()> &task)
+{
+    if (_pending.load() == 0)
+        return false;
+
+    size_t slots = _slots.load();
+    size_t victims = _workers[index]->retiring.load() ? 1 : slots;
+
+    for (size_t lane = 0; lane < static_cast<size_t>(TaskPriority::COUNT); ++lane)
+    {
+        for (size_t i = 0; i < victims; ++i)
+        {
+            Worker &victim = *_workers[(index + i) % slots];
+            if (victim.queued[lane].load(std::memory_order_relaxed) == 0)
+                continue; // Skips empty lanes without touching the lock
+
+            std::lock_guard<std::mutex> queueLock(victim.mutex);
+            auto &queue = victim.lanes[lane];
+            if (!queue.empty())
+            {
+                task = std::move(queue.front());
+                queue.pop_front();
+                victim.queued[lane].fetch_sub(1, std::memory_order_relaxed);
+                _pending.fetch_sub(1);
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,233 @@
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <unistd.h>
+
+#include "aux/Tracing.hpp"
+#include "aux/StateSnapshot.hpp"
+#include "util/format.hpp"
+
+namespace
+{
+    struct Event
+    {
+        const char *category; // Null for counters
+        const char *name;
+        const char *argName; // Null if the event has no argument
+        int64_t timestamp;
+        int64_t duration;
+        int64_t value;
+        char phase; // 'X' complete, 'i' instant, 'C' counter
+    };
+
+    // Written by its own thread; the lock is only ever contended while write() copies it out
+    struct ThreadBuffer
+    {
+        std::mutex mutex;
+        std::vector<Event> events;
+        std::string name;
+        uint64_t dropped = 0;
+        size_t tid = 0;
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers; // Kept after their threads exit
+    };
+
+    Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    std::chrono::steady_clock::time_point epoch;
+    thread_local ThreadBuffer *localBuffer = nullptr;
+
+    ThreadBuffer &threadBuffer()
+    {
+        if (localBuffer)
+            return *localBuffer;
+
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.buffers.push_back(std::make_unique<ThreadBuffer>());
+        localBuffer = reg.buffers.back().get();
+        localBuffer->tid = reg.buffers.size();
+        localBuffer->name = "thread " + std::to_string(localBuffer->tid);
+        localBuffer->events.reserve(4096);
+        return *localBuffer;
+    }
+
+    void record(const Event &event)
+    {
+        ThreadBuffer &buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        if (buffer.events.size() < TRACE_MAX_EVENTS_PER_THREAD)
+            buffer.events.push_back(event);
+        else
+            buffer.dropped++;
+    }
+
+    void appendEvent(std::string &out, const Event &event, long pid, size_t tid)
+    {
+        char numbers[128];
+        out += "{\"name\":";
+        appendJsonString(out, event.name);
+        if (event.category)
+        {
+            out += ",\"cat\":";
+            appendJsonString(out, event.category);
+        }
+
+        out += ",\"ph\":\"";
+        out += event.phase;
+        out += '"';
+        if (event.phase == 'i')
+            out += ",\"s\":\"t\"";
+
+        std::snprintf(numbers, sizeof(numbers), ",\"ts\":%lld,\"pid\":%ld,\"tid\":%zu",
+                      static_cast<long long>(event.timestamp), pid, tid);
+        out += numbers;
+        if (event.phase == 'X')
+        {
+            std::snprintf(numbers, sizeof(numbers), ",\"dur\":%lld", static_cast<long long>(event.duration));
+            out += numbers;
+        }
+
+        if (event.argName)
+        {
+            out += ",\"args\":{";
+            appendJsonString(out, event.argName);
+            std::snprintf(numbers, sizeof(numbers), ":%lld}", static_cast<long long>(event.value));
+            out += numbers;
+        }
+        out += '}';
+    }
+}
+
+namespace tracing
+{
+    namespace detail
+    {
+        std::atomic<bool> enabled{false};
+    }
+
+    // Starts recording; call before the threads to be traced are started
+    void enable()
+    {
+        if (isEnabled())
+            return;
+
+        epoch = std::chrono::steady_clock::now();
+        detail::enabled.store(true);
+        setThreadName("main");
+    }
+
+    int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Labels the calling thread's track in the viewer
+    void setThreadName(const std::string &name)
+    {
+        if (!isEnabled())
+            return;
+
+        ThreadBuffer &buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.name = name;
+    }
+
+    void complete(const char *category, const char *name, int64_t startUs, int64_t durationUs, int64_t id)
+    {
+        if (!isEnabled())
+            return;
+        record({category, name, id >= 0 ? "id" : nullptr, startUs, durationUs, id, 'X'});
+    }
+
+    void instant(const char *category, const char *name, int64_t id)
+    {
+        if (!isEnabled())
+            return;
+        record({category, name, id >= 0 ? "id" : nullptr, now(), 0, id, 'i'});
+    }
+
+    // Series of the same counter name are drawn as one track
+    void counter(const char *name, const char *series, int64_t value)
+    {
+        if (!isEnabled())
+            return;
+        record({nullptr, name, series, now(), 0, value, 'C'});
+    }
+
+    // curl reports each phase as the time from the start of the request to its end, so the
+    // phases are laid end to end from startUs; phases the request skipped are left out
+    void transfer(const char *name, int64_t startUs, const TransferTimings &timings, int64_t id)
+    {
+        if (!isEnabled() || timings.isEmpty())
+            return;
+
+        complete("transfer", name, startUs, timings.totalUs, id);
+
+        const std::pair<const char *, int64_t> phases[] = {
+            {"dns", timings.lookupPhaseUs()},
+            {"connect", timings.connectPhaseUs()},
+            {"tls", timings.tlsPhaseUs()},
+            {"wait", timings.waitPhaseUs()},
+            {"receive", timings.transferPhaseUs()},
+        };
+
+        int64_t offset = startUs;
+        for (const auto &[phase, duration] : phases)
+        {
+            if (duration > 0)
+                complete("transfer", phase, offset, duration, id);
+            offset += duration;
+        }
+    }
+
+    // Writes every recorded event as a trace-event JSON object; recording may continue meanwhile
+    bool write(const std::string &path, std::string &error)
+    {
+        long pid = static_cast<long>(getpid());
+        std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        uint64_t dropped = 0;
+        bool first = true;
+
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> registryLock(reg.mutex);
+        for (const auto &buffer : reg.buffers)
+        {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            dropped += buffer->dropped;
+
+            out += first ? "\n" : ",\n";
+            first = false;
+            out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) +
+                   ",\"tid\":" + std::to_string(buffer->tid) + ",\"args\":{\"name\":";
+            appendJsonString(out, buffer->name);
+            out += "}}";
+
+            for (const auto &event : buffer->events)
+            {
+                out += ",\n";
+                appendEvent(out, event, pid, buffer->tid);
+            }
+        }
+        out += "\n],\"otherData\":{\"droppedEvents\":" + std::to_string(dropped) + "}}\n";
+
+        std::ofstream file(path, std::ios::trunc);
+        if (!file || !(file << out).flush())
+        {
+            error = "cannot write trace to " + path;
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,119 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+#include "aux/UnixSocket.hpp"
+
+namespace
+{
+    bool makeAddress(const std::string &path, sockaddr_un &address)
+    {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+            return false;
+
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+}
+
+namespace unixsocket
+{
+    int listen(const std::string &path, std::string &error)
+    {
+        sockaddr_un address;
+        if (!makeAddress(path, address))
+        {
+            error = "socket path is too long: " + path;
+            return -1;
+        }
+
+        // A socket file that still accepts connections belongs to a running daemon
+        int existing = connect(path);
+        if (existing >= 0)
+        {
+            close(existing);
+            error = "another daemon is already listening on " + path;
+            return -1;
+        }
+        unlink(path.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            error = std::strerror(errno);
+            return -1;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(fd, 64) != 0)
+        {
+            error = std::string(std::strerror(errno)) + ": " + path;
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    int connect(const std::string &path)
+    {
+        sockaddr_un address;
+        if (!makeAddress(path, address))
+            return -1;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        if (::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+
+    bool sendAll(int fd, const std::string &data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool readLine(int fd, std::string &buffer, std::string &line)
+    {
+        while (true)
+        {
+            size_t newline = buffer.find('\n');
+            if (newline != std::string::npos)
+            {
+                line.assign(buffer, 0, newline);
+                buffer.erase(0, newline + 1);
+                return true;
+            }
+
+            char chunk[4096];
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+    }
+}
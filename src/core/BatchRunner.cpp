@@ -0,0 +1,192 @@
+#include <poll.h>
+#include <climits>
+#include <algorithm>
+
+#include "core/BatchRunner.hpp"
+#include "util/format.hpp"
+
+BatchRunner::BatchRunner(DownloadManager &manager, std::chrono::milliseconds progressInterval, std::ostream &out)
+    : _manager(manager), _progressInterval(progressInterval), _out(out)
+{
+    _manager.setTaskFinishedCallback([this](const DownloadTask &task)
+                                     { onTaskFinished(task); });
+}
+
+BatchRunner::~BatchRunner()
+{
+    _manager.setTaskFinishedCallback(nullptr);
+}
+
+// Queues every item, then drives the manager until all of them have finished or stop() is called
+// Items without a file are queued once the manager has looked up their filenames off this thread,
+// so transfers start while the remaining lookups run
+// Returns one of the BATCH_EXIT_* codes
+int BatchRunner::run(const std::vector<BatchItem> &items)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (const auto &item : items)
+    {
+        _unqueued++;
+        _manager.queueDownloadAsync(item.url, item.destination, [this, &item](TaskId id)
+                                    { onQueued(item, id); });
+    }
+
+    auto nextProgress = std::chrono::steady_clock::now() + _progressInterval;
+    while (!_stopping.load() && (_unqueued > 0 || hasUnfinishedTasks()))
+    {
+        pollfd fds[2] = {{_manager.getEventFd(), POLLIN, 0}, {_stopNotifier.getFd(), POLLIN, 0}};
+        poll(fds, 2, calcWaitTimeoutMs(nextProgress));
+        _stopNotifier.drain();
+        _manager.consumeEventSignal();
+
+        _manager.update(); // Apply finished runs and start queued tasks
+
+        if (_progressInterval.count() > 0 && std::chrono::steady_clock::now() >= nextProgress)
+        {
+            emitProgress();
+            nextProgress = std::chrono::steady_clock::now() + _progressInterval;
+        }
+    }
+
+    // Whatever is left when interrupted is canceled rather than kept for later
+    size_t canceled = 0;
+    if (_stopping.load())
+    {
+        canceled = _unqueued;
+        for (const auto &list : {_manager.getQueued(), _manager.getActive(), _manager.getPaused()})
+        {
+            for (const auto &task : list)
+            {
+                auto joined = _joined.find(task->getId());
+                canceled += 1 + (joined == _joined.end() ? 0 : joined->second.size());
+            }
+        }
+        _manager.cancelAllDownloads();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    emit("{\"event\":\"summary\",\"completed\":" + std::to_string(_completed) +
+         ",\"failed\":" + std::to_string(_failed) +
+         ",\"canceled\":" + std::to_string(canceled) +
+         ",\"elapsed\":" + std::to_string(elapsed.count()) + "}");
+
+    if (_stopping.load())
+        return BATCH_EXIT_INTERRUPTED;
+    return _failed == 0 ? BATCH_EXIT_SUCCESS : BATCH_EXIT_FAILURES;
+}
+
+// Makes run() cancel what is left and return; safe to call from a signal handler
+void BatchRunner::stop()
+{
+    _stopping.store(true);
+    _stopNotifier.notify();
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+// Reports an item once it is queued, or joined to the download of an earlier item with the same URL
+// An item that failed before it was queued has id 0 and was reported by onTaskFinished()
+void BatchRunner::onQueued(const BatchItem &item, TaskId id)
+{
+    _unqueued--;
+    if (id == 0)
+        return;
+
+    // An id handed out before means the item joined a download of the same URL
+    auto task = _manager.getTask(id);
+    bool joined = !_queued.insert(id).second;
+    std::string file = joined && !item.destination.empty() ? item.destination : task->getDestination();
+    if (joined)
+        _joined[id].push_back(file);
+
+    std::string line = std::string("{\"event\":\"") + (joined ? "joined" : "queued") +
+                       "\",\"id\":" + std::to_string(id) + ",\"url\":";
+    appendJsonString(line, item.url);
+    line += ",\"file\":";
+    appendJsonString(line, file);
+    emit(line + "}");
+}
+
+// Reports the outcome of the task for the item that queued it and for every item that joined it
+void BatchRunner::onTaskFinished(const DownloadTask &task)
+{
+    emitOutcome(task, task.getDestination());
+
+    auto joined = _joined.find(task.getId());
+    if (joined == _joined.end())
+        return;
+    for (const auto &file : joined->second)
+        emitOutcome(task, file);
+    _joined.erase(joined);
+}
+
+void BatchRunner::emitOutcome(const DownloadTask &task, const std::string &file)
+{
+    bool completed = task.getStatus() == DownloadStatus::COMPLETED;
+    if (completed)
+        _completed++;
+    else
+        _failed++;
+
+    std::string line = std::string("{\"event\":\"") + (completed ? "completed" : "failed") +
+                       "\",\"id\":" + std::to_string(task.getId()) + ",\"url\":";
+    appendJsonString(line, task.getUrl());
+    line += ",\"file\":";
+    appendJsonString(line, file);
+
+    if (completed)
+    {
+        line += ",\"bytes\":" + std::to_string(task.getBytesDownloaded());
+        line += ",\"http\":" + std::to_string(task.getHttpStatus());
+    }
+    else
+    {
+        line += ",\"http\":" + std::to_string(task.getHttpStatus());
+        line += ",\"curl\":" + std::to_string(static_cast<int>(task.getErrorCode()));
+        line += ",\"error\":";
+        appendJsonString(line, task.getErrorMessage());
+    }
+    emit(line + "}");
+}
+
+// Reports the byte counts and speed of every running task
+void BatchRunner::emitProgress()
+{
+    for (const auto &task : _manager.getActive())
+    {
+        emit("{\"event\":\"progress\",\"id\":" + std::to_string(task->getId()) +
+             ",\"bytes\":" + std::to_string(task->getBytesDownloaded()) +
+             ",\"total\":" + std::to_string(task->getTotalBytes()) +
+             ",\"bps\":" + std::to_string(static_cast<int64_t>(task->calcCurrentSpeedBps())) + "}");
+    }
+}
+
+// Writes one event and flushes it, so a reader on a pipe sees it immediately
+void BatchRunner::emit(const std::string &line)
+{
+    _out << line << '\n'
+         << std::flush;
+}
+
+bool BatchRunner::hasUnfinishedTasks() const
+{
+    return !_manager.getQueued().empty() || !_manager.getActive().empty();
+}
+
+// Sleeps until a task finishes, a retry is due, or the next progress report is due
+int BatchRunner::calcWaitTimeoutMs(std::chrono::steady_clock::time_point nextProgress) const
+{
+    auto timeout = _manager.timeUntilNextUpdate();
+    if (_progressInterval.count() > 0)
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(nextProgress - std::chrono::steady_clock::now());
+        timeout = std::min(timeout, remaining + std::chrono::milliseconds(1));
+    }
+
+    if (timeout == std::chrono::milliseconds::max())
+        return -1;
+    return static_cast<int>(std::clamp<long long>(timeout.count(), 0, INT_MAX));
+}
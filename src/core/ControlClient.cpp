@@ -0,0 +1,120 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+
+#include "core/ControlClient.hpp"
+#include "aux/UnixSocket.hpp"
+
+ControlClient::~ControlClient()
+{
+    disconnect();
+}
+
+// Connects to the daemon listening on the given path; returns false if none is
+bool ControlClient::connect(const std::string &socketPath)
+{
+    disconnect();
+    _fd = unixsocket::connect(socketPath);
+    return _fd >= 0;
+}
+
+// Sends one request line; its response is handed to onResponse by a later receive()
+// Returns false if the daemon has gone away
+bool ControlClient::send(const std::string &request, ResponseCallback onResponse)
+{
+    if (_fd < 0)
+        return false;
+
+    if (!unixsocket::sendAll(_fd, request + "\n"))
+    {
+        disconnect();
+        return false;
+    }
+
+    _callbacks.push_back(std::move(onResponse));
+    return true;
+}
+
+// Reads whatever the daemon has sent without blocking and handles every complete response
+// Returns false once the daemon has closed the connection
+bool ControlClient::receive()
+{
+    if (_fd < 0)
+        return false;
+
+    bool open = true;
+    char chunk[4096];
+    while (true)
+    {
+        ssize_t n = recv(_fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n > 0)
+        {
+            _input.append(chunk, static_cast<size_t>(n));
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        break;
+    }
+
+    handleResponses();
+    if (!open)
+        disconnect();
+    return open;
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+// Passes each complete response at the front of the input to the callback of the oldest request
+void ControlClient::handleResponses()
+{
+    while (!_callbacks.empty())
+    {
+        size_t end = _input.find('\n');
+        if (end == std::string::npos)
+            return;
+
+        bool ok = _input.compare(0, 2, "OK") == 0;
+        std::vector<std::string> lines;
+        if (!ok)
+        {
+            // "ERR <message>"
+            lines.push_back(end > 4 ? _input.substr(4, end - 4) : std::string());
+        }
+        else
+        {
+            // "OK <n>" is followed by n data lines; wait until all of them have arrived
+            long count = std::strtol(_input.c_str() + 2, nullptr, 10);
+            for (long i = 0; i < count; ++i)
+            {
+                size_t next = _input.find('\n', end + 1);
+                if (next == std::string::npos)
+                    return;
+                lines.push_back(_input.substr(end + 1, next - end - 1));
+                end = next;
+            }
+        }
+        _input.erase(0, end + 1);
+
+        // The callback may send another request, so take it off the queue first
+        ResponseCallback callback = std::move(_callbacks.front());
+        _callbacks.pop_front();
+        if (callback)
+            callback(ok, lines);
+    }
+}
+
+void ControlClient::disconnect()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+        _fd = -1;
+    }
+    _callbacks.clear();
+}
@@ -0,0 +1,406 @@
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include "core/ControlServer.hpp"
+#include "aux/UnixSocket.hpp"
+#include "util/args.hpp"
+
+namespace
+{
+    const char *statusName(DownloadStatus status)
+    {
+        switch (status)
+        {
+        case DownloadStatus::QUEUED:
+            return "queued";
+        case DownloadStatus::ACTIVE:
+            return "active";
+        case DownloadStatus::PAUSED:
+            return "paused";
+        case DownloadStatus::COMPLETED:
+            return "completed";
+        case DownloadStatus::FAILED:
+            return "failed";
+        default:
+            return "canceled";
+        }
+    }
+}
+
+ControlServer::ControlServer(const std::string &socketPath) : _socketPath(socketPath)
+{
+}
+
+// Disconnects all clients and removes the socket file
+ControlServer::~ControlServer()
+{
+    for (auto &client : _clients)
+        close(client.fd);
+
+    if (_listenFd >= 0)
+    {
+        close(_listenFd);
+        unlink(_socketPath.c_str());
+    }
+}
+
+// Starts listening on the socket path
+// Done before the manager is created, so a second daemon fails without touching the state files
+bool ControlServer::start(std::string &error)
+{
+    _listenFd = unixsocket::listen(_socketPath, error);
+    if (_listenFd < 0)
+        return false;
+
+    fcntl(_listenFd, F_SETFL, fcntl(_listenFd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+// Serves clients and drives the manager until stop() is called
+void ControlServer::run(DownloadManager &manager)
+{
+    _manager = &manager;
+    std::vector<pollfd> fds;
+
+    while (!_stopping.load())
+    {
+        fds.clear();
+        fds.push_back({_listenFd, POLLIN, 0});
+        fds.push_back({_stopNotifier.getFd(), POLLIN, 0});
+        fds.push_back({_manager->getEventFd(), POLLIN, 0});
+        for (const auto &client : _clients)
+        {
+            short events = static_cast<short>((client.finished ? 0 : POLLIN) | (client.output.empty() ? 0 : POLLOUT));
+            fds.push_back({client.fd, events, 0});
+        }
+
+        poll(fds.data(), fds.size(), calcWaitTimeoutMs());
+        _stopNotifier.drain();
+        _manager->consumeEventSignal();
+
+        // Serve the clients polled above; clients accepted below are polled from the next pass
+        size_t polledClients = fds.size() - 3;
+        size_t kept = 0;
+        for (size_t i = 0; i < _clients.size(); ++i)
+        {
+            Client &client = _clients[i];
+            short revents = i < polledClients ? fds[i + 3].revents : 0;
+
+            bool open = true;
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+                open = readClient(client);
+            if (open && !client.output.empty())
+                open = writeClient(client);
+            if (client.finished && client.output.empty() && client.pending.empty())
+                open = false;
+
+            if (!open)
+            {
+                close(client.fd);
+                continue;
+            }
+            if (kept != i)
+                _clients[kept] = std::move(client);
+            kept++;
+        }
+        _clients.resize(kept);
+
+        if (fds[0].revents & POLLIN)
+            acceptClients();
+
+        _manager->update(); // Start queued tasks, apply finished runs and persist state
+    }
+
+    _manager = nullptr;
+}
+
+// Makes run() return; safe to call from a signal handler
+void ControlServer::stop()
+{
+    _stopping.store(true);
+    _stopNotifier.notify();
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+void ControlServer::acceptClients()
+{
+    while (true)
+    {
+        int fd = accept(_listenFd, nullptr, nullptr);
+        if (fd < 0)
+            return; // EAGAIN once the backlog is empty
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        Client client;
+        client.id = _nextClientId++;
+        client.fd = fd;
+        _clients.push_back(std::move(client));
+    }
+}
+
+// Reads what the client has sent and answers every complete request
+// A client that closes its side of the connection still gets the answers to the requests it sent
+// Returns false once the connection has failed or the client has sent an oversized request
+bool ControlServer::readClient(Client &client)
+{
+    char chunk[4096];
+    while (!client.finished)
+    {
+        ssize_t n = read(client.fd, chunk, sizeof(chunk));
+        if (n > 0)
+        {
+            client.input.append(chunk, static_cast<size_t>(n));
+            continue;
+        }
+        if (n == 0)
+        {
+            client.finished = true; // End of stream
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        return false;
+    }
+
+    size_t start = 0;
+    size_t newline;
+    while ((newline = client.input.find('\n', start)) != std::string::npos)
+    {
+        std::string request = client.input.substr(start, newline - start);
+        if (!request.empty() && request.back() == '\r')
+            request.pop_back();
+
+        std::string response;
+        handleRequest(client, request, response);
+        if (!response.empty())
+            respond(client, std::move(response));
+        start = newline + 1;
+    }
+    client.input.erase(0, start);
+
+    return client.input.size() <= CONTROL_MAX_REQUEST_LENGTH;
+}
+
+// Sends as much pending output as the socket accepts without blocking
+bool ControlServer::writeClient(Client &client)
+{
+    while (!client.output.empty())
+    {
+        ssize_t n = send(client.fd, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            client.output.erase(0, static_cast<size_t>(n));
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+}
+
+// Runs one request against the manager and appends its response
+// A queue request that needs a filename lookup leaves the response empty and is answered later
+void ControlServer::handleRequest(Client &client, const std::string &request, std::string &response)
+{
+    std::istringstream iss(request);
+    std::string command;
+    iss >> command;
+
+    if (command.empty())
+        return; // Blank lines are ignored rather than answered
+
+    if (command == "queue" || command == "download")
+    {
+        auto args = extractArguments(request, 2);
+        if (args.empty())
+        {
+            response += "ERR missing url\n";
+            return;
+        }
+
+        if (args.size() < 2)
+        {
+            queueAsync(client, args[0]);
+            return;
+        }
+
+        TaskId id = _manager->queueDownload(args[0], args[1]);
+        if (id == 0)
+            response += "ERR request failed: " + args[0] + "\n";
+        else
+            response += "OK 1\n" + std::to_string(id) + "\n";
+    }
+    else if (command == "cancel")
+    {
+        auto args = extractArguments(request, 2);
+        if (args.empty())
+        {
+            _manager->cancelAllDownloads();
+            response += "OK 0\n";
+            return;
+        }
+
+        TaskId id = parseId(args[0]);
+        if (args.size() == 2)
+        {
+            // Withdraws one request of a shared download
+            response += _manager->withdrawDestination(id, args[1])
+                            ? "OK 0\n"
+                            : "ERR no request joined " + args[0] + " with file: " + args[1] + "\n";
+            return;
+        }
+
+        auto task = _manager->getTask(id);
+        if (task && !task->getExtraDestinations().empty())
+        {
+            response += "ERR download " + args[0] + " is shared; withdraw a request with cancel " + args[0] + " <file>\n";
+            return;
+        }
+        response += _manager->cancelDownload(id) ? "OK 0\n" : "ERR no matching task: " + args[0] + "\n";
+    }
+    else if (command == "pause" || command == "resume")
+    {
+        auto args = extractArguments(request, 1);
+        if (args.empty())
+        {
+            // No id applies the command to every task, as in the TUI
+            if (command == "pause")
+                _manager->pauseAllDownloads();
+            else
+                _manager->resumeAllDownloads();
+            response += "OK 0\n";
+            return;
+        }
+
+        TaskId id = parseId(args[0]);
+        bool done = command == "pause" ? _manager->pauseDownload(id) : _manager->resumeDownload(id);
+        response += done ? "OK 0\n" : "ERR no matching task: " + args[0] + "\n";
+    }
+    else if (command == "concurrency")
+    {
+        auto args = extractArguments(request, 1);
+        if (!args.empty())
+        {
+            char *end = nullptr;
+            long value = std::strtol(args[0].c_str(), &end, 10);
+            if (*end != '\0' || value < 1)
+            {
+                response += "ERR invalid concurrency: " + args[0] + "\n";
+                return;
+            }
+            _manager->setConcurrency(static_cast<size_t>(value));
+        }
+        response += "OK 1\n" + std::to_string(_manager->getConcurrency()) + "\n";
+    }
+    else if (command == "status")
+    {
+        appendStatus(response);
+    }
+    else if (command == "shutdown")
+    {
+        response += "OK 0\n";
+        stop();
+    }
+    else
+    {
+        response += "ERR unknown command: " + command + "\n";
+    }
+}
+
+// Queues a URL whose filename the manager looks up off the loop, holding back this client's later
+// responses until it is answered
+void ControlServer::queueAsync(Client &client, const std::string &url)
+{
+    uint64_t clientId = client.id;
+    uint64_t sequence = client.firstPending + client.pending.size();
+    client.pending.emplace_back();
+
+    _manager->queueDownloadAsync(url, "", [this, clientId, sequence, url](TaskId id)
+                                 { completeResponse(clientId, sequence, id == 0 ? "ERR request failed: " + url + "\n"
+                                                                                : "OK 1\n" + std::to_string(id) + "\n"); });
+}
+
+// Sends a response after the ones still pending
+void ControlServer::respond(Client &client, std::string response)
+{
+    if (client.pending.empty())
+        client.output += response;
+    else
+        client.pending.push_back({true, std::move(response)});
+}
+
+// Fills in a pending response and moves every response that is no longer waiting to the output
+// The client may have disconnected meanwhile, in which case the response is dropped
+void ControlServer::completeResponse(uint64_t clientId, uint64_t sequence, std::string response)
+{
+    auto it = std::find_if(_clients.begin(), _clients.end(), [clientId](const Client &client)
+                           { return client.id == clientId; });
+    if (it == _clients.end())
+        return;
+
+    Client &client = *it;
+    client.pending[sequence - client.firstPending] = {true, std::move(response)};
+    while (!client.pending.empty() && client.pending.front().ready)
+    {
+        client.output += client.pending.front().text;
+        client.pending.pop_front();
+        client.firstPending++;
+    }
+}
+
+// Lists every unfinished task, one per line
+void ControlServer::appendStatus(std::string &response)
+{
+    auto queued = _manager->getQueued();
+    auto active = _manager->getActive();
+    auto paused = _manager->getPaused();
+
+    std::ostringstream oss;
+    oss << "OK " << queued.size() + active.size() + paused.size() << "\n";
+    for (const auto &list : {active, paused, queued})
+    {
+        for (const auto &task : list)
+        {
+            oss << task->getId() << " "
+                << (task->isWaitingToRetry() ? "retrying" : statusName(task->getStatus())) << " "
+                << task->getBytesDownloaded() << " "
+                << task->getTotalBytes() << " "
+                << static_cast<int64_t>(task->calcCurrentSpeedBps()) << " "
+                << std::quoted(task->getUrl()) << " "
+                << std::quoted(task->getDestination());
+            for (const auto &destination : task->getExtraDestinations())
+                oss << " " << std::quoted(destination);
+            oss << "\n";
+        }
+    }
+    response += oss.str();
+}
+
+// Sleeps until the persister is due, or for one update interval while transfers are running
+int ControlServer::calcWaitTimeoutMs() const
+{
+    auto timeout = _manager->timeUntilNextUpdate();
+    if (!_manager->getActive().empty())
+        timeout = std::min(timeout, std::chrono::duration_cast<std::chrono::milliseconds>(DAEMON_UPDATE_INTERVAL));
+
+    if (timeout == std::chrono::milliseconds::max())
+        return -1;
+
+    return static_cast<int>(std::min<long long>(timeout.count() + 1, INT_MAX));
+}
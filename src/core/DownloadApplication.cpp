@@ -1,13 +1,511 @@
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <unistd.h>
+
 #include "core/DownloadApplication.hpp"
 #include "core/DownloadManager.hpp"
+#include "core/ControlServer.hpp"
+#include "core/ControlClient.hpp"
+#include "core/BatchRunner.hpp"
+#include "aux/UnixSocket.hpp"
+#include "aux/Tracing.hpp"
 #include "ui/UI.hpp"
+#include "util/args.hpp"
+
+namespace
+{
+    ControlServer *activeServer = nullptr; // Stopped by SIGINT/SIGTERM while the daemon runs
+    BatchRunner *activeBatch = nullptr;    // Stopped by SIGINT/SIGTERM while a batch runs
+
+    void handleStopSignal(int /* signal */)
+    {
+        if (activeServer)
+            activeServer->stop();
+        if (activeBatch)
+            activeBatch->stop();
+    }
+
+    void installStopHandlers()
+    {
+        struct sigaction action{};
+        action.sa_handler = handleStopSignal;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        std::signal(SIGPIPE, SIG_IGN);
+    }
+
+    // Reads a batch list: one "url [file]" per line, quoted as in the TUI
+    // Blank lines and lines starting with '#' are skipped
+    bool readBatchList(const std::string &path, std::vector<BatchItem> &items, std::string &error)
+    {
+        std::ifstream input(path);
+        if (!input)
+        {
+            error = "cannot read " + path;
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(input, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+
+            size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos || line[start] == '#')
+                continue;
+
+            auto args = extractArguments("queue " + line.substr(start), 2);
+            if (args.empty())
+                continue;
+            items.push_back({args[0], args.size() > 1 ? args[1] : ""});
+        }
+        return true;
+    }
+
+    // Parses a non-negative number of seconds, allowing fractions
+    bool parseSeconds(const char *text, std::chrono::milliseconds &result)
+    {
+        char *end = nullptr;
+        double seconds = std::strtod(text, &end);
+        if (end == text || *end != '\0' || !(seconds >= 0.0))
+            return false;
+
+        result = std::chrono::milliseconds(static_cast<long long>(seconds * 1000.0));
+        return true;
+    }
+}
+
+DownloadApplication::DownloadApplication(ApplicationOptions options) : _options(std::move(options))
+{
+    if (_options.socketPath.empty())
+    {
+        _options.socketPath = DownloadManager::getStateFilePath(SDM_SOCKET_FILENAME);
+    }
+}
 
-DownloadApplication::DownloadApplication() {}
 DownloadApplication::~DownloadApplication() {}
 
-void DownloadApplication::run()
+// Parses the command line; returns false with a message if it is invalid
+bool DownloadApplication::parseOptions(int argc, char *argv[], ApplicationOptions &options, std::string &error)
 {
-    DownloadManager manager;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--daemon")
+        {
+            options.mode = ApplicationMode::DAEMON;
+        }
+        else if (arg == "--client")
+        {
+            // Everything after --client is the command to send
+            options.mode = ApplicationMode::CLIENT;
+            options.arguments.assign(argv + i + 1, argv + argc);
+            return true;
+        }
+        else if (arg == "--batch")
+        {
+            // Everything after --batch is a URL to download
+            options.mode = ApplicationMode::BATCH;
+            options.arguments.insert(options.arguments.end(), argv + i + 1, argv + argc);
+            return true;
+        }
+        else if (arg == "--input")
+        {
+            if (++i >= argc)
+            {
+                error = "--input requires a file";
+                return false;
+            }
+            options.mode = ApplicationMode::BATCH;
+            options.inputPath = argv[i];
+        }
+        else if (arg == "--concurrency")
+        {
+            char *end = nullptr;
+            long value = ++i < argc ? std::strtol(argv[i], &end, 10) : 0;
+            if (!end || *end != '\0' || value < 1)
+            {
+                error = "--concurrency requires a positive number";
+                return false;
+            }
+            options.concurrency = static_cast<size_t>(value);
+        }
+        else if (arg == "--retries")
+        {
+            char *end = nullptr;
+            long value = ++i < argc ? std::strtol(argv[i], &end, 10) : -1;
+            if (!end || *end != '\0' || value < 0)
+            {
+                error = "--retries requires a number";
+                return false;
+            }
+            options.retries = static_cast<int>(value);
+        }
+        else if (arg == "--stall-timeout")
+        {
+            char *end = nullptr;
+            long value = ++i < argc ? std::strtol(argv[i], &end, 10) : -1;
+            if (!end || *end != '\0' || value < 0)
+            {
+                error = "--stall-timeout requires a number of seconds";
+                return false;
+            }
+            options.stallTimeout = value;
+        }
+        else if (arg == "--min-speed")
+        {
+            char *end = nullptr;
+            long value = ++i < argc ? std::strtol(argv[i], &end, 10) : 0;
+            if (!end || *end != '\0' || value < 1)
+            {
+                error = "--min-speed requires a positive number of bytes per second";
+                return false;
+            }
+            options.minSpeed = value;
+        }
+        else if (arg == "--cache-size")
+        {
+            char *end = nullptr;
+            long value = ++i < argc ? std::strtol(argv[i], &end, 10) : 0;
+            if (!end || *end != '\0' || value < 1)
+            {
+                error = "--cache-size requires a positive number of megabytes";
+                return false;
+            }
+            options.cacheSize = value;
+        }
+        else if (arg == "--metrics-port")
+        {
+            char *end = nullptr;
+            long value = ++i < argc ? std::strtol(argv[i], &end, 10) : 0;
+            if (!end || *end != '\0' || value < 1 || value > 65535)
+            {
+                error = "--metrics-port requires a port number";
+                return false;
+            }
+            options.metricsPort = static_cast<int>(value);
+        }
+        else if (arg == "--metrics-file")
+        {
+            if (++i >= argc)
+            {
+                error = "--metrics-file requires a path";
+                return false;
+            }
+            options.metricsPath = argv[i];
+        }
+        else if (arg == "--metrics-interval")
+        {
+            if (++i >= argc || !parseSeconds(argv[i], options.metricsInterval) || options.metricsInterval.count() == 0)
+            {
+                error = "--metrics-interval requires a positive number of seconds";
+                return false;
+            }
+        }
+        else if (arg == "--trace")
+        {
+            if (++i >= argc)
+            {
+                error = "--trace requires a path";
+                return false;
+            }
+            options.tracePath = argv[i];
+        }
+        else if (arg == "--progress-interval")
+        {
+            if (++i >= argc || !parseSeconds(argv[i], options.progressInterval))
+            {
+                error = "--progress-interval requires a number of seconds";
+                return false;
+            }
+        }
+        else if (arg == "--socket")
+        {
+            if (++i >= argc)
+            {
+                error = "--socket requires a path";
+                return false;
+            }
+            options.socketPath = argv[i];
+        }
+        else
+        {
+            error = "unknown option: " + arg;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void DownloadApplication::printUsage(const char *program)
+{
+    std::cerr << "usage: " << program << " [--concurrency <n>] [--socket <path>]\n"
+              << "       " << program << " --daemon [--concurrency <n>] [--socket <path>]\n"
+              << "       " << program << " [--socket <path>] --client [command [args...]]\n"
+              << "       " << program << " [--concurrency <n>] [--progress-interval <seconds>] [--input <file>] [--batch <url>...]\n"
+              << "every mode also accepts [--metrics-port <port>] [--metrics-file <path>] [--metrics-interval <seconds>]\n"
+              << "                        [--retries <n>] [--stall-timeout <seconds>] [--min-speed <bytes/s>]\n"
+              << "                        [--cache-size <MB>] [--trace <path>]\n";
+}
+
+// Runs the selected mode; with --trace, records its timeline and writes it once the manager has shut down
+int DownloadApplication::run()
+{
+    if (_options.tracePath.empty())
+        return runMode();
+
+    tracing::enable();
+    int result = runMode();
+
+    std::string error;
+    if (!tracing::write(_options.tracePath, error))
+    {
+        std::cerr << "sdm: " << error << "\n";
+        return result == 0 ? 1 : result;
+    }
+    return result;
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+int DownloadApplication::runMode()
+{
+    switch (_options.mode)
+    {
+    case ApplicationMode::DAEMON:
+        return runDaemon();
+    case ApplicationMode::CLIENT:
+        return runClient();
+    case ApplicationMode::BATCH:
+        return runBatch();
+    default:
+        return runInteractive();
+    }
+}
+
+// Runs the curses interface, with the downloads in this process or, while a daemon is listening,
+// as one more client of the daemon, which owns the state files
+// Exits with 2 if the connection to the daemon was lost
+int DownloadApplication::runInteractive()
+{
+    ControlClient commands, status;
+    if (commands.connect(_options.socketPath) && status.connect(_options.socketPath))
+    {
+        UI ui(commands, status);
+        ui.run();
+        if (!commands.isConnected() || !status.isConnected())
+        {
+            std::cerr << "sdm: connection to the daemon was lost\n";
+            return 2;
+        }
+        return 0;
+    }
+
+    ManagerOptions managerOptions = makeManagerOptions();
+
+    DownloadManager manager(managerOptions);
+    std::unique_ptr<MetricsExporter> metrics;
+    if (!startMetrics(manager.getMetrics(), metrics))
+        return 1;
+
     UI ui(manager);
     ui.run();
-}
\ No newline at end of file
+    return 0;
+}
+
+// Runs the manager without a terminal until SIGINT, SIGTERM or a shutdown request
+int DownloadApplication::runDaemon()
+{
+    ControlServer server(_options.socketPath);
+
+    std::string error;
+    if (!server.start(error))
+    {
+        std::cerr << "sdm: " << error << "\n";
+        return 1;
+    }
+
+    ManagerOptions managerOptions = makeManagerOptions();
+
+    DownloadManager manager(managerOptions);
+    std::unique_ptr<MetricsExporter> metrics;
+    if (!startMetrics(manager.getMetrics(), metrics))
+        return 1;
+
+    activeServer = &server;
+    installStopHandlers();
+
+    server.run(manager);
+
+    activeServer = nullptr;
+    return 0;
+}
+
+// Sends the command line, or each line of stdin, to the daemon and prints the responses
+// Exits with 1 if any request failed and 2 if the daemon could not be reached
+int DownloadApplication::runClient()
+{
+    int fd = unixsocket::connect(_options.socketPath);
+    if (fd < 0)
+    {
+        std::cerr << "sdm: no daemon listening on " << _options.socketPath << "\n";
+        return 2;
+    }
+
+    std::vector<std::string> requests;
+    if (!_options.arguments.empty())
+    {
+        std::string request;
+        for (const auto &argument : _options.arguments)
+            request += (request.empty() ? "" : " ") + quoteArgument(argument);
+        requests.push_back(request);
+    }
+
+    int result = 0;
+    std::string buffer, line;
+    auto receive = [&]() -> bool
+    {
+        if (!unixsocket::readLine(fd, buffer, line))
+            return false;
+
+        if (line.rfind("OK", 0) != 0)
+        {
+            std::cerr << line << "\n";
+            result = 1;
+            return true;
+        }
+
+        // "OK <n>" is followed by n data lines
+        long count = std::strtol(line.c_str() + 2, nullptr, 10);
+        for (long i = 0; i < count; ++i)
+        {
+            if (!unixsocket::readLine(fd, buffer, line))
+                return false;
+            std::cout << line << "\n";
+        }
+        return true;
+    };
+
+    bool connected = true;
+    if (!requests.empty())
+    {
+        connected = unixsocket::sendAll(fd, requests.front() + "\n") && receive();
+    }
+    else
+    {
+        // Requests from a pipe are sent ahead of their responses, up to a window, so that the daemon
+        // looks up their filenames concurrently; a terminal gets each response before the next line
+        size_t window = isatty(STDIN_FILENO) ? 1 : CONTROL_CLIENT_WINDOW;
+        size_t outstanding = 0;
+        std::string request;
+        bool more = true;
+        while (connected && (more || outstanding > 0))
+        {
+            if (more && outstanding < window)
+            {
+                more = static_cast<bool>(std::getline(std::cin, request));
+                if (more && !request.empty())
+                {
+                    connected = unixsocket::sendAll(fd, request + "\n");
+                    outstanding++;
+                }
+                continue;
+            }
+
+            connected = receive();
+            outstanding--;
+        }
+    }
+
+    close(fd);
+    if (!connected)
+    {
+        std::cerr << "sdm: connection to the daemon was lost\n";
+        return 2;
+    }
+    return result;
+}
+
+// Downloads the URLs given on the command line and in the input list, then exits
+// Progress goes to stdout as JSON lines; the exit code is one of the BATCH_EXIT_* values
+// The batch keeps its tasks in memory, so it never touches the state shared with the TUI and daemon
+int DownloadApplication::runBatch()
+{
+    std::vector<BatchItem> items;
+    std::string error;
+    if (!_options.inputPath.empty() && !readBatchList(_options.inputPath, items, error))
+    {
+        std::cerr << "sdm: " << error << "\n";
+        return BATCH_EXIT_USAGE;
+    }
+
+    for (const auto &url : _options.arguments)
+        items.push_back({url, ""});
+
+    if (items.empty())
+    {
+        std::cerr << "sdm: nothing to download\n";
+        return BATCH_EXIT_USAGE;
+    }
+
+    ManagerOptions managerOptions = makeManagerOptions();
+    managerOptions.persistent = false;
+
+    DownloadManager manager(managerOptions);
+    std::unique_ptr<MetricsExporter> metrics;
+    if (!startMetrics(manager.getMetrics(), metrics))
+        return BATCH_EXIT_USAGE;
+
+    BatchRunner runner(manager, _options.progressInterval, std::cout);
+
+    activeBatch = &runner;
+    installStopHandlers();
+
+    int result = runner.run(items);
+
+    activeBatch = nullptr;
+    return result;
+}
+
+// Builds the manager settings given on the command line, leaving the rest at their defaults
+ManagerOptions DownloadApplication::makeManagerOptions() const
+{
+    ManagerOptions managerOptions;
+    if (_options.concurrency > 0)
+        managerOptions.concurrency = _options.concurrency;
+    if (_options.retries >= 0)
+        managerOptions.maxRetries = _options.retries;
+    if (_options.stallTimeout >= 0)
+        managerOptions.stall.window = std::chrono::seconds(_options.stallTimeout);
+    if (_options.minSpeed > 0)
+        managerOptions.stall.minBytesPerSecond = _options.minSpeed;
+    managerOptions.cacheBytes = static_cast<int64_t>(_options.cacheSize) * 1024 * 1024;
+    return managerOptions;
+}
+
+// Starts exporting the manager's metrics if a port or file was given
+// Returns false after reporting the error if the exporter could not start
+bool DownloadApplication::startMetrics(const Metrics &metrics, std::unique_ptr<MetricsExporter> &exporter) const
+{
+    if (_options.metricsPort == 0 && _options.metricsPath.empty())
+        return true;
+
+    exporter = std::make_unique<MetricsExporter>(metrics);
+
+    std::string error;
+    if (!exporter->start(_options.metricsPort, _options.metricsPath, _options.metricsInterval, error))
+    {
+        std::cerr << "sdm: " << error << "\n";
+        return false;
+    }
+    return true;
+}
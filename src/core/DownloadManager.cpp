@@ -1,6 +1,8 @@
 #include <iostream>
 #include <fstream>
+#include <cstdio>
 #include <cstdlib>
+#include <algorithm>
 #include <sys/stat.h>
 
 #ifndef _WIN32
@@ -8,30 +10,13 @@
 #endif
 
 #include "core/DownloadManager.hpp"
+#include "aux/Tracing.hpp"
 #include "util/http.hpp"
 #include "util/format.hpp"
 #include "util/file.hpp"
 
 namespace
 {
-    // Returns the file path where download manager state should be stored
-    // Creates ~/.sdm if necessary (on non-Windows platforms)
-    std::string getStateFilePath()
-    {
-        const char *home = std::getenv("HOME");
-        if (!home)
-        {
-            // Fallback to current directory if HOME is not set
-            return SDM_STATE_FILENAME;
-        }
-
-        std::string stateDirectory = std::string(home) + "/." + SDM_STATE_DIRECTORY;
-#ifndef _WIN32
-        mkdir(stateDirectory.c_str(), 0755); // Create directory if it doesn't exist
-#endif
-        return stateDirectory + "/" + SDM_STATE_FILENAME;
-    }
-
     // Returns true if the download task is effectively complete (i.e., its progress is >= 99.9999)
     bool isTaskComplete(const std::shared_ptr<DownloadTask> &task)
     {
@@ -61,22 +46,102 @@ namespace
             return DownloadStatus::CANCELED;
         }
     }
+
+    // Builds a task from its persisted representation
+    std::shared_ptr<DownloadTask> taskFromRecord(const TaskRecord &record)
+    {
+        auto task = std::make_shared<DownloadTask>(record.url);
+        task->setId(record.id);
+        task->setDestination(record.destination);
+        task->setBytesDownloaded(static_cast<int64_t>(record.bytesDownloaded));
+        task->setTotalBytes(static_cast<int64_t>(record.totalBytes));
+        task->setStatus(intToStatus(record.status));
+        task->setHttpStatus(record.httpStatus);
+        task->setErrorCode(static_cast<CURLcode>(record.errorCode));
+        task->setAddedAt(record.addedAt);
+        task->setEndedAt(record.endedAt);
+        task->setHeadTimings(record.headTimings);
+        task->setTimings(record.timings);
+        task->setValidators(record.etag, record.lastModified);
+        task->setExtraDestinations(record.extraDestinations);
+        return task;
+    }
+
+    // Captures the persistent fields of a task
+    TaskRecord recordFromTask(const DownloadTask &task)
+    {
+        TaskRecord record;
+        record.id = task.getId();
+        record.url = task.getUrl();
+        record.destination = task.getDestination();
+        record.bytesDownloaded = static_cast<double>(task.getBytesDownloaded());
+        record.totalBytes = static_cast<double>(task.getTotalBytes());
+        record.status = statusToInt(task.getStatus());
+        record.httpStatus = task.getHttpStatus();
+        record.errorCode = task.getErrorCode();
+        record.addedAt = task.getAddedAt();
+        record.endedAt = task.getEndedAt();
+        record.headTimings = task.getHeadTimings();
+        record.timings = task.getTimings();
+        record.etag = task.getEtag();
+        record.lastModified = task.getLastModified();
+        record.extraDestinations = task.getExtraDestinations();
+        return record;
+    }
+}
+
+// Returns the file path where the given piece of download manager state should be stored
+// Creates ~/.sdm if necessary (on non-Windows platforms)
+std::string DownloadManager::getStateFilePath(const char *filename)
+{
+    const char *home = std::getenv("HOME");
+    if (!home)
+    {
+        // Fallback to current directory if HOME is not set
+        return filename;
+    }
+
+    std::string stateDirectory = std::string(home) + "/." + SDM_STATE_DIRECTORY;
+#ifndef _WIN32
+    mkdir(stateDirectory.c_str(), 0755); // Create directory if it doesn't exist
+#endif
+    return stateDirectory + "/" + filename;
 }
 
 // Initialises thread pool and loads saved download states
-DownloadManager::DownloadManager()
-    : _threadPool(5),
-      _stateFilePath(getStateFilePath())
+// A manager that is not persistent keeps everything in memory and leaves ~/.sdm untouched, apart from
+// the download cache when one is asked for
+DownloadManager::DownloadManager(const ManagerOptions &options)
+    : _options(options),
+      _threadPool(std::max<size_t>(options.concurrency, 1)),
+      _resolvers(SDM_RESOLVER_THREADS),
+      _stateFilePath(options.persistent ? getStateFilePath(SDM_STATE_FILENAME) : ""),
+      _history(options.persistent ? getStateFilePath(SDM_HISTORY_FILENAME) : ""),
+      _persister(_stateFilePath, std::chrono::milliseconds(SDM_STATE_SAVE_INTERVAL_MS)),
+      _jitter(std::random_device{}())
 {
-    loadState();
+    if (_options.cacheBytes > 0)
+    {
+        _cache = std::make_unique<DownloadCache>(getStateFilePath(SDM_CACHE_DIRECTORY), _options.cacheBytes);
+    }
+    if (_options.persistent)
+    {
+        loadState();
+    }
 }
 
-// Cleans up thread pool, pauses all downloads, and saves state
+// Pauses all downloads, waits for the workers to stop, and saves state
 DownloadManager::~DownloadManager()
 {
-    _threadPool.~ThreadPool();
-    pauseAllDownloads();
-    saveState();
+    pauseAllDownloads(); // Running transfers abort at their next progress callback
+    _stopping.store(true); // Lookups still waiting for a resolver are dropped rather than sent
+    _resolvers.shutdown();
+    _threadPool.shutdown();
+
+    if (_options.persistent)
+    {
+        _persister.flush(collectChanges()); // Write the final state immediately
+    }
 }
 
 // Assigns a given task to the container matching its current status
@@ -85,166 +150,312 @@ void DownloadManager::addTaskToStatusContainer(std::shared_ptr<DownloadTask> tas
     switch (task->getStatus())
     {
     case DownloadStatus::QUEUED:
-        _queued.push_back(task);
-        break;
     case DownloadStatus::ACTIVE:
-        _active.push_back(task);
-        break;
     case DownloadStatus::PAUSED:
-        _paused.push_back(task);
+        _tasks.add(task, task->getStatus());
+        if (task->getStatus() != DownloadStatus::PAUSED)
+            trackUrl(*task); // A paused task cannot be joined, so it is tracked once resumed
         break;
     case DownloadStatus::COMPLETED:
-        _completed.push_back(task);
-        break;
     case DownloadStatus::FAILED:
-        _failed.push_back(task);
+    {
+        tracing::Scope span("state", "finish task", static_cast<int64_t>(task->getId()));
+        untrackUrl(*task);
+        if (task->getStatus() == DownloadStatus::COMPLETED)
+            cloneToExtraDestinations(*task);
+        _history.append(recordFromTask(*task)); // Finished tasks only live on disk
+        if (_onTaskFinished)
+            _onTaskFinished(*task);
         break;
+    }
     default:
+        untrackUrl(*task);
         break; // CANCELED tasks are not stored
     }
 }
 
-// Removes a given task from whichever container currently holds it
-void DownloadManager::removeTaskFromCurrentContainer(std::shared_ptr<DownloadTask> task)
+// Updates a task's status and moves it to the container of the new status
+// Finished tasks leave the registry for the history store; cancelled tasks are dropped
+void DownloadManager::updateTaskStatus(std::shared_ptr<DownloadTask> task, DownloadStatus newStatus)
 {
-    auto removeTask = [&](std::vector<std::shared_ptr<DownloadTask>> &list)
+    // A task waiting to retry has no worker to clean up after it
+    if (task->isWaitingToRetry())
     {
-        auto it = std::find(list.begin(), list.end(), task);
-        if (it != list.end())
-        {
-            list.erase(it);
-        }
-    };
+        cancelRetry(*task);
+        if (newStatus == DownloadStatus::CANCELED)
+            std::remove(task->getDestination().c_str());
+    }
 
-    switch (task->getStatus())
+    if (newStatus != DownloadStatus::COMPLETED && newStatus != DownloadStatus::FAILED &&
+        !task->requestStatus(newStatus))
+    {
+        // A worker finished the task first; settle it with the status the worker chose
+        _tasks.erase(task->getId());
+        addTaskToStatusContainer(task);
+        saveTask(*task);
+        return;
+    }
+
+    switch (newStatus)
     {
     case DownloadStatus::QUEUED:
-        removeTask(_queued);
-        break;
     case DownloadStatus::ACTIVE:
-        removeTask(_active);
-        break;
     case DownloadStatus::PAUSED:
-        removeTask(_paused);
-        break;
-    case DownloadStatus::COMPLETED:
-        removeTask(_completed);
-        break;
-    case DownloadStatus::FAILED:
-        removeTask(_failed);
+        if (!_tasks.move(task->getId(), newStatus))
+            _tasks.add(task, newStatus);
+        if (newStatus == DownloadStatus::QUEUED)
+            trackUrl(*task);
         break;
     default:
-        break; // CANCELED tasks won't be in a container
-    }
-}
-
-// Updates a task's status, removes it from its old container,
-// Places it into the container of the new status (unless cancelled).
-void DownloadManager::updateTaskStatus(std::shared_ptr<DownloadTask> task, DownloadStatus newStatus)
-{
-    removeTaskFromCurrentContainer(task);
-    task->setStatus(newStatus);
-
-    if (newStatus != DownloadStatus::CANCELED)
-    {
+        task->setStatus(newStatus);
+        _tasks.erase(task->getId());
         addTaskToStatusContainer(task);
+        break;
     }
 
-    saveState();
+    saveTask(*task);
 }
 
 // Creates a new download task from the given URL and destination and adds it to the queued container
-void DownloadManager::queueDownload(const std::string &url, const std::string &destination)
+// Returns the id of the queued task, or 0 if the server rejected the request and the task failed
+// A URL already being downloaded is not fetched again: the request joins that transfer, its destination
+// is filled in from the downloaded file on completion, and the id of the existing task is returned
+TaskId DownloadManager::queueDownload(const std::string &url, const std::string &destination)
 {
+    TaskId joined = joinInFlight(url, destination);
+    if (joined != 0)
+        return joined;
+
     auto task = std::make_shared<DownloadTask>(url);
+    task->setStallPolicy(_options.stall);
 
     std::string resolvedDestination = destination;
     if (resolvedDestination.empty())
     {
         // If the user does not provide a destination, resolve it from the server
         resolvedDestination = http::resolveFilenameFromServer(*task);
+        _metrics.recordRequest(MetricsRequest::HEAD);
+    }
+
+    return addResolvedTask(task, resolvedDestination);
+}
+
+// Queues a download like queueDownload(), but resolves a missing destination on the resolver threads,
+// so that the caller's loop does not wait on the server; onQueued receives the id from a later update()
+// Requests that need no lookup call onQueued before returning; onQueued may be empty
+void DownloadManager::queueDownloadAsync(const std::string &url, const std::string &destination, QueuedCallback onQueued)
+{
+    TaskId joined = joinInFlight(url, destination);
+    if (joined != 0 || !destination.empty())
+    {
+        TaskId id = joined != 0 ? joined : queueDownload(url, destination);
+        if (onQueued)
+            onQueued(id);
+        return;
+    }
+
+    auto task = std::make_shared<DownloadTask>(url);
+    task->setStallPolicy(_options.stall);
+    resolveDestination(task, std::move(onQueued));
+}
+
+// Looks up a task's filename on the resolver threads; update() then queues the task
+// Used for new requests and for started tasks whose earlier lookup failed
+void DownloadManager::resolveDestination(std::shared_ptr<DownloadTask> task, QueuedCallback onQueued)
+{
+    task->setErrorCode(CURLE_OK);
+    task->setHttpStatus(0);
+    _resolvers.enqueue([this, task, onQueued = std::move(onQueued)]() mutable
+                       {
+                           if (_stopping.load())
+                               return;
+                           std::string resolvedDestination = http::resolveFilenameFromServer(*task);
+                           _resolutions.push({task, std::move(resolvedDestination), std::move(onQueued)});
+                           _notifier.notify(); },
+                       TaskPriority::HIGH);
+}
+
+// Adds the URL's destination to an unfinished task for the same URL, if there is one
+// Returns the id of that task, or 0 if there is none
+TaskId DownloadManager::joinInFlight(const std::string &url, const std::string &destination)
+{
+    auto inFlight = findInFlight(url);
+    if (!inFlight)
+        return 0;
+
+    const auto &extras = inFlight->getExtraDestinations();
+    if (!destination.empty() && destination != inFlight->getDestination() &&
+        std::find(extras.begin(), extras.end(), destination) == extras.end())
+    {
+        inFlight->addExtraDestination(destination);
+        saveTask(*inFlight);
+    }
+    tracing::instant("scheduler", "join", static_cast<int64_t>(inFlight->getId()));
+    return inFlight->getId();
+}
+
+// Queues a task once its destination is known
+// A failed filename request is retried with the same backoff as a failed transfer if the error is
+// transient, with the task listed as active meanwhile; otherwise the task fails
+// Returns the id of the task, or 0 if it failed
+TaskId DownloadManager::addResolvedTask(std::shared_ptr<DownloadTask> task, const std::string &resolvedDestination)
+{
+    // A task started without a destination is already listed; it may have been paused or cancelled since
+    bool listed = task->getId() != 0;
+    if (listed && task->getStatus() != DownloadStatus::ACTIVE)
+    {
+        if (task->getStatus() == DownloadStatus::PAUSED && task->getErrorCode() == CURLE_OK)
+        {
+            task->setDestination(getUniqueFilename(resolvedDestination));
+            saveTask(*task);
+        }
+        return task->getId();
     }
 
     if (task->getErrorCode() != CURLE_OK)
     {
+        _metrics.recordFailure(task->getErrorCode(), task->getHttpStatus());
+        task->setStatus(DownloadStatus::FAILED);
+        if (!listed)
+        {
+            _tasks.add(task, DownloadStatus::ACTIVE);
+            trackUrl(*task);
+        }
+        if (scheduleRetry(task))
+        {
+            saveTask(*task);
+            return task->getId();
+        }
+
         // If the server returned an error during filename resolution, mark the task as failed
         updateTaskStatus(task, DownloadStatus::FAILED);
-        return;
+        return 0;
+    }
+
+    if (listed)
+    {
+        task->setDestination(getUniqueFilename(resolvedDestination));
+        updateTaskStatus(task, DownloadStatus::QUEUED);
+        return task->getId();
     }
 
+    // Another request for the URL may have been queued while this one was being resolved
+    TaskId joined = joinInFlight(task->getUrl(), "");
+    if (joined != 0)
+        return joined;
+
     task->setDestination(getUniqueFilename(resolvedDestination));
-    _queued.push_back(task);
+    TaskId id = _tasks.add(task, DownloadStatus::QUEUED);
+    trackUrl(*task);
+    tracing::instant("scheduler", "queue", static_cast<int64_t>(id));
 
-    saveState();
+    saveTask(*task);
+    return id;
 }
 
-// Pauses an active download by index, moving it to the paused container
-void DownloadManager::pauseDownload(size_t index)
+// Queues the tasks whose filename the resolver threads have looked up and tells their requesters
+void DownloadManager::applyResolutions()
 {
-    if (index >= _active.size())
-        return;
+    Resolution resolution;
+    while (_resolutions.pop(resolution))
+    {
+        _metrics.recordRequest(MetricsRequest::HEAD);
+        TaskId id = addResolvedTask(resolution.task, resolution.destination);
+        if (resolution.onQueued)
+            resolution.onQueued(id);
+    }
+}
+
+// Pauses an active download by id, moving it to the paused container
+bool DownloadManager::pauseDownload(TaskId id)
+{
+    auto task = _tasks.find(id, DownloadStatus::ACTIVE);
+    if (!task)
+        return false;
 
-    auto task = _active[index];
     updateTaskStatus(task, DownloadStatus::PAUSED);
+    return true;
 }
 
-// Resumes a paused download by index, moving it to the queued container
-void DownloadManager::resumeDownload(size_t index)
+// Resumes a paused download by id, moving it to the queued container
+bool DownloadManager::resumeDownload(TaskId id)
 {
-    if (index >= _paused.size())
-        return;
+    auto task = _tasks.find(id, DownloadStatus::PAUSED);
+    if (!task)
+        return false;
 
-    auto task = _paused[index];
     task->resume();
+    task->setRetries(0);
     updateTaskStatus(task, DownloadStatus::QUEUED);
+    return true;
 }
 
-// Cancels an active download by index
-void DownloadManager::cancelDownload(size_t index)
+// Cancels an active download by id
+// A download that joined requests share is left running, as the id does not say which request to
+// withdraw; withdrawDestination() removes a joined request's file instead
+bool DownloadManager::cancelDownload(TaskId id)
 {
-    if (index >= _active.size())
-        return;
+    auto task = _tasks.find(id, DownloadStatus::ACTIVE);
+    if (!task || !task->getExtraDestinations().empty())
+        return false;
 
-    auto task = _active[index];
     updateTaskStatus(task, DownloadStatus::CANCELED);
+    return true;
+}
+
+// Withdraws the request that joined an unfinished download with the given file, so the file is not made
+// Returns false if no request joined the download with that file
+bool DownloadManager::withdrawDestination(TaskId id, const std::string &destination)
+{
+    auto task = _tasks.find(id);
+    if (!task)
+        return false;
+
+    auto extras = task->getExtraDestinations();
+    auto it = std::find(extras.begin(), extras.end(), destination);
+    if (it == extras.end())
+        return false;
+
+    extras.erase(it);
+    task->setExtraDestinations(extras);
+    tracing::instant("scheduler", "withdraw", static_cast<int64_t>(id));
+    saveTask(*task);
+    return true;
 }
 
-// Retries a failed download by index, moving it to the queued container
-void DownloadManager::retryDownload(size_t index)
+// Retries a failed download by history id, removing it from the history and queueing it again
+void DownloadManager::retryDownload(uint64_t historyId)
 {
-    if (index >= _failed.size())
+    TaskRecord record;
+    if (!_history.read(historyId, record) || intToStatus(record.status) != DownloadStatus::FAILED)
         return;
 
-    auto task = _failed[index];
-    removeTaskFromCurrentContainer(task);
-    queueDownload(task->getUrl(), task->getDestination());
+    _history.remove(historyId);
+    requeueFailed(record);
 }
 
 // Pauses all active and queued downloads
 void DownloadManager::pauseAllDownloads()
 {
-    // Drain _activeDownloads from the back
-    while (!_active.empty())
+    for (DownloadStatus status : {DownloadStatus::ACTIVE, DownloadStatus::QUEUED})
     {
-        auto &task = _active.back();
-        updateTaskStatus(task, DownloadStatus::PAUSED);
-    }
-
-    // Drain _queuedDownloads from the back
-    while (!_queued.empty())
-    {
-        auto &task = _queued.back();
-        updateTaskStatus(task, DownloadStatus::PAUSED);
+        auto tasks = _tasks.list(status);
+        while (!tasks.empty())
+        {
+            updateTaskStatus(tasks.back(), DownloadStatus::PAUSED);
+        }
     }
 }
 
 // Resumes all paused downloads, moving them to the queued container
 void DownloadManager::resumeAllDownloads()
 {
-    while (!_paused.empty())
+    auto paused = _tasks.list(DownloadStatus::PAUSED);
+    while (!paused.empty())
     {
-        auto &task = _paused.back();
+        auto task = paused.back();
         task->resume();
+        task->setRetries(0);
         updateTaskStatus(task, DownloadStatus::QUEUED);
     }
 }
@@ -252,23 +463,28 @@ void DownloadManager::resumeAllDownloads()
 // Cancels all active or queued downloads
 void DownloadManager::cancelAllDownloads()
 {
-    for (auto &task : _active)
-    {
-        updateTaskStatus(task, DownloadStatus::CANCELED);
-    }
-    for (auto &task : _queued)
+    for (DownloadStatus status : {DownloadStatus::ACTIVE, DownloadStatus::QUEUED})
     {
-        updateTaskStatus(task, DownloadStatus::CANCELED);
+        auto tasks = _tasks.list(status);
+        while (!tasks.empty())
+        {
+            updateTaskStatus(tasks.back(), DownloadStatus::CANCELED);
+        }
     }
 }
 
+// Retries every failed download in the history
 void DownloadManager::retryAllDownloads()
 {
-    while (!_failed.empty())
+    HistoryQuery failedQuery;
+    failedQuery.status = statusToInt(DownloadStatus::FAILED);
+
+    // Collect first, as retries that fail again are appended to the history
+    auto failed = _history.query(failedQuery, 0, _history.count(failedQuery));
+    for (const auto &entry : failed)
     {
-        auto &task = _failed.back();
-        removeTaskFromCurrentContainer(task);
-        queueDownload(task->getUrl(), task->getDestination());
+        _history.remove(entry.id);
+        requeueFailed(entry.record);
     }
 }
 
@@ -276,141 +492,409 @@ void DownloadManager::retryAllDownloads()
 // Starts new tasks from the queue if possible
 void DownloadManager::update()
 {
-    // Collect any tasks that are still active
-    std::vector<std::shared_ptr<DownloadTask>> stillActive;
-    stillActive.reserve(_active.size());
+    tracing::Scope span("scheduler", "update");
 
-    for (auto &task : _active)
+    applyResolutions();
+
+    // Apply the outcome of every run that has ended since the last update
+    TaskEvent event;
+    while (_events.pop(event))
     {
-        DownloadStatus status = task->getStatus();
-        switch (status)
+        auto task = _tasks.find(event.id);
+        if (event.status != DownloadStatus::COMPLETED && event.status != DownloadStatus::FAILED)
         {
-        case DownloadStatus::ACTIVE:
-            stillActive.push_back(task);
-            break;
-        case DownloadStatus::COMPLETED:
-            updateTaskStatus(task, DownloadStatus::COMPLETED);
-            break;
-        case DownloadStatus::FAILED:
-            updateTaskStatus(task, DownloadStatus::FAILED);
-            break;
-        default:
-            break;
+            // Runs ending in a pause or cancel were already handled when requested, but the run may have
+            // written more of the file since; a paused task is saved again with what it ended with
+            if (task)
+                saveTask(*task);
+            continue;
+        }
+
+        if (task && task->getStatus() == event.status)
+        {
+            if (event.status == DownloadStatus::FAILED && scheduleRetry(task))
+            {
+                saveTask(*task);
+                continue;
+            }
+            updateTaskStatus(task, event.status);
+        }
+    }
+
+    startDueRetries();
+
+    // Start new tasks if there is room in the thread pool; tasks waiting to retry hold no worker
+    auto queued = _tasks.list(DownloadStatus::QUEUED);
+    auto active = _tasks.list(DownloadStatus::ACTIVE);
+    while (!queued.empty() && active.size() < _threadPool.size() + _retryTimers.size())
+    {
+        auto task = queued.back();
+        _tasks.move(task->getId(), DownloadStatus::ACTIVE);
+        saveTask(*task);
+        if (task->getDestination().empty())
+        {
+            // Its filename request failed before; the task is queued again once the lookup succeeds
+            task->transitionStatus(DownloadStatus::QUEUED, DownloadStatus::ACTIVE);
+            resolveDestination(task, nullptr);
+            continue;
         }
+        task->setMetrics(&_metrics);
+        task->setCache(_cache.get());
+        task->setStallPolicy(_options.stall);
+        tracing::instant("scheduler", "start", static_cast<int64_t>(task->getId()));
+
+        _threadPool.enqueue([this, task]()
+                            {
+                                task->run();
+                                _events.push({task->getId(), task->getStatus()});
+                                _notifier.notify(); });
+    }
+
+    // Progress alone does not make the state dirty: a task's progress is saved with its next change and
+    // on exit, and a resumed transfer continues from the size of its file on disk in any case
+    if (!active.empty())
+    {
+        _throughput.record(std::chrono::steady_clock::now(), _metrics.getBytesTransferred());
+    }
+    else
+    {
+        _throughput.reset();
+    }
+
+    // Hand the changes to the persister once the debounce interval has elapsed
+    if (_persister.isDue())
+    {
+        tracing::Scope submitSpan("state", "collect changes");
+        _persister.submit(collectChanges());
     }
-    // Overwrite _active with only the tasks still active
-    _active = std::move(stillActive);
 
-    // Start new tasks if there is room in the thread pool
-    while (!_queued.empty() && _active.size() < _threadPool.size())
+    size_t queuedCount = _tasks.list(DownloadStatus::QUEUED).size();
+    size_t activeCount = _tasks.list(DownloadStatus::ACTIVE).size();
+    size_t pausedCount = _tasks.list(DownloadStatus::PAUSED).size();
+    _metrics.setTaskCounts(queuedCount, activeCount, pausedCount);
+
+    // Idle slots show up as the gap between the active series and the pool size
+    if (tracing::isEnabled())
     {
-        auto task = _queued.back();
-        _queued.pop_back();
-        _active.push_back(task);
+        tracing::counter("tasks", "queued", static_cast<int64_t>(queuedCount));
+        tracing::counter("tasks", "active", static_cast<int64_t>(activeCount));
+        tracing::counter("tasks", "paused", static_cast<int64_t>(pausedCount));
+    }
+}
 
-        _threadPool.enqueue([task]()
-                            { task->run(); });
+// Time until the persister is due or the next retry should start
+std::chrono::milliseconds DownloadManager::timeUntilNextUpdate() const
+{
+    auto timeout = _persister.timeUntilDue();
+    if (!_retryTimers.empty())
+    {
+        // Rounded up, so that the caller does not wake just before the retry is due
+        auto untilRetry = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              _retryTimers.begin()->first - std::chrono::steady_clock::now()) +
+                          std::chrono::milliseconds(1);
+        timeout = std::min(timeout, std::max(untilRetry, std::chrono::milliseconds(0)));
     }
+    return timeout;
+}
 
-    saveState(); // Persist changes
+// Changes how many transfers run at once
+// Lowering it lets the running transfers finish; queued tasks wait until fewer are active
+void DownloadManager::setConcurrency(size_t concurrency)
+{
+    _threadPool.resize(concurrency);
+    _notifier.notify(); // Start queued tasks in the new slots on the next update
 }
 
-// Clears all history of completed and failed downloads (removes them from their containers)
+// Clears all history of completed and failed downloads
 void DownloadManager::clearHistory()
 {
-    _completed.clear();
-    _failed.clear();
-    saveState();
+    _history.clear();
 }
 
 //------------------------------------------------------------------------------
-// Loading and saving download state from and to disk
+// Deduplication of requests for the same URL
 //------------------------------------------------------------------------------
 
-// Loads the download manager's state from _stateFilePath
-// Creates tasks and places them in the appropriate containers
-void DownloadManager::loadState()
+// Returns the queued or active task downloading the given URL, if any; a paused task is not joined,
+// as the new request would wait for the user to resume it
+std::shared_ptr<DownloadTask> DownloadManager::findInFlight(const std::string &url) const
 {
-    std::ifstream inFile(_stateFilePath);
-    if (!inFile.is_open())
+    std::string normalized = http::normalizeUrl(url);
+    auto it = _tasksByUrl.find(std::max<size_t>(std::hash<std::string>()(normalized), 1));
+    if (it == _tasksByUrl.end())
+        return nullptr;
+
+    auto task = _tasks.find(it->second);
+    if (!task || (task->getStatus() != DownloadStatus::QUEUED && task->getStatus() != DownloadStatus::ACTIVE) ||
+        http::normalizeUrl(task->getUrl()) != normalized)
+        return nullptr;
+    return task;
+}
+
+// Key of a task in _tasksByUrl, kept in the task as tasks are tracked again on every resume
+size_t DownloadManager::urlKey(DownloadTask &task)
+{
+    if (task.getUrlKey() == 0)
+        task.setUrlKey(std::max<size_t>(std::hash<std::string>()(http::normalizeUrl(task.getUrl())), 1));
+    return task.getUrlKey();
+}
+
+void DownloadManager::trackUrl(DownloadTask &task)
+{
+    _tasksByUrl[urlKey(task)] = task.getId();
+}
+
+// Forgets a finished task, unless a newer task for the same URL has taken its place
+void DownloadManager::untrackUrl(DownloadTask &task)
+{
+    auto it = _tasksByUrl.find(urlKey(task));
+    if (it != _tasksByUrl.end() && it->second == task.getId())
+        _tasksByUrl.erase(it);
+}
+
+// Gives each request that joined a completed task its own file, sharing storage with the download
+// where the filesystem allows; a name taken in the meantime gets a numbered variant
+void DownloadManager::cloneToExtraDestinations(const DownloadTask &task)
+{
+    for (const auto &destination : task.getExtraDestinations())
     {
-        return; // No file => nothing to load
+        tracing::Scope span("state", "clone file", static_cast<int64_t>(task.getId()));
+        cloneFile(task.getDestination(), getUniqueFilename(destination));
     }
+}
 
-    std::string line;
-    while (std::getline(inFile, line))
+//------------------------------------------------------------------------------
+// Retries
+//------------------------------------------------------------------------------
+
+// Queues a failed download again, continuing into the file it was writing
+void DownloadManager::requeueFailed(const TaskRecord &record)
+{
+    _metrics.recordRetry();
+    if (record.destination.empty())
     {
-        if (line.empty()) 
-            continue;
+        queueDownloadAsync(record.url, "", nullptr); // Failed before a filename was resolved
+        return;
+    }
+
+    auto task = std::make_shared<DownloadTask>(record.url);
+    task->setDestination(record.destination);
+    task->setValidators(record.etag, record.lastModified);
+    task->setExtraDestinations(record.extraDestinations);
+    task->resume();
+    TaskId id = _tasks.add(task, DownloadStatus::QUEUED);
+    trackUrl(*task);
+    tracing::instant("scheduler", "queue", static_cast<int64_t>(id));
+    saveTask(*task);
+}
 
-        std::istringstream iss(line);
-
-        std::string url, destination;
-        double downloadedBytes, totalBytes;
-        int statusInt, httpStatus, errorCodeInt;
-        time_t addedAt, endedAt;
-
-        // Read a line of data for a single task
-        if (!(iss >> std::quoted(url)
-                  >> std::quoted(destination) // Enable reading strings with spaces
-                  >> downloadedBytes
-                  >> totalBytes
-                  >> statusInt
-                  >> httpStatus
-                  >> errorCodeInt
-                  >> addedAt
-                  >> endedAt))
+// Gives a run that failed with a transient error another attempt after a backoff; the task stays active
+// Returns false if the task should fail: the error is permanent, or the task has failed too often
+// without receiving anything in between
+bool DownloadManager::scheduleRetry(const std::shared_ptr<DownloadTask> &task)
+{
+    if (!http::isTransientError(task->getErrorCode(), task->getHttpStatus()))
+        return false;
+
+    if (task->getRunBytes() > 0)
+        task->setRetries(0); // Progress since the last failure starts the backoff over
+    if (task->getRetries() >= _options.maxRetries ||
+        !task->transitionStatus(DownloadStatus::FAILED, DownloadStatus::ACTIVE))
+        return false;
+
+    auto retryAt = std::chrono::steady_clock::now() + calcRetryDelay(task->getRetries(), task->getRetryAfterSeconds());
+    task->setRetries(task->getRetries() + 1);
+    task->setRetryAt(retryAt);
+    _retryTimers.emplace(retryAt, task->getId());
+    _metrics.recordRetry();
+    return true;
+}
+
+// Forgets the pending retry of a task that is being paused, cancelled or started
+void DownloadManager::cancelRetry(DownloadTask &task)
+{
+    auto range = _retryTimers.equal_range(task.getRetryAt());
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == task.getId())
         {
-            break; // Break on EOF or malformed data
+            _retryTimers.erase(it);
+            break;
         }
+    }
+    task.setRetryAt(std::chrono::steady_clock::time_point());
+}
 
-        auto task = std::make_shared<DownloadTask>(url);
-        task->setDestination(destination);
-        task->setBytesDownloaded(downloadedBytes);
-        task->setTotalBytes(totalBytes);
-        task->setStatus(static_cast<DownloadStatus>(statusInt));
-        task->setHttpStatus(httpStatus);
-        task->setErrorCode(static_cast<CURLcode>(errorCodeInt));
-        task->setAddedAt(addedAt);
-        task->setEndedAt(endedAt);
+// Queues the tasks whose backoff has elapsed, to continue from the bytes already on disk
+void DownloadManager::startDueRetries()
+{
+    auto now = std::chrono::steady_clock::now();
+    while (!_retryTimers.empty() && _retryTimers.begin()->first <= now)
+    {
+        auto task = _tasks.find(_retryTimers.begin()->second, DownloadStatus::ACTIVE);
+        _retryTimers.erase(_retryTimers.begin());
+        if (!task)
+            continue;
+
+        task->setRetryAt(std::chrono::steady_clock::time_point());
+        if (task->getErrorCode() == CURLE_RANGE_ERROR)
+            task->restart(); // The server would not resume the transfer
+        else
+            task->resume();
+        tracing::instant("scheduler", "retry", static_cast<int64_t>(task->getId()));
+        updateTaskStatus(task, DownloadStatus::QUEUED);
+    }
+}
+
+// Backoff before a retry: the server's Retry-After if it sent one, otherwise an exponential delay
+// with jitter, so that tasks which failed together do not all retry at the same moment
+std::chrono::milliseconds DownloadManager::calcRetryDelay(int retries, int64_t retryAfterSeconds)
+{
+    if (retryAfterSeconds >= 0)
+        return std::min<std::chrono::milliseconds>(std::chrono::seconds(retryAfterSeconds), SDM_RETRY_AFTER_LIMIT);
 
+    std::chrono::milliseconds ceiling = std::min<std::chrono::milliseconds>(
+        SDM_RETRY_BASE_DELAY * (1LL << std::min(retries, 16)), SDM_RETRY_MAX_DELAY);
+    std::uniform_int_distribution<long long> delay(ceiling.count() / 2, ceiling.count());
+    return std::chrono::milliseconds(delay(_jitter));
+}
+
+//------------------------------------------------------------------------------
+// Loading and saving download state from and to disk
+//------------------------------------------------------------------------------
+
+// Loads the download manager's state from _stateFilePath
+// Reads the binary snapshot if present, otherwise imports a legacy text state file
+// Finished tasks found in older state files are moved into the history store
+void DownloadManager::loadState()
+{
+    bool migrated = false;
+    auto onRecord = [this, &migrated](const TaskRecord &record)
+    {
+        DownloadStatus status = intToStatus(record.status);
+        migrated |= (status == DownloadStatus::COMPLETED || status == DownloadStatus::FAILED);
+
+        auto task = taskFromRecord(record);
+        if (status == DownloadStatus::ACTIVE)
+        {
+            // The previous session ended without pausing this task; continue it from the partial file
+            task->setStatus(DownloadStatus::QUEUED);
+            task->resume();
+        }
+        else if (status == DownloadStatus::QUEUED)
+        {
+            task->resume(); // A retried task may have been queued with part of its file on disk
+        }
         addTaskToStatusContainer(task);
+        if (_tasks.find(task->getId()))
+            _unsavedTasks.insert(task->getId());
+    };
+
+    if (snapshot::isBinarySnapshot(_stateFilePath))
+    {
+        snapshot::readBinary(_stateFilePath, onRecord);
+    }
+    else
+    {
+        snapshot::readText(_stateFilePath, onRecord);
+    }
+
+    // The persister starts from the loaded tasks, so that later writes only need what changes
+    StateChanges loaded = collectChanges();
+    _persister.load(std::move(loaded));
+
+    if (migrated)
+    {
+        saveState(); // Rewrite the snapshot without the migrated tasks
     }
+}
 
-    inFile.close();
+// Marks the state as changed; the persister writes it to _stateFilePath in the background
+void DownloadManager::saveState()
+{
+    if (_options.persistent)
+    {
+        _persister.markDirty();
+    }
 }
 
-// Saves the current download manager state (all containers) to _stateFilePath
-void DownloadManager::saveState() const
+// Marks a task as changed, or as no longer saved once it has finished or been cancelled
+void DownloadManager::saveTask(const DownloadTask &task)
 {
-    std::ofstream outFile(_stateFilePath, std::ios::out | std::ios::trunc);
-    if (!outFile.is_open())
+    if (_options.persistent)
     {
-        return;
+        _unsavedTasks.insert(task.getId());
+        _persister.markDirty();
     }
+}
 
-    auto writeContainer = [&](const std::vector<std::shared_ptr<DownloadTask>> &container)
+// Takes the saved form of every task changed since the last call, in proportion to the changes
+// A task's position keeps the snapshot grouped by status, queued then active then paused as before,
+// and each group in list order
+StateChanges DownloadManager::collectChanges()
+{
+    StateChanges changes;
+    changes.saved.reserve(_unsavedTasks.size());
+    for (TaskId id : _unsavedTasks)
     {
-        for (const auto &task : container)
+        auto task = _tasks.find(id);
+        if (!task)
         {
-            outFile << std::quoted(task->getUrl()) << " "
-                    << std::quoted(task->getDestination()) << " "
-                    << task->getBytesDownloaded() << " "
-                    << task->getTotalBytes() << " "
-                    << statusToInt(task->getStatus()) << " "
-                    << task->getHttpStatus() << " "
-                    << task->getErrorCode() << " "
-                    << task->getAddedAt() << " "
-                    << task->getEndedAt() << "\n";
+            changes.removed.push_back(id);
+            continue;
         }
-    };
 
-    // Write out each container in turn
-    writeContainer(_queued);
-    writeContainer(_active);
-    writeContainer(_paused);
-    writeContainer(_completed);
-    writeContainer(_failed);
+        uint64_t group = 0;
+        if (task->getStatus() == DownloadStatus::ACTIVE)
+            group = 1;
+        else if (task->getStatus() == DownloadStatus::PAUSED)
+            group = 2;
+        changes.saved.emplace_back((group << 56) | _tasks.getSequence(id), recordFromTask(*task));
+    }
+    _unsavedTasks.clear();
+    return changes;
+}
+
+// Adds every task listed in a text state file to the containers matching their status
+bool DownloadManager::importState(const std::string &path)
+{
+    bool imported = snapshot::readText(path, [this](const TaskRecord &record)
+                                       {
+                                           auto task = taskFromRecord(record);
+                                           addTaskToStatusContainer(task);
+                                           saveTask(*task);
+                                       });
+    saveState();
+    return imported;
+}
 
-    outFile.close();
-}
\ No newline at end of file
+// Writes all tasks, including the history, to a text state file
+bool DownloadManager::exportState(const std::string &path) const
+{
+    std::vector<TaskRecord> records = collectRecords();
+
+    HistoryQuery everything;
+    for (auto &entry : _history.query(everything, 0, _history.count(everything)))
+    {
+        records.push_back(std::move(entry.record));
+    }
+
+    return snapshot::writeText(path, records);
+}
+
+// Captures the persistent fields of every unfinished task, in container order
+std::vector<TaskRecord> DownloadManager::collectRecords() const
+{
+    std::vector<TaskRecord> records;
+    records.reserve(_tasks.size());
+
+    for (DownloadStatus status : {DownloadStatus::QUEUED, DownloadStatus::ACTIVE, DownloadStatus::PAUSED})
+    {
+        for (const auto &task : _tasks.list(status))
+        {
+            records.push_back(recordFromTask(*task));
+        }
+    }
+
+    return records;
+}
@@ -2,25 +2,47 @@
 #include <iostream>
 #include <sys/stat.h>
 #include <cstdio>
+#include <cstdlib>
 #include <chrono>
-#include <deque>
 
 #include "core/DownloadTask.hpp"
 #include "aux/FileWriter.hpp"
+#include "aux/Tracing.hpp"
+#include "util/file.hpp"
+#include "util/http.hpp"
+#include "util/sha256.hpp"
 
 namespace
 {
+    // State of one run shared by the libcurl callbacks; libcurl passes every response, including
+    // redirects, through the same state
+    struct RunContext
+    {
+        DownloadTask *task = nullptr;
+        FileWriter *writer = nullptr;
+        Sha256 *hasher = nullptr; // Digest of the body for the download cache, if there is one
+        bool hashedFromStart = false; // The body written is the whole file, so the digest covers it
+        int httpStatus = 0;
+        std::string etag;
+        std::string lastModified;
+        bool changed = false; // The resource differs from the one the partial file came from
+    };
+
     // Writes incoming data from libcurl to the destination file
     size_t curlWriteCallback(void *ptr, size_t size, size_t nmemb, void *userdata)
     {
-        auto *writer = static_cast<FileWriter *>(userdata);
-        if (!writer)
+        auto *context = static_cast<RunContext *>(userdata);
+        if (!context)
         {
             return 0;
         }
 
         size_t totalBytes = size * nmemb;
-        writer->write(static_cast<const char *>(ptr), totalBytes);
+        context->writer->write(static_cast<const char *>(ptr), totalBytes);
+        if (context->hasher)
+        {
+            context->hasher->update(ptr, totalBytes);
+        }
         return totalBytes; // Return number of bytes written
     }
 
@@ -37,42 +59,71 @@ namespace
             return 1;
         }
 
-        // Abort if paused or cancelled
-        if (task->isPaused() || task->isCanceled())
+        // Abort if the task was paused, cancelled or resumed into a new run
+        if (task->getStatus() != DownloadStatus::ACTIVE)
         {
             return 1;
         }
 
         // Include any previously downloaded amount (resume offset)
-        double resumeOffset = task->getResumeOffset();
-        double downloadedBytesSoFar = static_cast<double>(dlnow) + resumeOffset;
-        double totalBytesSoFar = static_cast<double>(dltotal) + resumeOffset;
+        int64_t resumeOffset = task->getResumeOffset();
+        int64_t downloadedBytesSoFar = static_cast<int64_t>(dlnow) + resumeOffset;
+        int64_t totalBytesSoFar = static_cast<int64_t>(dltotal) + resumeOffset;
 
         // Update total bytes if the server reports a larger size
-        if (totalBytesSoFar > 0.0 && totalBytesSoFar > task->getTotalBytes())
+        if (dltotal > 0 && totalBytesSoFar > task->getTotalBytes())
         {
             task->setTotalBytes(totalBytesSoFar);
         }
 
-        // If total is known, calculate percentage
-        double knownTotal = task->getTotalBytes();
-        if (knownTotal > 0.0)
-        {
-            double percentage = (downloadedBytesSoFar / knownTotal) * 100.0;
-            if (percentage > 100.0)
-            {
-                percentage = 100.0;
-            }
-            task->setProgress(percentage);
-        }
-
         // Update downloaded bytes and record speed
         task->setBytesDownloaded(downloadedBytesSoFar);
-        task->recordSpeedSample(std::time(nullptr), downloadedBytesSoFar);
+        task->recordSpeedSample(std::chrono::steady_clock::now(), downloadedBytesSoFar);
+        task->reportTransferred(static_cast<int64_t>(dlnow));
 
         return 0;
     }
 
+    // Collects the status and validators of each response and lets the task vet a successful one
+    // before its body is written; returning 0 aborts the transfer
+    size_t curlHeaderCallback(char *buffer, size_t size, size_t nmemb, void *userdata)
+    {
+        auto *headers = static_cast<RunContext *>(userdata);
+        size_t length = size * nmemb;
+        std::string line(buffer, length);
+
+        if (line.compare(0, 5, "HTTP/") == 0)
+        {
+            // A new response starts; forget the headers of the previous one
+            size_t codePos = line.find(' ');
+            headers->httpStatus = codePos == std::string::npos ? 0 : std::atoi(line.c_str() + codePos + 1);
+            headers->etag.clear();
+            headers->lastModified.clear();
+        }
+        else if (line == "\r\n" || line == "\n")
+        {
+            // End of the headers; only a successful response carries the body that will be written
+            if (headers->httpStatus >= 200 && headers->httpStatus < 300)
+            {
+                if (!headers->task->acceptResponse(headers->httpStatus, headers->etag, headers->lastModified, *headers->writer))
+                {
+                    headers->changed = true;
+                    return 0;
+                }
+                headers->hashedFromStart = headers->task->getResumeOffset() == 0;
+                if (headers->hasher)
+                {
+                    headers->hasher->reset();
+                }
+            }
+        }
+        else if (!http::readHeaderValue(line, "ETag", headers->etag))
+        {
+            http::readHeaderValue(line, "Last-Modified", headers->lastModified);
+        }
+
+        return length;
+    }
 }
 
 DownloadTask::DownloadTask(const std::string &url) : _url(url) {}
@@ -80,14 +131,21 @@ DownloadTask::DownloadTask(const std::string &url) : _url(url) {}
 // Starts the download process, handles curl initialisation and clean-up
 void DownloadTask::run()
 {
-    // Skip if task is active or already completed
-    if (_status == DownloadStatus::COMPLETED || _status == DownloadStatus::ACTIVE)
+    // A previous run of this task may still be unwinding after a pause and resume
+    std::lock_guard<std::mutex> runLock(_runMutex);
+
+    // Only queued tasks may start; a pause or cancel that arrived first wins
+    if (!transitionStatus(DownloadStatus::QUEUED, DownloadStatus::ACTIVE))
     {
         return;
     }
 
     _startTime = std::chrono::steady_clock::now();
-    _status = DownloadStatus::ACTIVE;
+    _speed.reset(); // Samples from a previous run start from a different offset
+    _runBytesReported = 0;
+    _counters.resumeOffset.store(0, std::memory_order_relaxed);
+    _errorCode.store(CURLE_OK); // The error of a retried run is cleared once it starts again
+    _retryAfterSeconds.store(-1);
 
     CURL *curlHandle = curl_easy_init();
     if (!curlHandle)
@@ -108,44 +166,102 @@ void DownloadTask::run()
 
     curl_easy_setopt(curlHandle, CURLOPT_URL, _url.c_str());
     curl_easy_setopt(curlHandle, CURLOPT_WRITEFUNCTION, curlWriteCallback);
-    curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, &writer);
+    Sha256 hasher;
+    RunContext context;
+    context.task = this;
+    context.writer = &writer;
+    context.hasher = _cache ? &hasher : nullptr;
+    curl_easy_setopt(curlHandle, CURLOPT_WRITEDATA, &context);
     curl_easy_setopt(curlHandle, CURLOPT_NOPROGRESS, 0L); // Disable progress meter
     curl_easy_setopt(curlHandle, CURLOPT_XFERINFOFUNCTION, curlProgressCallback);
     curl_easy_setopt(curlHandle, CURLOPT_XFERINFODATA, this); // Pass this task as client data
+    curl_easy_setopt(curlHandle, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+    curl_easy_setopt(curlHandle, CURLOPT_HEADERDATA, &context);
     curl_easy_setopt(curlHandle, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
+    curl_easy_setopt(curlHandle, CURLOPT_FAILONERROR, 1L);    // HTTP errors fail the task instead of saving the error page
+    http::applyStallPolicy(curlHandle, _stallPolicy);          // A stalled transfer fails and is retried from where it stopped
 
-    // Attempt resume if requested
+    // Attempt resume if requested, otherwise revalidate a cached copy
+    curl_slist *requestHeaders = nullptr;
+    CacheEntry cached;
+    bool revalidating = false;
     if (_resumeEnabled)
     {
-        configureResume(curlHandle);
+        requestHeaders = configureResume(curlHandle);
+    }
+    else if (_cache && _cache->lookup(_url, cached))
+    {
+        requestHeaders = configureRevalidation(curlHandle, cached);
+        revalidating = true;
     }
 
     // Perform the download
+    int64_t traceStart = tracing::isEnabled() ? tracing::now() : 0;
     CURLcode res = curl_easy_perform(curlHandle);
+    curl_slist_free_all(requestHeaders);
+    if (context.changed)
+    {
+        res = CURLE_RANGE_ERROR; // The retry downloads the new content from the start
+    }
     // Get HTTP status code and store it in the task
-    curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &_httpStatus);
+    long httpStatus = 0; // libcurl writes a long
+    curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &httpStatus);
+    _httpStatus.store(static_cast<int>(httpStatus));
 
-    // Check outcome
-    if (res == CURLE_OK)
+    // The file is complete on disk before the task is, so that the cache can take a copy
+    bool servedFromCache = false;
+    if (res == CURLE_OK && !writer.close())
     {
-        onDownloadComplete();
+        res = CURLE_WRITE_ERROR;
     }
-    else
+    else if (res == CURLE_OK && revalidating && httpStatus == 304)
     {
-        if (isPaused())
-        {
-            onDownloadPause();
-        }
-        else if (isCanceled())
+        servedFromCache = copyFromCache(cached);
+    }
+
+    // Another worker evicted the cached copy since the lookup: the file is requested again at once,
+    // without the condition, rather than failing or waiting out a retry
+    if (res == CURLE_OK && revalidating && httpStatus == 304 && !servedFromCache)
+    {
+        FileWriter refetchWriter(_destination, false);
+        context.writer = &refetchWriter;
+        curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, nullptr);
+        res = refetchWriter.isOpen() ? curl_easy_perform(curlHandle) : CURLE_WRITE_ERROR;
+        if (context.changed)
         {
-            onDownloadCancel();
+            res = CURLE_RANGE_ERROR;
         }
-        else
+        curl_easy_getinfo(curlHandle, CURLINFO_RESPONSE_CODE, &httpStatus);
+        _httpStatus.store(static_cast<int>(httpStatus));
+        if (res == CURLE_OK && !refetchWriter.close())
         {
-            onDownloadError(res);
+            res = CURLE_WRITE_ERROR;
         }
     }
 
+    if (res == CURLE_OK && _cache && !servedFromCache)
+    {
+        addToCache(context.hashedFromStart ? hasher.finishHex() : std::string());
+    }
+
+    // Servers answering 429 or 503 may say when to come back
+    curl_off_t retryAfter = 0;
+    if (curl_easy_getinfo(curlHandle, CURLINFO_RETRY_AFTER, &retryAfter) == CURLE_OK && retryAfter > 0)
+    {
+        _retryAfterSeconds.store(static_cast<int64_t>(retryAfter));
+    }
+
+    // Everything about the run is written before the outcome publishes it: once the status is final,
+    // the manager may move the task to the history at any moment
+    TransferTimings timings;
+    http::readTimings(curlHandle, timings);
+    setTimings(timings);
+    tracing::transfer("GET", traceStart, timings, static_cast<int64_t>(_id));
+
+    // Check outcome
+    bool published = res == CURLE_OK ? onDownloadComplete() : onDownloadError(res);
+
+    recordRunMetrics(curlHandle, res, timings, published);
     curl_easy_cleanup(curlHandle); // Clean up curl handle
 }
 
@@ -168,29 +284,75 @@ bool DownloadTask::isCanceled() const
     return _status == DownloadStatus::CANCELED;
 }
 
-void DownloadTask::onDownloadPause()
+// Atomically changes the status only if it still equals expected
+bool DownloadTask::transitionStatus(DownloadStatus expected, DownloadStatus desired)
 {
-    _status = DownloadStatus::PAUSED;
+    return _status.compare_exchange_strong(expected, desired);
+}
+
+// Atomically changes the status unless the task has already finished or been cancelled
+bool DownloadTask::requestStatus(DownloadStatus desired)
+{
+    DownloadStatus current = _status.load();
+    do
+    {
+        if (current == DownloadStatus::COMPLETED || current == DownloadStatus::FAILED ||
+            current == DownloadStatus::CANCELED)
+        {
+            return false;
+        }
+    } while (!_status.compare_exchange_weak(current, desired));
+
+    return true;
 }
 
 void DownloadTask::onDownloadCancel()
 {
-    _status = DownloadStatus::CANCELED;
     std::remove(_destination.c_str());
 }
 
-void DownloadTask::onDownloadComplete()
+// A finished transfer completes the task even if a pause raced with it,
+// as the file is whole; only a cancellation overrides it
+// Returns true if the task was completed
+bool DownloadTask::onDownloadComplete()
 {
-    _status = DownloadStatus::COMPLETED;
-    _progress.store(100.0);
-    _endedAt = std::time(nullptr);
+    time_t previousEnd = _endedAt.exchange(std::time(nullptr));
+
+    if (requestStatus(DownloadStatus::COMPLETED))
+    {
+        return true;
+    }
+
+    _endedAt.store(previousEnd);
+    if (isCanceled())
+    {
+        onDownloadCancel();
+    }
+    return false;
 }
 
-void DownloadTask::onDownloadError(const CURLcode errorCode)
+// Errors only fail a task that is still active; aborts caused by a pause,
+// resume or cancel leave the status chosen by the manager
+// The error is written ahead of the status and taken back if the task was not failed, so that it only
+// ever shows together with FAILED. Returns true if the task was failed
+bool DownloadTask::onDownloadError(const CURLcode errorCode)
 {
-    _errorCode = errorCode;
-    _status = DownloadStatus::FAILED;
-    _endedAt = std::time(nullptr); // Current time
+    if (isCanceled())
+    {
+        onDownloadCancel();
+        return false;
+    }
+
+    CURLcode previousError = _errorCode.exchange(errorCode);
+    time_t previousEnd = _endedAt.exchange(std::time(nullptr));
+    if (transitionStatus(DownloadStatus::ACTIVE, DownloadStatus::FAILED))
+    {
+        return true;
+    }
+
+    _errorCode.store(previousError);
+    _endedAt.store(previousEnd);
+    return false;
 }
 
 void DownloadTask::resume()
@@ -198,107 +360,292 @@ void DownloadTask::resume()
     _resumeEnabled.store(true);
 }
 
-void DownloadTask::configureResume(CURL *curlHandle)
+// Makes the next run download the whole file again, replacing what is on disk
+void DownloadTask::restart()
+{
+    _resumeEnabled.store(false);
+    setBytesDownloaded(0);
+}
+
+// Requests the rest of the file from its size on disk, on condition that the resource is the one the
+// partial file came from: If-Range makes the server answer with the whole new content otherwise, which
+// acceptResponse() writes from the start, so a changed file costs no extra request
+// Returns the request headers to free once the transfer ends
+curl_slist *DownloadTask::configureResume(CURL *curlHandle)
 {
     // Retrieve file information (e.g., size) for the destination
+    struct stat fileStat{};
+    if (stat(_destination.c_str(), &fileStat) != 0 || fileStat.st_size <= 0)
+    {
+        return nullptr;
+    }
+
+    // A plain range rather than CURLOPT_RESUME_FROM_LARGE, which fails a transfer answered with the whole file
+    int64_t resumeFrom = static_cast<int64_t>(fileStat.st_size);
+    std::string range = std::to_string(resumeFrom) + "-";
+    curl_easy_setopt(curlHandle, CURLOPT_RANGE, range.c_str());
+
+    _counters.resumeOffset.store(resumeFrom, std::memory_order_relaxed);
+    setBytesDownloaded(resumeFrom);
+
+    std::string ifRange = chooseIfRange();
+    if (ifRange.empty())
+    {
+        return nullptr; // Nothing to validate against; resume unconditionally as before
+    }
+
+    curl_slist *requestHeaders = curl_slist_append(nullptr, ("If-Range: " + ifRange).c_str());
+    curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, requestHeaders);
+    return requestHeaders;
+}
+
+// Makes the request conditional on the cached copy being out of date; the server answers 304 otherwise
+// Returns the request headers to free once the transfer ends
+curl_slist *DownloadTask::configureRevalidation(CURL *curlHandle, const CacheEntry &cached)
+{
+    curl_slist *requestHeaders = nullptr;
+    if (!cached.etag.empty())
+    {
+        requestHeaders = curl_slist_append(requestHeaders, ("If-None-Match: " + cached.etag).c_str());
+    }
+    if (!cached.lastModified.empty())
+    {
+        requestHeaders = curl_slist_append(requestHeaders, ("If-Modified-Since: " + cached.lastModified).c_str());
+    }
+    curl_easy_setopt(curlHandle, CURLOPT_HTTPHEADER, requestHeaders);
+    return requestHeaders;
+}
+
+// Replaces the empty file of a 304 reply with the cached copy
+// Returns false if the copy is gone, evicted by another worker since the lookup
+bool DownloadTask::copyFromCache(const CacheEntry &cached)
+{
+    std::remove(_destination.c_str());
+    if (!cloneFile(cached.objectPath, _destination))
+    {
+        return false;
+    }
+
+    setTotalBytes(cached.size);
+    setBytesDownloaded(cached.size);
+    _cache->touch(_url);
+    if (_metrics)
+    {
+        _metrics->recordCacheHit();
+    }
+    return true;
+}
+
+// Offers the downloaded file to the cache; the digest is computed from the file when the body written
+// in this run was not the whole file
+void DownloadTask::addToCache(std::string digest)
+{
+    if (digest.empty() && !Sha256::hashFile(_destination, digest))
+    {
+        return;
+    }
+
     struct stat fileStat{};
     if (stat(_destination.c_str(), &fileStat) == 0)
     {
-        // If there is a valid file and its size is greater than zero
-        curl_off_t resumeFrom = fileStat.st_size;
-        if (resumeFrom > 0)
-        {
-            // Tell libcurl to resume the download at this file size
-            curl_easy_setopt(curlHandle, CURLOPT_RESUME_FROM_LARGE, resumeFrom);
+        _cache->store(_url, _destination, digest, static_cast<int64_t>(fileStat.st_size), getEtag(), getLastModified());
+    }
+}
 
-            _resumeOffset = resumeFrom;
-            setBytesDownloaded(static_cast<double>(resumeFrom));
+// If-Range takes a strong ETag or a date; a weak ETag cannot vouch for the bytes on disk
+std::string DownloadTask::chooseIfRange() const
+{
+    std::lock_guard<std::mutex> lock(_validatorsMutex);
+    if (!_etag.empty() && _etag.compare(0, 2, "W/") != 0)
+    {
+        return _etag;
+    }
+    return _lastModified;
+}
 
-            // If the total size is known, recalculate the approximate progress
-            double tot = getTotalBytes();
-            if (tot > 0.0 && resumeFrom < tot)
+// Called by the worker once the headers of a successful response have arrived, before its body
+// A full response to a resumed request restarts the file in place: the resource changed, or the server
+// ignores ranges. A partial response whose validators differ from the recorded ones comes from a server
+// that ignored If-Range; it is rejected so that the retry starts over
+// Returns false to abort the transfer
+bool DownloadTask::acceptResponse(int httpStatus, const std::string &etag, const std::string &lastModified, FileWriter &writer)
+{
+    if (getResumeOffset() > 0)
+    {
+        if (httpStatus != 206)
+        {
+            if (!writer.truncate())
             {
-                double pct = (static_cast<double>(resumeFrom) / tot) * 100.0;
-                setProgress(pct);
+                return false;
+            }
+            _counters.resumeOffset.store(0, std::memory_order_relaxed);
+            setBytesDownloaded(0);
+            setTotalBytes(0); // The new content may be smaller
+            _speed.reset();
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(_validatorsMutex);
+            if ((!_etag.empty() && !etag.empty() && etag != _etag) ||
+                (!_lastModified.empty() && !lastModified.empty() && lastModified != _lastModified))
+            {
+                return false;
             }
         }
     }
+
+    setValidators(etag, lastModified);
+    return true;
 }
 
 //---------------------------------------------------------------------------------
 // Speed calculation
 //---------------------------------------------------------------------------------
 
-void DownloadTask::recordSpeedSample(time_t timestamp, double bytesDownloaded)
+// Called from the progress callback; the estimator throttles how often a sample is kept
+void DownloadTask::recordSpeedSample(std::chrono::steady_clock::time_point time, int64_t bytesDownloaded)
 {
-    // Add a new sample (current time, bytes) to the speed list
-    _speedSamples.push_back({timestamp, bytesDownloaded});
+    _speed.record(time, bytesDownloaded);
+}
 
-    // Remove samples older than 10 seconds from the front
-    double cutoff = static_cast<double>(timestamp) - 10.0;
-    while (!_speedSamples.empty() && static_cast<double>(_speedSamples.front().first) < cutoff)
+// Adds the bytes received since the previous callback of this run to the shared byte counter
+void DownloadTask::reportTransferred(int64_t runBytes)
+{
+    int64_t delta = runBytes - _runBytesReported;
+    _runBytesReported = runBytes;
+
+    if (_metrics && delta > 0)
     {
-        _speedSamples.pop_front();
+        _metrics->addBytes(delta);
     }
 }
 
-double DownloadTask::calcEstimatedTimeRemaining() const
+TransferTimings DownloadTask::getHeadTimings() const
+{
+    std::lock_guard<std::mutex> lock(_timingsMutex);
+    return _headTimings;
+}
+
+TransferTimings DownloadTask::getTimings() const
+{
+    std::lock_guard<std::mutex> lock(_timingsMutex);
+    return _timings;
+}
+
+std::string DownloadTask::getEtag() const
+{
+    std::lock_guard<std::mutex> lock(_validatorsMutex);
+    return _etag;
+}
+
+std::string DownloadTask::getLastModified() const
+{
+    std::lock_guard<std::mutex> lock(_validatorsMutex);
+    return _lastModified;
+}
+
+void DownloadTask::setValidators(const std::string &etag, const std::string &lastModified)
 {
-    double total = getTotalBytes();
-    double downloaded = getBytesDownloaded();
+    std::lock_guard<std::mutex> lock(_validatorsMutex);
+    _etag = etag;
+    _lastModified = lastModified;
+}
+
+void DownloadTask::setHeadTimings(const TransferTimings &timings)
+{
+    std::lock_guard<std::mutex> lock(_timingsMutex);
+    _headTimings = timings;
+}
+
+void DownloadTask::setTimings(const TransferTimings &timings)
+{
+    std::lock_guard<std::mutex> lock(_timingsMutex);
+    _timings = timings;
+}
 
-    // If not actively downloading, none downloaded, already finished, or not enough data for calculation, return -1
-    if (_status != DownloadStatus::ACTIVE || downloaded <= 0.0 || downloaded >= total || _speedSamples.size() < 2)
+// Percentage derived from the byte counters; a completed task is always 100%
+double DownloadTask::getProgress() const
+{
+    if (_status == DownloadStatus::COMPLETED)
     {
-        return -1.0;
+        return 100.0;
+    }
+
+    int64_t total = getTotalBytes();
+    if (total <= 0)
+    {
+        return 0.0;
     }
 
-    // Calculate time difference and downloaded bytes difference between first and last samples
-    double t0 = static_cast<double>(_speedSamples.front().first);
-    double t1 = static_cast<double>(_speedSamples.back().first);
-    double dl0 = _speedSamples.front().second;
-    double dl1 = _speedSamples.back().second;
+    double percentage = (static_cast<double>(getBytesDownloaded()) / static_cast<double>(total)) * 100.0;
+    return percentage > 100.0 ? 100.0 : percentage;
+}
 
-    double dt = t1 - t0;
-    double deltaBytes = dl1 - dl0;
+double DownloadTask::calcEstimatedTimeRemaining() const
+{
+    int64_t total = getTotalBytes();
+    int64_t downloaded = getBytesDownloaded();
 
-    // If the interval or byte difference is too small, return -1
-    if (dt < 0.0001 || deltaBytes < 1.0)
+    // If not actively downloading, none downloaded or already finished, return -1
+    if (_status != DownloadStatus::ACTIVE || downloaded <= 0 || downloaded >= total)
     {
         return -1.0;
     }
 
-    // Calculate current speed in bytes per second
-    double speedBps = deltaBytes / dt;
+    // If there is not yet enough data for a speed estimate, return -1
+    double speedBps = calcCurrentSpeedBps();
+    if (speedBps < 1.0)
+    {
+        return -1.0;
+    }
 
     // Estimate time remaining based on the speed and bytes left
-    double remaining = total - downloaded;
+    double remaining = static_cast<double>(total - downloaded);
     double secsLeft = remaining / speedBps;
     return secsLeft;
 }
 
 double DownloadTask::calcCurrentSpeedBps() const
 {
-    // Need at least two samples for current speed calculation
-    if (_speedSamples.size() < 2)
+    return _speed.bytesPerSecond(); // Bytes per second
+}
+
+// Counts the request and its outcome; runs ended by a pause or cancel are neither completed nor failed
+// The outcome comes from the run itself, as the manager may already have moved the task on
+void DownloadTask::recordRunMetrics(CURL *curlHandle, CURLcode res, const TransferTimings &timings, bool published)
+{
+    if (!_metrics)
     {
-        return 0.0;
+        return;
     }
 
-    // Calculate the speed using the first and last samples
-    double t0 = static_cast<double>(_speedSamples.front().first);
-    double t1 = static_cast<double>(_speedSamples.back().first);
-    double dl0 = _speedSamples.front().second;
-    double dl1 = _speedSamples.back().second;
+    _metrics->recordRequest(MetricsRequest::GET);
 
-    double dt = t1 - t0;
-    double deltaBytes = dl1 - dl0;
+    if (timings.startTransferUs > 0)
+    {
+        _metrics->observe(MetricsHistogram::FIRST_BYTE, static_cast<double>(timings.startTransferUs) / 1e6);
+    }
 
-    // If data is not valid for a speed calculation, return 0
-    if (dt <= 0.0 || deltaBytes <= 0.0)
+    if (!published)
     {
-        return 0.0;
+        return;
     }
 
-    return deltaBytes / dt; // Bytes per second
-}
\ No newline at end of file
+    if (res == CURLE_OK)
+    {
+        curl_off_t bytes = 0;
+        curl_easy_getinfo(curlHandle, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+
+        double seconds = static_cast<double>(timings.totalUs) / 1e6;
+        _metrics->recordCompleted();
+        _metrics->observe(MetricsHistogram::DURATION, seconds);
+        if (seconds > 0)
+        {
+            _metrics->observe(MetricsHistogram::THROUGHPUT, static_cast<double>(bytes) / seconds);
+        }
+    }
+    else
+    {
+        _metrics->recordFailure(static_cast<int>(res), getHttpStatus());
+    }
+}
@@ -0,0 +1,175 @@
+#include <algorithm>
+
+#include "core/TaskRegistry.hpp"
+
+// Stores a task at the tail of the list for the given status and returns its id
+// Tasks restored from disk keep their id unless it is already taken
+TaskId TaskRegistry::add(std::shared_ptr<DownloadTask> task, DownloadStatus status)
+{
+    TaskId id = task->getId();
+    if (id == 0 || _idToSlot.count(id) != 0)
+    {
+        id = _nextId;
+    }
+    _nextId = std::max(_nextId, id + 1);
+    task->setId(id);
+
+    // Reuse a free slot if there is one, otherwise grow the slab
+    uint32_t slot;
+    if (!_freeSlots.empty())
+    {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+    }
+    else
+    {
+        slot = static_cast<uint32_t>(_slots.size());
+        _slots.emplace_back();
+    }
+
+    _slots[slot].task = std::move(task);
+    _idToSlot.emplace(id, slot);
+    link(slot, static_cast<uint8_t>(status));
+
+    return id;
+}
+
+// Moves a task to the tail of the list for the given status
+bool TaskRegistry::move(TaskId id, DownloadStatus status)
+{
+    auto it = _idToSlot.find(id);
+    if (it == _idToSlot.end())
+        return false;
+
+    unlink(it->second);
+    link(it->second, static_cast<uint8_t>(status));
+    return true;
+}
+
+// Removes a task from its list and releases its slot
+bool TaskRegistry::erase(TaskId id)
+{
+    auto it = _idToSlot.find(id);
+    if (it == _idToSlot.end())
+        return false;
+
+    uint32_t slot = it->second;
+    unlink(slot);
+    _slots[slot].task.reset();
+    _freeSlots.push_back(slot);
+    _idToSlot.erase(it);
+    return true;
+}
+
+std::shared_ptr<DownloadTask> TaskRegistry::find(TaskId id) const
+{
+    auto it = _idToSlot.find(id);
+    return it == _idToSlot.end() ? nullptr : _slots[it->second].task;
+}
+
+// Returns the task only if it is currently in the list for the given status
+std::shared_ptr<DownloadTask> TaskRegistry::find(TaskId id, DownloadStatus status) const
+{
+    auto it = _idToSlot.find(id);
+    if (it == _idToSlot.end() || _slots[it->second].list != static_cast<uint8_t>(status))
+        return nullptr;
+    return _slots[it->second].task;
+}
+
+// Returns when the task entered its current list, as a number that orders the tasks of each list as
+// the list does; 0 if there is no such task
+uint64_t TaskRegistry::getSequence(TaskId id) const
+{
+    auto it = _idToSlot.find(id);
+    return it == _idToSlot.end() ? 0 : _slots[it->second].sequence;
+}
+
+TaskRegistry::ListView TaskRegistry::list(DownloadStatus status) const
+{
+    return ListView(&_slots, &_lists[static_cast<size_t>(status)]);
+}
+
+// Returns an iterator to the task at the given position, or end() if the list is shorter
+// Walks from whichever of the head, the tail or the previous seek is closest, so that
+// successive seeks to nearby positions (e.g. while scrolling) cost only the distance moved
+TaskRegistry::Iterator TaskRegistry::ListView::seek(size_t index) const
+{
+    if (index >= _list->size)
+        return end();
+
+    uint32_t slot = _list->head;
+    size_t position = 0;
+    size_t distance = index;
+
+    if (_list->size - 1 - index < distance)
+    {
+        slot = _list->tail;
+        position = _list->size - 1;
+        distance = position - index;
+    }
+
+    if (_list->cursorSlot != NIL)
+    {
+        size_t cursor = _list->cursorIndex;
+        size_t cursorDistance = cursor > index ? cursor - index : index - cursor;
+        if (cursorDistance < distance)
+        {
+            slot = _list->cursorSlot;
+            position = cursor;
+        }
+    }
+
+    for (; position < index; ++position)
+        slot = (*_slots)[slot].next;
+    for (; position > index; --position)
+        slot = (*_slots)[slot].prev;
+
+    _list->cursorSlot = slot;
+    _list->cursorIndex = index;
+    return Iterator(_slots, slot);
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+void TaskRegistry::link(uint32_t slot, uint8_t list)
+{
+    List &target = _lists[list];
+    Slot &entry = _slots[slot];
+    target.cursorSlot = NIL;
+
+    entry.list = list;
+    entry.sequence = _nextSequence++;
+    entry.prev = target.tail;
+    entry.next = NIL;
+
+    if (target.tail != NIL)
+        _slots[target.tail].next = slot;
+    else
+        target.head = slot;
+
+    target.tail = slot;
+    target.size++;
+}
+
+void TaskRegistry::unlink(uint32_t slot)
+{
+    Slot &entry = _slots[slot];
+    List &source = _lists[entry.list];
+    source.cursorSlot = NIL;
+
+    if (entry.prev != NIL)
+        _slots[entry.prev].next = entry.next;
+    else
+        source.head = entry.next;
+
+    if (entry.next != NIL)
+        _slots[entry.next].prev = entry.prev;
+    else
+        source.tail = entry.prev;
+
+    entry.prev = NIL;
+    entry.next = NIL;
+    source.size--;
+}
@@ -3,8 +3,15 @@
 
 int main(int argc, char* argv[])
 {
-    DownloadApplication app;
-    app.run();
+    ApplicationOptions options;
+    std::string error;
+    if (!DownloadApplication::parseOptions(argc, argv, options, error))
+    {
+        std::cerr << error << "\n";
+        DownloadApplication::printUsage(argv[0]);
+        return 2;
+    }
 
-    return 0;
+    DownloadApplication app(options);
+    return app.run();
 }
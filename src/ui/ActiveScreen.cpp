@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <string>
 #include <vector>
+#include <cstdio>
 
 #include "ui/ActiveScreen.hpp"
 #include "ui/UI.hpp"
@@ -9,7 +10,8 @@
 #include "util/args.hpp"
 
 ActiveScreen::ActiveScreen(DownloadManager &manager, UI &ui)
-    : Screen(manager, ui),
+    : Screen(ui),
+      _manager(manager),
       _commandTable{
           {{"exit", "quit", "q"},
            MatchType::EXACT,
@@ -42,6 +44,18 @@ ActiveScreen::ActiveScreen(DownloadManager &manager, UI &ui)
            {
                parseCancelCommand(command);
            }},
+          {{"export"},
+           MatchType::PREFIX,
+           [this](const std::string &command)
+           {
+               parseExportCommand(command);
+           }},
+          {{"import"},
+           MatchType::PREFIX,
+           [this](const std::string &command)
+           {
+               parseImportCommand(command);
+           }},
           {{"history", "h"},
            MatchType::EXACT,
            [this](const std::string & /*unused*/)
@@ -54,55 +68,54 @@ ActiveScreen::ActiveScreen(DownloadManager &manager, UI &ui)
 void ActiveScreen::drawAvailableCommands(int &currentRow, WINDOW *win)
 {
     mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "download <URL> [file] | Start a new download");
-    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "pause [index]         | Pause a download");
-    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "resume [index]        | Resume a paused download");
-    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "cancel [index]        | Cancel an active download");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "pause [id]            | Pause a download");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "resume [id]           | Resume a paused download");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "cancel [id] [file]    | Cancel a download, or one joined file");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "export <file>         | Save all downloads as text");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "import <file>         | Load downloads from text");
     mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "history               | Show past downloads (%zu|%zu)",
-              _manager.getCompleted().size(), _manager.getFailed().size());
+              _manager.getHistory().countByStatus(static_cast<int>(DownloadStatus::COMPLETED)),
+              _manager.getHistory().countByStatus(static_cast<int>(DownloadStatus::FAILED)));
     mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "exit                  | Quit the program");
 }
 
-void ActiveScreen::drawScreen(int &currentRow, WINDOW *win)
+void ActiveScreen::drawScreen(int &currentRow, Frame &frame)
 {
-    auto &active = _manager.getActive();
-    auto &paused = _manager.getPaused();
-    auto &queued = _manager.getQueued();
-    auto &failed = _manager.getFailed();
+    auto active = _manager.getActive();
+    auto paused = _manager.getPaused();
+    auto queued = _manager.getQueued();
+    size_t failedCount = _manager.getHistory().countByStatus(static_cast<int>(DownloadStatus::FAILED));
 
     // Active downloads
     if (active.empty())
     {
-        mvwprintw(win, currentRow, LEFT_PADDING, "Active Downloads: None");
+        frame.print(currentRow, LEFT_PADDING, "Active Downloads: None");
     }
     else
     {
-        mvwprintw(win, currentRow, LEFT_PADDING, "Active Downloads: %zu", active.size());
-        for (size_t i = 0; i < active.size(); ++i)
-        {
-            drawDownloadProgress(++currentRow, win, i + 1, active[i], true);
-        }
+        char throughput[FORMAT_BYTES_SIZE];
+        formatBytes(throughput, sizeof(throughput), _manager.getThroughputBps());
+        frame.print(currentRow, LEFT_PADDING, "Active Downloads: %zu @ %s/s", active.size(), throughput);
+        drawTaskList(currentRow, frame, active, true);
     }
 
     // Paused downloads
     if (!paused.empty())
     {
-        mvwprintw(win, currentRow += 2, LEFT_PADDING, "Paused Downloads: %zu", paused.size());
-        for (size_t i = 0; i < paused.size(); ++i)
-        {
-            drawDownloadProgress(++currentRow, win, i + 1, paused[i], false);
-        }
+        frame.print(currentRow += 2, LEFT_PADDING, "Paused Downloads: %zu", paused.size());
+        drawTaskList(currentRow, frame, paused, false);
     }
 
     // Queued downloads
     if (!queued.empty())
     {
-        mvwprintw(win, currentRow += 2, LEFT_PADDING, "Queued Downloads: %zu", queued.size());
+        frame.print(currentRow += 2, LEFT_PADDING, "Queued Downloads: %zu", queued.size());
     }
 
     // Failed downloads
-    if (!failed.empty())
+    if (failedCount > 0)
     {
-        mvwprintw(win, currentRow += 2, LEFT_PADDING, "Failed Downloads: %zu", failed.size());
+        frame.print(currentRow += 2, LEFT_PADDING, "Failed Downloads: %zu", failedCount);
     }
 }
 
@@ -116,13 +129,11 @@ void ActiveScreen::parseDownloadCommand(const std::string &command)
     if (args.empty())
         return;
 
-    if (args.size() == 1)
-        // No destination provided
-        _manager.queueDownload(args[0], "");
-    else
-        _manager.queueDownload(args[0], args[1]);
+    // A missing destination is looked up off the UI thread; the task is listed once it is queued
+    _manager.queueDownloadAsync(args[0], args.size() == 1 ? "" : args[1], nullptr);
 }
 
+// An id that is not a number is parsed as 0, which matches no task
 void ActiveScreen::parsePauseCommand(const std::string &command)
 {
     auto args = extractArguments(command, 1);
@@ -130,7 +141,7 @@ void ActiveScreen::parsePauseCommand(const std::string &command)
         // No index provided, pause all
         _manager.pauseAllDownloads();
     else
-        _manager.pauseDownload(std::stoul(args[0]) - 1);
+        _manager.pauseDownload(parseId(args[0]));
 }
 
 void ActiveScreen::parseResumeCommand(const std::string &command)
@@ -140,89 +151,129 @@ void ActiveScreen::parseResumeCommand(const std::string &command)
         // No index provided, resume all
         _manager.resumeAllDownloads();
     else
-        _manager.resumeDownload(std::stoul(args[0]) - 1);
+        _manager.resumeDownload(parseId(args[0]));
 }
 
 void ActiveScreen::parseCancelCommand(const std::string &command)
 {
-    auto args = extractArguments(command, 1);
+    auto args = extractArguments(command, 2);
     if (args.empty())
         // No index provided, cancel all
         _manager.cancelAllDownloads();
+    else if (args.size() == 1)
+        _manager.cancelDownload(parseId(args[0]));
     else
-        _manager.cancelDownload(std::stoul(args[0]) - 1);
+        // Withdraw the request that joined with this file
+        _manager.withdrawDestination(parseId(args[0]), args[1]);
+}
+
+void ActiveScreen::parseExportCommand(const std::string &command)
+{
+    auto args = extractArguments(command, 1);
+    if (!args.empty())
+        _manager.exportState(args[0]);
+}
+
+void ActiveScreen::parseImportCommand(const std::string &command)
+{
+    auto args = extractArguments(command, 1);
+    if (!args.empty())
+        _manager.importState(args[0]);
+}
+
+// Lays out a list of tasks below its heading at currentRow, drawing only the tasks inside the viewport
+// Each task takes TASK_ROWS rows, so the visible range is found without visiting the others
+void ActiveScreen::drawTaskList(int &currentRow,
+                                Frame &frame,
+                                const TaskRegistry::ListView &tasks,
+                                bool isActive)
+{
+    int listStart = currentRow + 1;
+    int listEnd = listStart + static_cast<int>(tasks.size()) * TASK_ROWS;
+    int visibleStart = std::max(frame.getFirstRow(), listStart);
+    int visibleEnd = std::min(frame.getFirstRow() + frame.getRowCount(), listEnd);
+
+    if (visibleStart < visibleEnd)
+    {
+        size_t first = static_cast<size_t>((visibleStart - listStart) / TASK_ROWS);
+        int row = listStart + static_cast<int>(first) * TASK_ROWS;
+
+        for (auto it = tasks.seek(first); it != tasks.end() && row < visibleEnd; ++it)
+        {
+            drawDownloadProgress(row, frame, *it, isActive);
+            row++; // Gap between tasks
+        }
+    }
+
+    currentRow = listEnd - 1;
+    frame.extendTo(currentRow);
 }
 
 void ActiveScreen::drawDownloadProgress(int &currentRow,
-                                        WINDOW *win,
-                                        size_t index,
+                                        Frame &frame,
                                         const std::shared_ptr<DownloadTask> &task,
                                         bool isActive)
 {
-    // <index>) <url> -> <destination>
-    mvwprintw(win, currentRow++, LEFT_PADDING + 1,
-              "%zu) %s -> %s",
-              index,
-              task->getUrl().c_str(),
-              task->getDestination().c_str());
+    // <id>) <url> -> <destination>
+    frame.print(currentRow++, LEFT_PADDING + 1,
+                "%llu) %s -> %s",
+                static_cast<unsigned long long>(task->getId()),
+                task->getUrl().c_str(),
+                task->getDestination().c_str());
 
     // Prepare progress bar
     double progress = task->getProgress();
-    double bytesDownloaded = task->getBytesDownloaded();
-    double totalBytes = task->getTotalBytes();
-    int filled = 0;
+    int64_t bytesDownloaded = task->getBytesDownloaded();
+    int64_t totalBytes = task->getTotalBytes();
 
-    if (totalBytes > 0.1)
+    bool isRunning = isActive && !task->isWaitingToRetry();
+    char bar[BAR_WIDTH + 1];
+    formatProgressBar(bar, sizeof(bar), bytesDownloaded, totalBytes, isRunning);
+
+    // Size and speed are formatted into stack buffers so that drawing a row does not allocate
+    char sizeInfo[2 * FORMAT_BYTES_SIZE + 8] = " (size unknown)";
+    if (bytesDownloaded > 0)
     {
-        filled = static_cast<int>((bytesDownloaded / totalBytes) * BAR_WIDTH);
-        filled = std::min(filled, BAR_WIDTH);
+        char current[FORMAT_BYTES_SIZE], total[FORMAT_BYTES_SIZE];
+        formatBytes(current, sizeof(current), static_cast<double>(bytesDownloaded));
+        formatBytes(total, sizeof(total), static_cast<double>(totalBytes));
+        std::snprintf(sizeInfo, sizeof(sizeInfo), " (%s / %s)", current, total);
     }
 
-    // [=======>   ] <progress>% (<currentBytes> MB / <totalBytes> MB) ETA: <time remaining> @ <speed>/s
-    mvwaddstr(win, currentRow, 0, std::string(LEFT_PADDING, ' ').c_str());
-    waddch(win, '[');
-    for (int j = 0; j < BAR_WIDTH; ++j)
+    if (!isActive)
     {
-        if (j < filled)
-            waddch(win, '=');
-        else if (j == filled)
-            waddch(win, isActive ? '>' : '|'); 
-        else
-            waddch(win, ' ');
+        // [=======|   ] <progress>% (<currentBytes> MB / <totalBytes> MB)
+        frame.print(currentRow, LEFT_PADDING, "[%s] %.1f%%%s", bar, progress, sizeInfo);
     }
-    waddch(win, ']');
-
-    // Print percentage progress
-    wprintw(win, " %.1f%%", progress);
-
-    // Print size info
-    if (bytesDownloaded <= 0.0)
+    else if (!isRunning)
     {
-        wprintw(win, " (size unknown)");
+        // [=======|   ] <progress>% (<currentBytes> MB / <totalBytes> MB) retry <n> in <seconds>s: <error>
+        auto wait = std::chrono::duration_cast<std::chrono::seconds>(task->getRetryAt() - std::chrono::steady_clock::now());
+        char error[64];
+        if (task->getHttpStatus() >= 400)
+            std::snprintf(error, sizeof(error), "HTTP %d", task->getHttpStatus());
+        else
+            std::snprintf(error, sizeof(error), "%s", curl_easy_strerror(task->getErrorCode()));
+
+        frame.print(currentRow, LEFT_PADDING, "[%s] %.1f%%%s retry %d in %llds: %s",
+                    bar, progress, sizeInfo, task->getRetries(), static_cast<long long>(wait.count()) + 1, error);
     }
     else
     {
-        std::string currentStr = formatBytes(bytesDownloaded);
-        std::string totalStr = formatBytes(totalBytes);
-        wprintw(win, " (%s / %s)", currentStr.c_str(), totalStr.c_str());
-    }
+        // [=======>   ] <progress>% (<currentBytes> MB / <totalBytes> MB) ETA: <time remaining> @ <speed>/s
+        char speed[FORMAT_BYTES_SIZE];
+        formatBytes(speed, sizeof(speed), task->calcCurrentSpeedBps());
 
-    // If active, show ETA and speed
-    if (isActive)
-    {
         double eta = task->calcEstimatedTimeRemaining();
-        std::string speed = formatBytes(task->calcCurrentSpeedBps());
-
         if (eta > 0.0)
         {
             int sec = static_cast<int>(eta);
-            int min = sec / 60;
-            int seconds = sec % 60;
-            wprintw(win, " ETA: %dm %ds @ %s/s", min, seconds, speed.c_str());
+            frame.print(currentRow, LEFT_PADDING, "[%s] %.1f%%%s ETA: %dm %ds @ %s/s",
+                        bar, progress, sizeInfo, sec / 60, sec % 60, speed);
         }
         else
-            wprintw(win, " ETA: -- @ %s/s", speed.c_str());
+            frame.print(currentRow, LEFT_PADDING, "[%s] %.1f%%%s ETA: -- @ %s/s", bar, progress, sizeInfo, speed);
     }
 
     currentRow++;
-}
\ No newline at end of file
+}
@@ -0,0 +1,58 @@
+#include <cstdarg>
+#include <cstdio>
+
+#include "ui/Frame.hpp"
+
+// Empties the frame and sets the range of rows that will be kept
+void Frame::reset(int firstRow, int rowCount)
+{
+    _firstRow = firstRow;
+    _height = 0;
+
+    _rows.resize(static_cast<size_t>(rowCount > 0 ? rowCount : 0));
+    for (auto &row : _rows)
+        row.clear();
+}
+
+// Records that the layout reaches the given row without drawing anything
+void Frame::extendTo(int row)
+{
+    if (row >= _height)
+        _height = row + 1;
+}
+
+// Formats text into the given row starting at the given column, padding with spaces as needed
+// Rows outside the viewport are only counted
+void Frame::print(int row, int col, const char *format, ...)
+{
+    extendTo(row);
+    if (!isVisible(row) || col < 0)
+        return;
+
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int length = std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length < 0)
+        return;
+
+    std::string &text = _rows[row - _firstRow];
+    size_t start = static_cast<size_t>(col);
+    if (text.size() < start)
+        text.resize(start, ' ');
+
+    if (static_cast<size_t>(length) < sizeof(buffer))
+    {
+        text.replace(start, std::string::npos, buffer, static_cast<size_t>(length));
+        return;
+    }
+
+    // Longer than the stack buffer (e.g. a very long URL); format again into the row itself
+    text.resize(start + static_cast<size_t>(length) + 1);
+    va_start(args, format);
+    std::vsnprintf(&text[start], static_cast<size_t>(length) + 1, format, args);
+    va_end(args);
+    text.pop_back(); // Terminator written by vsnprintf
+}
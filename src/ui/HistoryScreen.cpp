@@ -1,5 +1,9 @@
 #include <curses.h>
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -9,7 +13,8 @@
 #include "util/args.hpp"
 
 HistoryScreen::HistoryScreen(DownloadManager &manager, UI &ui)
-    : Screen(manager, ui),
+    : Screen(ui),
+      _manager(manager),
       _commandTable{
           {{"retry", "r"},
            MatchType::PREFIX,
@@ -18,6 +23,30 @@ HistoryScreen::HistoryScreen(DownloadManager &manager, UI &ui)
                parseRetryCommand(command);
                _ui.changeScreen(ScreenType::ACTIVE);
            }},
+          {{"filter", "f"},
+           MatchType::PREFIX,
+           [this](const std::string &command)
+           {
+               parseFilterCommand(command);
+           }},
+          {{"next", "n"},
+           MatchType::EXACT,
+           [this](const std::string & /*unused*/)
+           {
+               changePage(1);
+           }},
+          {{"prev", "p"},
+           MatchType::EXACT,
+           [this](const std::string & /*unused*/)
+           {
+               changePage(-1);
+           }},
+          {{"hosts", "h"},
+           MatchType::EXACT,
+           [this](const std::string & /*unused*/)
+           {
+               _showHosts = !_showHosts;
+           }},
           {{"clear", "c"},
            MatchType::PREFIX,
            [this](const std::string & /*command*/)
@@ -35,57 +64,87 @@ HistoryScreen::HistoryScreen(DownloadManager &manager, UI &ui)
 
 void HistoryScreen::drawAvailableCommands(int &currentRow, WINDOW *win)
 {
-    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "retry [index] | Retry a failed download");
-    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "clear         | Clear download history");
-    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "back          | Return to active downloads (%zu|%zu|%zu)",
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "retry [index]  | Retry a failed download");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "filter [terms] | Filter by completed|failed host=<h> dest=<f> since=<min>");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "next | prev    | Show the next or previous page");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "hosts          | Toggle request timings per host");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "clear          | Clear download history");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "back           | Return to active downloads (%zu|%zu|%zu)",
               _manager.getActive().size(), _manager.getQueued().size(), _manager.getPaused().size());
 }
 
-void HistoryScreen::drawScreen(int &currentRow, WINDOW *win)
+void HistoryScreen::drawScreen(int &currentRow, Frame &frame)
 {
-    auto &completed = _manager.getCompleted();
-    auto &failed = _manager.getFailed();
+    const HistoryStore &history = _manager.getHistory();
+    size_t completedCount = history.countByStatus(static_cast<int>(DownloadStatus::COMPLETED));
+    size_t failedCount = history.countByStatus(static_cast<int>(DownloadStatus::FAILED));
+
+    refreshPage();
 
-    // Completed downloads
-    if (completed.empty())
+    frame.print(currentRow, LEFT_PADDING, "History: %zu completed, %zu failed", completedCount, failedCount);
+    if (!_filterDescription.empty())
     {
-        mvwprintw(win, currentRow, LEFT_PADDING, "Completed downloads: None");
+        frame.print(++currentRow, LEFT_PADDING, "Filter: %s", _filterDescription.c_str());
     }
-    else
+
+    if (_showHosts)
     {
-        mvwprintw(win, currentRow, LEFT_PADDING, "Completed Downloads: %zu", completed.size());
-        for (size_t i = 0; i < completed.size(); ++i)
-        {
-            auto task = completed[i];
-            // <index>) <time> - <url>
-            mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "%zu) %s - %s",
-                      i + 1,
-                      formatTime(task->getEndedAt()).c_str(),
-                      task->getUrl().c_str());
-            // Saved to <destination> (<size>)
-            mvwprintw(win, ++currentRow, LEFT_PADDING + 3, "Saved to %s (%s)",
-                      task->getDestination().c_str(),
-                      formatBytes(task->getBytesDownloaded()).c_str());
-        }
+        drawHostSummaries(currentRow, frame);
+        return;
     }
 
-    // Failed downloads
-    if (!failed.empty())
+    if (_pageEntries.empty())
     {
-        mvwprintw(win, currentRow += 2, LEFT_PADDING, "Failed Downloads: %zu", failed.size());
-        for (size_t i = 0; i < failed.size(); ++i)
+        frame.print(currentRow += 2, LEFT_PADDING, "No matching downloads");
+        return;
+    }
+
+    size_t first = _page * HISTORY_PAGE_SIZE;
+    size_t pageCount = (_matchCount + HISTORY_PAGE_SIZE - 1) / HISTORY_PAGE_SIZE;
+    frame.print(currentRow += 2, LEFT_PADDING, "Showing %zu-%zu of %zu (page %zu/%zu)",
+                first + 1, first + _pageEntries.size(), _matchCount, _page + 1, pageCount);
+
+    for (const auto &entry : _pageEntries)
+    {
+        const TaskRecord &record = entry.record;
+
+        // Each entry takes two rows, plus one for its timings; skip formatting entries outside the viewport
+        int rows = record.timings.isEmpty() && record.headTimings.isEmpty() ? 2 : 3;
+        if (!frame.isVisible(currentRow + 1) && !frame.isVisible(currentRow + rows))
+        {
+            frame.extendTo(currentRow += rows);
+            continue;
+        }
+
+        // <index>) <time> - <url>
+        char endedAt[FORMAT_TIME_SIZE];
+        formatTime(endedAt, sizeof(endedAt), record.endedAt);
+        frame.print(++currentRow, LEFT_PADDING + 2, "%llu) %s - %s",
+                    static_cast<unsigned long long>(entry.id + 1),
+                    endedAt,
+                    record.url.c_str());
+
+        if (record.status == static_cast<int>(DownloadStatus::COMPLETED))
+        {
+            // Saved to <destination> (<size>)
+            char size[FORMAT_BYTES_SIZE];
+            formatBytes(size, sizeof(size), record.bytesDownloaded);
+            frame.print(++currentRow, LEFT_PADDING + 3, "Saved to %s (%s)",
+                        record.destination.c_str(),
+                        size);
+        }
+        else
         {
-            auto task = failed[i];
-            // <index>) <time> - <url>
-            mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "%zu) %s - %s",
-                      i + 1,
-                      formatTime(task->getEndedAt()).c_str(),
-                      task->getUrl().c_str());
             // E-<curl code>-<http code>: <message>
-            mvwprintw(win, ++currentRow, LEFT_PADDING + 3, "E-%02d-%03d: %s",
-                      task->getErrorCode(),
-                      task->getHttpStatus(),
-                      task->getErrorMessage().c_str());
+            frame.print(++currentRow, LEFT_PADDING + 3, "E-%02d-%03d: %s",
+                        record.errorCode,
+                        record.httpStatus,
+                        curl_easy_strerror(static_cast<CURLcode>(record.errorCode)));
+        }
+
+        if (rows == 3)
+        {
+            drawTimings(currentRow, frame, record);
         }
     }
 }
@@ -104,6 +163,154 @@ void HistoryScreen::parseRetryCommand(const std::string &command)
     }
     else
     {
-        _manager.retryDownload(std::stoul(args[0]) - 1);
+        // Indices start at 1; one that is not a number is ignored
+        uint64_t index = parseId(args[0]);
+        if (index > 0)
+            _manager.retryDownload(index - 1);
     }
-}
\ No newline at end of file
+}
+
+// Replaces the current filter with the given terms; no terms clears the filter
+void HistoryScreen::parseFilterCommand(const std::string &command)
+{
+    HistoryQuery query;
+    std::string description;
+
+    for (const auto &term : extractArguments(command, 4))
+    {
+        if (term == "completed")
+            query.status = static_cast<int>(DownloadStatus::COMPLETED);
+        else if (term == "failed")
+            query.status = static_cast<int>(DownloadStatus::FAILED);
+        else if (term.rfind("host=", 0) == 0)
+            query.host = term.substr(5);
+        else if (term.rfind("dest=", 0) == 0)
+            query.destination = term.substr(5);
+        else if (term.rfind("since=", 0) == 0)
+        {
+            // A count of minutes; anything else is ignored like an unrecognised term
+            char *end = nullptr;
+            errno = 0;
+            long minutes = std::strtol(term.c_str() + 6, &end, 10);
+            if (term.size() == 6 || *end != '\0' || errno == ERANGE || minutes < 0)
+                continue;
+            query.since = std::time(nullptr) - static_cast<time_t>(minutes) * 60;
+        }
+        else
+            continue; // Ignore unrecognised terms
+
+        description += (description.empty() ? "" : " ") + term;
+    }
+
+    _query = query;
+    _filterDescription = description;
+    _page = 0;
+    _cachedRevision = UINT64_MAX; // Force a reload
+    _hostsRevision = UINT64_MAX;
+}
+
+void HistoryScreen::changePage(int delta)
+{
+    size_t pageCount = (_matchCount + HISTORY_PAGE_SIZE - 1) / HISTORY_PAGE_SIZE;
+    if (delta < 0 && _page > 0)
+        _page--;
+    else if (delta > 0 && _page + 1 < pageCount)
+        _page++;
+
+    _cachedRevision = UINT64_MAX;
+}
+
+// Reads the current page from the history store if it may have changed
+void HistoryScreen::refreshPage()
+{
+    const HistoryStore &history = _manager.getHistory();
+    if (history.getRevision() == _cachedRevision)
+        return;
+
+    _matchCount = history.count(_query);
+
+    // Clamp to the last page if entries were removed
+    size_t pageCount = (_matchCount + HISTORY_PAGE_SIZE - 1) / HISTORY_PAGE_SIZE;
+    if (_page >= pageCount)
+        _page = pageCount > 0 ? pageCount - 1 : 0;
+
+    _pageEntries = history.query(_query, _page * HISTORY_PAGE_SIZE, HISTORY_PAGE_SIZE);
+    _cachedRevision = history.getRevision();
+}
+
+// DNS <t> | connect <t> | TLS <t> | wait <t> | transfer <t> [| <n> redirects] [| HEAD <t>]
+void HistoryScreen::drawTimings(int &currentRow, Frame &frame, const TaskRecord &record)
+{
+    const TransferTimings &timings = record.timings;
+    char lookup[FORMAT_DURATION_SIZE], connect[FORMAT_DURATION_SIZE], tls[FORMAT_DURATION_SIZE];
+    char wait[FORMAT_DURATION_SIZE], transfer[FORMAT_DURATION_SIZE], head[FORMAT_DURATION_SIZE];
+    formatDuration(lookup, sizeof(lookup), timings.lookupPhaseUs());
+    formatDuration(connect, sizeof(connect), timings.connectPhaseUs());
+    formatDuration(tls, sizeof(tls), timings.tlsPhaseUs());
+    formatDuration(wait, sizeof(wait), timings.waitPhaseUs());
+    formatDuration(transfer, sizeof(transfer), timings.transferPhaseUs());
+    formatDuration(head, sizeof(head), record.headTimings.totalUs);
+
+    char redirects[32] = "";
+    if (timings.redirects > 0)
+    {
+        snprintf(redirects, sizeof(redirects), " | %d redirect%s", timings.redirects, timings.redirects == 1 ? "" : "s");
+    }
+
+    frame.print(++currentRow, LEFT_PADDING + 3, "DNS %s | connect %s | TLS %s | wait %s | transfer %s%s%s%s",
+                lookup, connect, tls, wait, transfer, redirects,
+                record.headTimings.isEmpty() ? "" : " | HEAD ",
+                record.headTimings.isEmpty() ? "" : head);
+}
+
+// Lists the average request phase times of each host in the current filter
+void HistoryScreen::drawHostSummaries(int &currentRow, Frame &frame)
+{
+    const HistoryStore &history = _manager.getHistory();
+    if (history.getRevision() != _hostsRevision)
+    {
+        _hostSummaries = history.summarizeHosts(_query);
+        _hostsRevision = history.getRevision();
+    }
+
+    if (_hostSummaries.empty())
+    {
+        frame.print(currentRow += 2, LEFT_PADDING, "No matching downloads");
+        return;
+    }
+
+    frame.print(currentRow += 2, LEFT_PADDING, "Average request timings of %zu hosts", _hostSummaries.size());
+    frame.print(currentRow += 2, LEFT_PADDING + 2, "%-30s %5s %5s %9s %9s %9s %9s %9s %12s",
+                "Host", "Files", "Reqs", "DNS", "Connect", "TLS", "Wait", "Transfer", "Throughput");
+
+    for (const auto &summary : _hostSummaries)
+    {
+        if (!frame.isVisible(currentRow + 1))
+        {
+            frame.extendTo(++currentRow);
+            continue;
+        }
+
+        int64_t requests = std::max<int64_t>(static_cast<int64_t>(summary.requests), 1);
+        int64_t completed = std::max<int64_t>(static_cast<int64_t>(summary.completedWithTimings), 1);
+
+        char lookup[FORMAT_DURATION_SIZE], connect[FORMAT_DURATION_SIZE], tls[FORMAT_DURATION_SIZE];
+        char wait[FORMAT_DURATION_SIZE], transfer[FORMAT_DURATION_SIZE];
+        formatDuration(lookup, sizeof(lookup), summary.lookupUs / requests);
+        formatDuration(connect, sizeof(connect), summary.connectUs / requests);
+        formatDuration(tls, sizeof(tls), summary.tlsUs / requests);
+        formatDuration(wait, sizeof(wait), summary.waitUs / requests);
+        formatDuration(transfer, sizeof(transfer), summary.transferUs / completed);
+
+        char throughput[FORMAT_BYTES_SIZE + 2] = "-";
+        if (summary.transferUs > 0)
+        {
+            size_t length = formatBytes(throughput, FORMAT_BYTES_SIZE, summary.transferBytes * 1e6 / static_cast<double>(summary.transferUs));
+            std::memcpy(throughput + length, "/s", 3);
+        }
+
+        frame.print(++currentRow, LEFT_PADDING + 2, "%-30.30s %5zu %5zu %9s %9s %9s %9s %9s %12s",
+                    summary.host.empty() ? "(none)" : summary.host.c_str(),
+                    summary.downloads, summary.requests, lookup, connect, tls, wait, transfer, throughput);
+    }
+}
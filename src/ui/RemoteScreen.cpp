@@ -0,0 +1,244 @@
+#include <curses.h>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "ui/RemoteScreen.hpp"
+#include "ui/UI.hpp"
+#include "util/format.hpp"
+#include "util/args.hpp"
+
+RemoteScreen::RemoteScreen(ControlClient &commands, ControlClient &status, UI &ui)
+    : Screen(ui),
+      _commands(commands),
+      _status(status),
+      _commandTable{
+          {{"exit", "quit", "q"},
+           MatchType::EXACT,
+           [this](const std::string & /*unused*/)
+           {
+               _ui.stop(); // The daemon keeps running its downloads
+           }},
+          {{"download", "d"},
+           MatchType::PREFIX,
+           [this](const std::string &command)
+           {
+               sendCommand("queue", extractArguments(command, 2));
+           }},
+          {{"pause", "p"},
+           MatchType::PREFIX,
+           [this](const std::string &command)
+           {
+               sendCommand("pause", extractArguments(command, 1));
+           }},
+          {{"resume", "r"},
+           MatchType::PREFIX,
+           [this](const std::string &command)
+           {
+               sendCommand("resume", extractArguments(command, 1));
+           }},
+          {{"cancel", "c"},
+           MatchType::PREFIX,
+           [this](const std::string &command)
+           {
+               sendCommand("cancel", extractArguments(command, 2));
+           }},
+          {{"concurrency"},
+           MatchType::PREFIX,
+           [this](const std::string &command)
+           {
+               sendCommand("concurrency", extractArguments(command, 1));
+           }}}
+{
+}
+
+// Requests the daemon's task list once per render interval, unless the previous request is unanswered
+void RemoteScreen::refresh()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (_statusOutstanding || now - _lastStatusTime < RENDER_INTERVAL)
+        return;
+
+    _statusOutstanding = _status.send("status", [this](bool ok, const std::vector<std::string> &lines)
+                                      {
+                                          _statusOutstanding = false;
+                                          if (ok)
+                                              parseStatus(lines); });
+    _lastStatusTime = now;
+}
+
+void RemoteScreen::drawAvailableCommands(int &currentRow, WINDOW *win)
+{
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "download <URL> [file] | Start a new download");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "pause [id]            | Pause a download");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "resume [id]           | Resume a paused download");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "cancel [id] [file]    | Cancel a download, or one joined file");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "concurrency [n]       | Show or change the number of threads");
+    mvwprintw(win, ++currentRow, LEFT_PADDING + 2, "exit                  | Quit, leaving the daemon running");
+}
+
+void RemoteScreen::drawScreen(int &currentRow, Frame &frame)
+{
+    frame.print(currentRow, LEFT_PADDING, "Connected to the download daemon");
+    if (!_message.empty())
+    {
+        frame.print(++currentRow, LEFT_PADDING, "%s", _message.c_str());
+    }
+
+    // Active downloads
+    if (_active.empty())
+    {
+        frame.print(currentRow += 2, LEFT_PADDING, "Active Downloads: None");
+    }
+    else
+    {
+        int64_t speed = 0;
+        for (const auto &task : _active)
+            speed += task.speedBps;
+
+        char throughput[FORMAT_BYTES_SIZE];
+        formatBytes(throughput, sizeof(throughput), static_cast<double>(speed));
+        frame.print(currentRow += 2, LEFT_PADDING, "Active Downloads: %zu @ %s/s", _active.size(), throughput);
+        drawTaskList(currentRow, frame, _active, true);
+    }
+
+    // Paused downloads
+    if (!_paused.empty())
+    {
+        frame.print(currentRow += 2, LEFT_PADDING, "Paused Downloads: %zu", _paused.size());
+        drawTaskList(currentRow, frame, _paused, false);
+    }
+
+    // Queued downloads
+    if (_queuedCount > 0)
+    {
+        frame.print(currentRow += 2, LEFT_PADDING, "Queued Downloads: %zu", _queuedCount);
+    }
+}
+
+// ------------------------------------------------------------------------------
+// Private methods
+// ------------------------------------------------------------------------------
+
+// Sends a command with its arguments quoted as typed, then asks for the task list to show its effect
+// Errors, and the thread count reported by concurrency, are shown above the task list
+void RemoteScreen::sendCommand(const std::string &command, const std::vector<std::string> &args)
+{
+    std::string request = command;
+    for (const auto &argument : args)
+        request += " " + quoteArgument(argument);
+
+    _commands.send(request, [this, command](bool ok, const std::vector<std::string> &lines)
+                   {
+                       if (!ok)
+                           _message = "Error: " + (lines.empty() ? std::string() : lines.front());
+                       else if (command == "concurrency" && !lines.empty())
+                           _message = "Concurrency: " + lines.front();
+                       else
+                           _message.clear();
+                       _lastStatusTime = std::chrono::steady_clock::time_point(); });
+}
+
+// Replaces the task list with the lines of a status reply:
+// <id> <status> <bytes> <total bytes> <bytes/s> "<url>" "<file>" ["<joined file>"...]
+void RemoteScreen::parseStatus(const std::vector<std::string> &lines)
+{
+    _active.clear();
+    _paused.clear();
+    _queuedCount = 0;
+
+    for (const auto &line : lines)
+    {
+        std::istringstream iss(line);
+        RemoteTask task;
+        if (!(iss >> task.id >> task.status >> task.bytesDownloaded >> task.totalBytes >> task.speedBps >>
+              std::quoted(task.url) >> std::quoted(task.destination)))
+            continue; // Not a task line; skip it rather than show garbage
+
+        if (task.status == "active" || task.status == "retrying")
+            _active.push_back(std::move(task));
+        else if (task.status == "paused")
+            _paused.push_back(std::move(task));
+        else
+            _queuedCount++;
+    }
+}
+
+// Lays out a list of tasks below its heading, drawing only the tasks inside the viewport
+void RemoteScreen::drawTaskList(int &currentRow, Frame &frame, const std::vector<RemoteTask> &tasks, bool isActive)
+{
+    int listStart = currentRow + 1;
+    int listEnd = listStart + static_cast<int>(tasks.size()) * TASK_ROWS;
+    int visibleStart = std::max(frame.getFirstRow(), listStart);
+    int visibleEnd = std::min(frame.getFirstRow() + frame.getRowCount(), listEnd);
+
+    if (visibleStart < visibleEnd)
+    {
+        size_t first = static_cast<size_t>((visibleStart - listStart) / TASK_ROWS);
+        int row = listStart + static_cast<int>(first) * TASK_ROWS;
+
+        for (size_t i = first; i < tasks.size() && row < visibleEnd; ++i)
+        {
+            drawDownloadProgress(row, frame, tasks[i], isActive);
+            row++; // Gap between tasks
+        }
+    }
+
+    currentRow = listEnd - 1;
+    frame.extendTo(currentRow);
+}
+
+void RemoteScreen::drawDownloadProgress(int &currentRow, Frame &frame, const RemoteTask &task, bool isActive)
+{
+    // <id>) <url> -> <destination>
+    frame.print(currentRow++, LEFT_PADDING + 1,
+                "%llu) %s -> %s",
+                static_cast<unsigned long long>(task.id),
+                task.url.c_str(),
+                task.destination.c_str());
+
+    double progress = task.totalBytes > 0 ? 100.0 * static_cast<double>(task.bytesDownloaded) / static_cast<double>(task.totalBytes) : 0.0;
+    bool isRunning = isActive && task.status == "active";
+    char bar[BAR_WIDTH + 1];
+    formatProgressBar(bar, sizeof(bar), task.bytesDownloaded, task.totalBytes, isRunning);
+
+    char sizeInfo[2 * FORMAT_BYTES_SIZE + 8] = " (size unknown)";
+    if (task.bytesDownloaded > 0)
+    {
+        char current[FORMAT_BYTES_SIZE], total[FORMAT_BYTES_SIZE];
+        formatBytes(current, sizeof(current), static_cast<double>(task.bytesDownloaded));
+        formatBytes(total, sizeof(total), static_cast<double>(task.totalBytes));
+        std::snprintf(sizeInfo, sizeof(sizeInfo), " (%s / %s)", current, total);
+    }
+
+    if (!isActive)
+    {
+        // [=======|   ] <progress>% (<currentBytes> MB / <totalBytes> MB)
+        frame.print(currentRow, LEFT_PADDING, "[%s] %.1f%%%s", bar, progress, sizeInfo);
+    }
+    else if (!isRunning)
+    {
+        // The status reply does not say when the retry is due or why the run failed
+        frame.print(currentRow, LEFT_PADDING, "[%s] %.1f%%%s waiting to retry", bar, progress, sizeInfo);
+    }
+    else
+    {
+        // [=======>   ] <progress>% (<currentBytes> MB / <totalBytes> MB) ETA: <time remaining> @ <speed>/s
+        char speed[FORMAT_BYTES_SIZE];
+        formatBytes(speed, sizeof(speed), static_cast<double>(task.speedBps));
+
+        if (task.speedBps > 0 && task.totalBytes > task.bytesDownloaded)
+        {
+            int sec = static_cast<int>((task.totalBytes - task.bytesDownloaded) / task.speedBps);
+            frame.print(currentRow, LEFT_PADDING, "[%s] %.1f%%%s ETA: %dm %ds @ %s/s",
+                        bar, progress, sizeInfo, sec / 60, sec % 60, speed);
+        }
+        else
+            frame.print(currentRow, LEFT_PADDING, "[%s] %.1f%%%s ETA: -- @ %s/s", bar, progress, sizeInfo, speed);
+    }
+
+    currentRow++;
+}
@@ -1,6 +1,8 @@
 #include <curses.h>
+#include <poll.h>
+#include <unistd.h>
 #include <chrono>
-#include <thread>
+#include <climits>
 #include <algorithm>
 #include <cctype>
 #include <sstream>
@@ -9,14 +11,25 @@
 #include "ui/UI.hpp"
 #include "ui/ActiveScreen.hpp"
 #include "ui/HistoryScreen.hpp"
+#include "ui/RemoteScreen.hpp"
 #include "util/format.hpp"
 
 // Constructs the UI object, setting up the command dispatch table and the active screen
 UI::UI(DownloadManager &manager)
-    : _manager(manager),
+    : _manager(&manager),
       _isRunning(true),
       _lastFullUpdateTime(std::chrono::steady_clock::now()),
-      _screen(std::make_unique<ActiveScreen>(_manager, *this))
+      _screen(std::make_unique<ActiveScreen>(manager, *this))
+{
+}
+
+// Constructs a UI for the downloads of a running daemon, which has a single screen
+UI::UI(ControlClient &commands, ControlClient &status)
+    : _commands(&commands),
+      _status(&status),
+      _isRunning(true),
+      _lastFullUpdateTime(std::chrono::steady_clock::now()),
+      _screen(std::make_unique<RemoteScreen>(commands, status, *this))
 {
 }
 
@@ -29,9 +42,9 @@ void UI::run()
 
     while (_isRunning)
     {
+        bool signalled = waitForActivity();
         processInput();
-        updateScreen();
-        sleepBriefly(10); // 10ms sleep between render
+        updateScreen(signalled); // Show finished downloads without waiting for the next tick
     }
 
     destroyWindows();
@@ -47,13 +60,16 @@ void UI::stop()
 // Changes the current screen to the specified type
 void UI::changeScreen(ScreenType newScreen)
 {
+    if (!_manager)
+        return; // The daemon's downloads are shown on one screen
+
     switch (newScreen)
     {
     case ScreenType::ACTIVE:
-        _screen = std::make_unique<ActiveScreen>(_manager, *this);
+        _screen = std::make_unique<ActiveScreen>(*_manager, *this);
         break;
     case ScreenType::HISTORY:
-        _screen = std::make_unique<HistoryScreen>(_manager, *this);
+        _screen = std::make_unique<HistoryScreen>(*_manager, *this);
         break;
     }
 
@@ -93,8 +109,8 @@ void UI::createWindows()
     _cmdLineWin = newwin(_cmdLineHeight, maxX, maxY - _cmdLineHeight, 0); // Create command line window
 
     _padWidth = maxX;
-    _padHeight = 1000;
-    _bodyPad = newpad(_padHeight, _padWidth); // Create a pad for the screen body
+    _padRows = std::max(maxY, 1);
+    _bodyPad = newpad(_padRows, _padWidth); // Create a pad for the visible part of the screen body
 
     // Disable scrolling
     scrollok(_headerWin, FALSE);
@@ -205,16 +221,17 @@ void UI::handleCommand(const std::string &userInput)
     updateScreen(true);
 }
 
-// Periodically updates the screen (full or partial) based on elapsed time
+// Updates the manager, then redraws the screen (full or partial) based on elapsed time
 void UI::updateScreen(bool immediate)
 {
-    auto now = std::chrono::steady_clock::now();
-    double secondsSinceLastFullUpdate = std::chrono::duration<double>(now - _lastFullUpdateTime).count();
+    if (_manager)
+        _manager->update(); // Cheap when nothing has changed; also hands due snapshots to the persister
+    _screen->refresh();
 
-    // Redraw the entire interface every half second or immediately, if specified
-    if (immediate || secondsSinceLastFullUpdate >= 0.5)
+    // Redraw the entire interface once per render interval or immediately, if specified
+    auto now = std::chrono::steady_clock::now();
+    if (immediate || now - _lastFullUpdateTime >= RENDER_INTERVAL)
     {
-        _manager.update();
         drawFullScreen();
         _lastFullUpdateTime = now;
     }
@@ -244,12 +261,18 @@ void UI::drawFullScreen()
     wresize(_cmdLineWin, _cmdLineHeight, maxX);   // Resize the command line window
     wrefresh(_cmdLineWin);                        // Refresh the command line window
 
+    int visibleRows = std::max(_maxContentHeight + 1, 1);
+    if (maxX != _padWidth || visibleRows != _padRows)
+    {
+        resizePad(visibleRows, maxX); // Terminal or header size changed
+    }
+
     drawBody();
     drawCommandLine();
 
     prefresh(
         _bodyPad,
-        _scrollOffset,                     // Pad row to start reading
+        0,                                 // Pad row to start reading (the pad starts at the scroll offset)
         0,                                 // Pad col to start reading
         _headerHeight,                     // Top alignment of the pad (below the header, with gap)
         0,                                 // Left alignment of the pad
@@ -273,13 +296,50 @@ void UI::drawHeader()
     _headerHeight = currentRow + 2;
 }
 
-// Draws the main content of the screen body
+// Draws the visible rows of the screen body
 void UI::drawBody()
 {
-    // Draw the screen body content and calculate the pad height
+    // Keep the viewport inside the content if it has shrunk since the last frame
+    _scrollOffset = std::min(_scrollOffset, std::max(_padHeight - _maxContentHeight, 0));
+
+    // Draw the screen body content and calculate the content height
     int currentRow = 0;
-    _screen->drawScreen(currentRow, _bodyPad);
+    _frame.reset(_scrollOffset, _padRows);
+    _screen->drawScreen(currentRow, _frame);
     _padHeight = std::max(currentRow + 1, _maxContentHeight);
+
+    applyFrame();
+}
+
+// Writes the rows that differ from the previous frame into the pad
+void UI::applyFrame()
+{
+    int rowCount = std::min(_frame.getRowCount(), _padRows);
+    bool comparable = _lastFrame.getRowCount() == _frame.getRowCount();
+
+    for (int index = 0; index < rowCount; ++index)
+    {
+        const std::string &text = _frame.getVisibleRow(index);
+        if (comparable && text == _lastFrame.getVisibleRow(index))
+            continue;
+
+        // Clear first so a full-width row cannot wrap into the next one
+        wmove(_bodyPad, index, 0);
+        wclrtoeol(_bodyPad);
+        waddnstr(_bodyPad, text.c_str(), std::min(static_cast<int>(text.size()), _padWidth));
+    }
+
+    std::swap(_frame, _lastFrame);
+}
+
+// Reallocates the pad and forgets the previous frame so that the next one is written in full
+void UI::resizePad(int rows, int cols)
+{
+    _padRows = rows;
+    _padWidth = cols;
+    wresize(_bodyPad, _padRows, _padWidth);
+    werase(_bodyPad);
+    _lastFrame.reset(0, 0);
 }
 
 // // Draws the command line section at the bottom of the screen
@@ -294,12 +354,11 @@ void UI::drawCommandLine()
     wrefresh(_cmdLineWin);
 }
 
-// Clears the screen windows
+// Clears the header and command line windows; the body is updated row by row
 void UI::clearScreen()
 {
     werase(_headerWin);
     werase(_cmdLineWin);
-    werase(_bodyPad);
 }
 
 // Scrolls the screen body up by n lines
@@ -315,8 +374,60 @@ void UI::scrollDown(int lines)
     _scrollOffset = std::min(_scrollOffset + lines, maxOffset);
 }
 
-// Pauses execution briefly to prevent excessive CPU usage in the UI loop
-void UI::sleepBriefly(int intervalMs)
+// Blocks until there is keyboard input, a signal from the download engine, or a timer is due
+// Returns true if the download engine signalled a change of state
+bool UI::waitForActivity()
+{
+    if (!_manager)
+        return waitForDaemon();
+
+    pollfd fds[2] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {_manager->getEventFd(), POLLIN, 0},
+    };
+
+    poll(fds, 2, calcWaitTimeoutMs()); // EINTR (e.g. SIGWINCH) simply returns early
+    return _manager->consumeEventSignal();
+}
+
+// Blocks until there is keyboard input, a reply from the daemon, or the next status request is due
+// Returns true if the daemon replied; stops the UI if the daemon has gone away
+bool UI::waitForDaemon()
+{
+    pollfd fds[3] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {_commands->getFd(), POLLIN, 0},
+        {_status->getFd(), POLLIN, 0},
+    };
+
+    poll(fds, 3, calcWaitTimeoutMs());
+    bool replied = fds[1].revents != 0 || fds[2].revents != 0;
+    if (replied)
+    {
+        _commands->receive();
+        _status->receive();
+    }
+
+    if (!_commands->isConnected() || !_status->isConnected())
+        stop();
+    return replied;
+}
+
+// Returns how long the UI may sleep: until the next progress redraw while transfers are running
+// or while showing a daemon's downloads, or until the manager's next deadline, or indefinitely (-1) when idle
+int UI::calcWaitTimeoutMs() const
 {
-    std::this_thread::sleep_for(std::chrono::milliseconds(intervalMs));
+    auto timeout = _manager ? _manager->timeUntilNextUpdate() : std::chrono::milliseconds::max();
+
+    if (!_manager || !_manager->getActive().empty())
+    {
+        auto elapsed = std::chrono::steady_clock::now() - _lastFullUpdateTime;
+        auto untilRender = std::chrono::duration_cast<std::chrono::milliseconds>(RENDER_INTERVAL - elapsed);
+        timeout = std::min(timeout, std::max(untilRender, std::chrono::milliseconds(0)));
+    }
+
+    if (timeout == std::chrono::milliseconds::max())
+        return -1;
+
+    return static_cast<int>(std::min<long long>(timeout.count() + 1, INT_MAX)); // Round up past the deadline
 }
\ No newline at end of file
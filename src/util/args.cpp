@@ -1,6 +1,11 @@
 #include <sstream>
 #include <vector>
 #include <string>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+#include "util/args.hpp"
 
 std::vector<std::string> extractArguments(const std::string &command, size_t maxArgs)
 {
@@ -43,3 +48,25 @@ std::vector<std::string> extractArguments(const std::string &command, size_t max
 
     return parts;
 }
+
+// Parses an id or index argument, returning 0 if it is not a whole number; ids and indices start at 1
+uint64_t parseId(const std::string &text)
+{
+    if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])))
+        return 0;
+
+    char *end = nullptr;
+    errno = 0;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE)
+        return 0;
+    return value;
+}
+
+// Quotes an argument that contains spaces so that extractArguments reads it back as one argument
+std::string quoteArgument(const std::string &argument)
+{
+    if (argument.find(' ') == std::string::npos)
+        return argument;
+    return "\"" + argument + "\"";
+}
@@ -1,6 +1,13 @@
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 #include <cstdio>
 #include <string>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 #include "util/file.hpp"
 
@@ -48,4 +55,73 @@ std::string getUniqueFilename(const std::string &originalPath)
     }
 
     return originalPath; // Unreachable
-}
\ No newline at end of file
+}
+
+namespace
+{
+    // Copies every byte of one open file to another
+    bool copyContents(int in, int out)
+    {
+        char buffer[1 << 16];
+        while (true)
+        {
+            ssize_t count = read(in, buffer, sizeof(buffer));
+            if (count == 0)
+                return true;
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+
+            const char *data = buffer;
+            while (count > 0)
+            {
+                ssize_t written = write(out, data, static_cast<size_t>(count));
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                data += written;
+                count -= written;
+            }
+        }
+    }
+}
+
+// Makes a file at destination with the contents of source, as cheaply as the filesystem allows:
+// a reflink shares the blocks until either file is written, and a copy is the fallback where reflinks
+// are unsupported. The two files stay independent either way. Never replaces an existing file
+bool cloneFile(const std::string &source, const std::string &destination)
+{
+    int in = open(source.c_str(), O_RDONLY);
+    if (in < 0)
+        return false;
+
+    int out = open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0)
+    {
+        close(in);
+        close(out);
+        return true;
+    }
+#endif
+
+    bool copied = copyContents(in, out);
+    copied = close(out) == 0 && copied;
+    close(in);
+
+    if (!copied)
+        unlink(destination.c_str());
+    return copied;
+}
@@ -1,33 +1,160 @@
-#include <sstream>
-#include <stdio.h>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
 #include <time.h>
-#include <iomanip>
 
 #include "util/format.hpp"
 
-std::string formatBytes(double bytes) {
+namespace {
+    // Formatting a timestamp goes through localtime(), which consults the time zone on every call
+    // The render path formats the same timestamps frame after frame, so recent results are cached
+    struct CachedTime {
+        time_t time = 0;
+        size_t length = 0;
+        bool valid = false;
+        char text[FORMAT_TIME_SIZE];
+    };
+
+    constexpr size_t TIME_CACHE_SIZE = 64;
+    thread_local CachedTime timeCache[TIME_CACHE_SIZE];
+
+    // Copies at most size - 1 characters and terminates the buffer
+    size_t copyTerminated(char *buffer, size_t size, const char *text, size_t length) {
+        if (size == 0) {
+            return 0;
+        }
+
+        length = length < size - 1 ? length : size - 1;
+        std::memcpy(buffer, text, length);
+        buffer[length] = '\0';
+        return length;
+    }
+}
+
+size_t formatBytes(char *buffer, size_t size, double bytes) {
     const double KB = 1024.0;
     const double MB = KB * 1024.0;
     const double GB = MB * 1024.0;
 
-    std::ostringstream oss;
-    oss << std::fixed;
+    double value = bytes / KB;
+    int precision = 0;
+    const char *unit = " KB";
+
+    if (bytes >= GB) {
+        value = bytes / GB;
+        precision = 2;
+        unit = " GB";
+    } else if (bytes >= MB) {
+        value = bytes / MB;
+        precision = 1;
+        unit = " MB";
+    }
+
+    char text[FORMAT_BYTES_SIZE];
+    auto result = std::to_chars(text, text + sizeof(text) - 3, value, std::chars_format::fixed, precision);
+    if (result.ec != std::errc()) {
+        return copyTerminated(buffer, size, "?", 1);
+    }
+
+    std::memcpy(result.ptr, unit, 3);
+    return copyTerminated(buffer, size, text, static_cast<size_t>(result.ptr + 3 - text));
+}
+
+size_t formatTime(char *buffer, size_t size, time_t time) {
+    CachedTime &entry = timeCache[static_cast<size_t>(time) % TIME_CACHE_SIZE];
+    if (!entry.valid || entry.time != time) {
+        struct tm timeinfo{};
+        localtime_r(&time, &timeinfo);
+        entry.length = strftime(entry.text, sizeof(entry.text), "%H:%M:%S %d/%m/%y", &timeinfo);
+        entry.time = time;
+        entry.valid = true;
+    }
+
+    return copyTerminated(buffer, size, entry.text, entry.length);
+}
 
-    if (bytes < MB) {
-        oss << std::setprecision(0) << (bytes / KB) << " KB";
-    } else if (bytes < GB) {
-        oss << std::setprecision(1) << (bytes / MB) << " MB";
+// Picks the unit that keeps the value readable: "850 us", "12.4 ms", "3.25 s"
+size_t formatDuration(char *buffer, size_t size, int64_t microseconds) {
+    int length;
+    if (microseconds < 1000) {
+        length = std::snprintf(buffer, size, "%lld us", static_cast<long long>(microseconds));
+    } else if (microseconds < 1000000) {
+        length = std::snprintf(buffer, size, "%.1f ms", static_cast<double>(microseconds) / 1e3);
     } else {
-        oss << std::setprecision(2) << (bytes / GB) << " GB";
+        length = std::snprintf(buffer, size, "%.2f s", static_cast<double>(microseconds) / 1e6);
+    }
+
+    if (length < 0 || size == 0) {
+        return 0;
+    }
+    return static_cast<size_t>(length) < size ? static_cast<size_t>(length) : size - 1;
+}
+
+size_t formatProgressBar(char *buffer, size_t size, int64_t done, int64_t total, bool running) {
+    if (size == 0) {
+        return 0;
+    }
+
+    int64_t width = static_cast<int64_t>(size - 1);
+    int64_t filled = 0;
+    if (total > 0) {
+        filled = done * width / total;
+        filled = filled < width ? filled : width;
     }
 
-    return oss.str();
+    for (int64_t j = 0; j < width; ++j) {
+        if (j < filled) {
+            buffer[j] = '=';
+        } else if (j == filled) {
+            buffer[j] = running ? '>' : '|';
+        } else {
+            buffer[j] = ' ';
+        }
+    }
+    buffer[width] = '\0';
+    return static_cast<size_t>(width);
+}
+
+std::string formatBytes(double bytes) {
+    char buffer[FORMAT_BYTES_SIZE];
+    size_t length = formatBytes(buffer, sizeof(buffer), bytes);
+    return std::string(buffer, length);
 }
 
 std::string formatTime(time_t time) {
-    char buffer[20];
-    struct tm *timeinfo = localtime(&time);
-    strftime(buffer, sizeof(buffer), "%H:%M:%S %d/%m/%y", timeinfo);
-    
-    return std::string(buffer);
-}
\ No newline at end of file
+    char buffer[FORMAT_TIME_SIZE];
+    size_t length = formatTime(buffer, sizeof(buffer), time);
+    return std::string(buffer, length);
+}
+
+void appendJsonString(std::string &out, const std::string &text) {
+    out += '"';
+    for (char c : text) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+}
@@ -5,6 +5,7 @@
 #include <string>
 
 #include "util/http.hpp"
+#include "aux/Tracing.hpp"
 
 namespace http 
 {
@@ -114,13 +115,25 @@ namespace http
         curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow HTTP redirects
         curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
         curl_easy_setopt(curl, CURLOPT_HEADERDATA, &resolvedName);
+        applyStallPolicy(curl, task.getStallPolicy());
 
+        int64_t traceStart = tracing::isEnabled() ? tracing::now() : 0;
         CURLcode res = curl_easy_perform(curl);
 
+        TransferTimings timings;
+        readTimings(curl, timings);
+        task.setHeadTimings(timings);
+        tracing::transfer("HEAD", traceStart, timings, -1); // The task has no id until it is queued
+
         // Retrieve the HTTP response status code
-        int httpStatus;
+        long httpStatus = 0; // libcurl writes a long
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpStatus);
-        task.setHttpStatus(httpStatus);
+        task.setHttpStatus(static_cast<int>(httpStatus));
+
+        // A 429 or 503 may say when to ask again, should the lookup be retried
+        curl_off_t retryAfter = 0;
+        bool hasRetryAfter = curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retryAfter) == CURLE_OK && retryAfter > 0;
+        task.setRetryAfterSeconds(hasRetryAfter ? static_cast<int64_t>(retryAfter) : -1);
 
         // Treat HTTP status codes 400 and above as errors
         if (res == CURLE_OK && httpStatus >= 400)
@@ -151,4 +164,154 @@ namespace http
 
         return resolvedName;
     }
-}
\ No newline at end of file
+
+    // Extracts the lower-cased host from a URL, without scheme, credentials, port or path
+    // Returns an empty string if the URL has no host component
+    std::string extractHost(const std::string &url)
+    {
+        size_t start = url.find("://");
+        start = (start == std::string::npos) ? 0 : start + 3;
+
+        size_t end = url.find_first_of("/?#", start);
+        std::string authority = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+        // Strip any user information preceding the host
+        auto atPos = authority.rfind('@');
+        if (atPos != std::string::npos)
+        {
+            authority.erase(0, atPos + 1);
+        }
+
+        // Strip the port, taking care not to split bracketed IPv6 addresses
+        auto colonPos = authority.rfind(':');
+        if (colonPos != std::string::npos && authority.find(']', colonPos) == std::string::npos)
+        {
+            authority.erase(colonPos);
+        }
+
+        std::transform(authority.begin(), authority.end(), authority.begin(), ::tolower);
+        return authority;
+    }
+
+    // Reduces a URL to the form shared by every spelling of the same resource: the scheme and host
+    // lower-cased, a default port and a fragment dropped, and an empty path written as "/"
+    // The path and query are kept as they are, since servers may treat them case-sensitively
+    std::string normalizeUrl(const std::string &url)
+    {
+        size_t schemeEnd = url.find("://");
+        if (schemeEnd == std::string::npos)
+        {
+            return url.substr(0, url.find('#'));
+        }
+
+        std::string scheme = url.substr(0, schemeEnd);
+        std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+
+        size_t authorityStart = schemeEnd + 3;
+        size_t authorityEnd = url.find_first_of("/?#", authorityStart);
+        std::string authority = url.substr(authorityStart, authorityEnd == std::string::npos ? std::string::npos : authorityEnd - authorityStart);
+        std::string rest = authorityEnd == std::string::npos ? "" : url.substr(authorityEnd);
+        rest.erase(std::min(rest.find('#'), rest.size()));
+
+        // Lower-case the host, leaving any user information as it is
+        size_t hostStart = authority.rfind('@');
+        hostStart = hostStart == std::string::npos ? 0 : hostStart + 1;
+        std::transform(authority.begin() + static_cast<std::ptrdiff_t>(hostStart), authority.end(),
+                       authority.begin() + static_cast<std::ptrdiff_t>(hostStart), ::tolower);
+
+        if ((scheme == "http" && authority.size() > 3 && authority.compare(authority.size() - 3, 3, ":80") == 0) ||
+            (scheme == "https" && authority.size() > 4 && authority.compare(authority.size() - 4, 4, ":443") == 0))
+        {
+            authority.erase(authority.rfind(':'));
+        }
+
+        if (rest.empty() || rest[0] != '/')
+        {
+            rest.insert(0, "/");
+        }
+
+        return scheme + "://" + authority + rest;
+    }
+
+    // Reads the phase times and redirect count of a finished request
+    void readTimings(CURL *curl, TransferTimings &timings)
+    {
+        curl_off_t value = 0;
+        if (curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &value) == CURLE_OK)
+            timings.nameLookupUs = value;
+        if (curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &value) == CURLE_OK)
+            timings.connectUs = value;
+        if (curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &value) == CURLE_OK)
+            timings.appConnectUs = value;
+        if (curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &value) == CURLE_OK)
+            timings.startTransferUs = value;
+        if (curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &value) == CURLE_OK)
+            timings.totalUs = value;
+
+        long redirects = 0; // libcurl writes a long
+        if (curl_easy_getinfo(curl, CURLINFO_REDIRECT_COUNT, &redirects) == CURLE_OK)
+            timings.redirects = static_cast<int32_t>(redirects);
+    }
+
+    // Makes libcurl give up on a connection attempt that takes too long, and on a request that
+    // stays below the minimum speed for the whole window, whether waiting for a response or receiving it
+    void applyStallPolicy(CURL *curl, const StallPolicy &policy)
+    {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, static_cast<long>(policy.connectTimeout.count()));
+        if (policy.window.count() > 0)
+        {
+            curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, static_cast<long>(std::max<int64_t>(policy.minBytesPerSecond, 1)));
+            curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, static_cast<long>(policy.window.count()));
+        }
+    }
+
+    // Reads the value of a header line with the given name, compared case-insensitively, without
+    // surrounding whitespace or the line ending; returns false if the line holds another header
+    bool readHeaderValue(const std::string &line, const char *name, std::string &value)
+    {
+        size_t nameLength = std::char_traits<char>::length(name);
+        if (line.size() <= nameLength || line[nameLength] != ':')
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < nameLength; ++i)
+        {
+            if (std::tolower(static_cast<unsigned char>(line[i])) != std::tolower(static_cast<unsigned char>(name[i])))
+            {
+                return false;
+            }
+        }
+
+        size_t start = line.find_first_not_of(" \t", nameLength + 1);
+        size_t end = line.find_last_not_of(" \t\r\n");
+        value = (start == std::string::npos || end < start) ? std::string() : line.substr(start, end - start + 1);
+        return true;
+    }
+
+    // Returns true for failures that may not happen again: broken or refused connections, timeouts,
+    // and statuses a server uses to ask for a later attempt. Anything else fails the same way every time
+    bool isTransientError(CURLcode code, int httpStatus)
+    {
+        switch (code)
+        {
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_RANGE_ERROR: // Resume refused; the retry starts over
+        case CURLE_SSL_CONNECT_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return true;
+        case CURLE_HTTP_RETURNED_ERROR:
+            return httpStatus == 408 || httpStatus == 429 || httpStatus == 500 ||
+                   httpStatus == 502 || httpStatus == 503 || httpStatus == 504;
+        default:
+            return false;
+        }
+    }
+}
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util/sha256.hpp"
+
+namespace
+{
+    constexpr uint32_t ROUND_CONSTANTS[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    inline uint32_t rotateRight(uint32_t value, int bits)
+    {
+        return (value >> bits) | (value << (32 - bits));
+    }
+}
+
+void Sha256::reset()
+{
+    static constexpr uint32_t INITIAL_STATE[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    std::memcpy(_state, INITIAL_STATE, sizeof(_state));
+    _length = 0;
+    _blockUsed = 0;
+}
+
+void Sha256::update(const void *data, size_t length)
+{
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    _length += length;
+
+    // Top up a partly filled block first, then hash whole blocks straight from the input
+    if (_blockUsed > 0)
+    {
+        size_t count = std::min(length, sizeof(_block) - _blockUsed);
+        std::memcpy(_block + _blockUsed, bytes, count);
+        _blockUsed += count;
+        bytes += count;
+        length -= count;
+        if (_blockUsed < sizeof(_block))
+            return;
+        compress(_block);
+        _blockUsed = 0;
+    }
+
+    while (length >= sizeof(_block))
+    {
+        compress(bytes);
+        bytes += sizeof(_block);
+        length -= sizeof(_block);
+    }
+
+    std::memcpy(_block, bytes, length);
+    _blockUsed = length;
+}
+
+// Pads the message with a 1 bit, zeros and the length in bits, and writes out the state
+std::string Sha256::finishHex()
+{
+    uint64_t bitLength = _length * 8;
+    unsigned char padding[72] = {0x80};
+    size_t padLength = (_blockUsed < 56 ? 56 : 120) - _blockUsed;
+    for (int i = 0; i < 8; ++i)
+        padding[padLength + static_cast<size_t>(i)] = static_cast<unsigned char>(bitLength >> (56 - 8 * i));
+    update(padding, padLength + 8);
+
+    static constexpr char DIGITS[] = "0123456789abcdef";
+    std::string hex(64, '0');
+    for (size_t i = 0; i < 8; ++i)
+    {
+        for (size_t j = 0; j < 8; ++j)
+            hex[i * 8 + j] = DIGITS[(_state[i] >> (28 - 4 * j)) & 0xf];
+    }
+    return hex;
+}
+
+void Sha256::compress(const unsigned char *block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) | (static_cast<uint32_t>(block[i * 4 + 1]) << 16) |
+               (static_cast<uint32_t>(block[i * 4 + 2]) << 8) | static_cast<uint32_t>(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + choice + ROUND_CONSTANTS[i] + w[i];
+        uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + majority;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+    _state[4] += e;
+    _state[5] += f;
+    _state[6] += g;
+    _state[7] += h;
+}
+
+// Hashes a whole file; returns false if it cannot be read
+bool Sha256::hashFile(const std::string &path, std::string &hex)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    Sha256 hasher;
+    char buffer[1 << 16];
+    while (true)
+    {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count == 0)
+            break;
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return false;
+        }
+        hasher.update(buffer, static_cast<size_t>(count));
+    }
+
+    close(fd);
+    hex = hasher.finishHex();
+    return true;
+}